@@ -0,0 +1,472 @@
+// Headless physics benchmark. Seeds a reproducible particle set for each
+// requested count, runs a fixed number of simulation steps without any
+// rendering and reports throughput and per-phase cost as JSON or CSV.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+#include "particle_system.h"
+#include "profiler.h"
+#include "seeding.h"
+#include "simulation.h"
+#include "thread_pool.h"
+
+namespace {
+
+struct BenchConfig {
+  std::vector<int> counts = {1000, 10000, 100000, 1000000};
+  int steps = 100;
+  int warmupSteps = 10;
+  float deltaTime = 1.0f / 120.0f;
+  unsigned int seed = 12345;
+  int threads = 1;
+  bool deterministic = false;
+  SimulationEngine engine = SimulationEngine::TimeStepped;
+  // Time-stepped engine; each count is run once per listed integrator
+  std::vector<IntegratorKind> integrators = {IntegratorKind::Euler};
+  bool adaptive = false;
+  float maxDisplacement = 0.25f;
+  DistributedOptions distributed;
+  // Multiple of the interactive scene's particle density
+  double density = 1.0;
+  CollisionBackend backend = CollisionBackend::UniformGrid;
+  SeedingMode seeding = SeedingMode::PoissonDisk;
+  std::string format = "json";
+  std::string output;
+  std::string trace;
+};
+
+struct BenchResult {
+  int requested = 0;
+  IntegratorKind integrator = IntegratorKind::Euler;
+  int particles = 0;
+  int boxSize = 0;
+  double seedMs = 0.0;
+  double totalMs = 0.0;
+  PhaseTimings phases; // summed over all measured steps
+  CollisionCounts collisions; // summed too; zero without the profiler
+  double exchangeMs = 0.0;    // distributed engine's halo exchange, summed
+  int substeps = 0;           // summed over the measured steps
+  // Relative change in total energy over the measured steps; not measured
+  // for SPH, whose pressure potential it leaves out
+  bool energyMeasured = false;
+  double energyDrift = 0.0;
+};
+
+void printUsage() {
+  std::cerr
+      << "Usage: fluid-sim-bench [options]\n"
+         "  --counts N[,N...]   particle counts to sweep (default "
+         "1000,10000,100000,1000000)\n"
+         "  --steps N           measured steps per count (default 100)\n"
+         "  --warmup N          unmeasured steps before timing (default 10)\n"
+         "  --dt SECONDS        fixed step size (default 1/120)\n"
+         "  --seed N            particle generator seed (default 12345)\n"
+         "  --threads N         worker threads (default 1)\n"
+         "  --deterministic     use the thread-count independent collision "
+         "path\n"
+         "  --engine stepped|event|sph|distributed  time-stepped, "
+         "event-driven, SPH fluid or time-stepped across worker processes "
+         "(default stepped)\n"
+         "  --integrator euler|verlet|leapfrog|all  time-stepped integrator; "
+         "all runs each in turn (default euler)\n"
+         "  --adaptive          split steps into substeps by particle speed\n"
+         "  --max-displacement X  adaptive substep limit as a fraction of the "
+         "smallest radius (default 0.25)\n"
+         "  --workers N         distributed worker processes (default 4); "
+         "--threads is split between them\n"
+         "  --transport shm|socket  distributed transport (default shm)\n"
+         "  --density X         particle density relative to the viewer's "
+         "default scene (default 1)\n"
+         "  --backend grid|brute  collision broad phase (default grid)\n"
+         "  --seeding poisson|lattice  initial placement (default poisson)\n"
+         "  --format json|csv   output format (default json)\n"
+         "  --output FILE       write results to FILE instead of stdout\n"
+         "  --trace FILE        write a Chrome trace of the run to FILE\n";
+}
+
+bool parseCounts(const std::string &text, std::vector<int> &counts) {
+  counts.clear();
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    int count = std::atoi(item.c_str());
+    if (count <= 0) {
+      return false;
+    }
+    counts.push_back(count);
+  }
+  return !counts.empty();
+}
+
+bool parseArguments(int argc, char *argv[], BenchConfig &config) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      return false;
+    }
+    if (arg == "--deterministic") {
+      config.deterministic = true;
+      continue;
+    }
+    if (arg == "--adaptive") {
+      config.adaptive = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--counts") {
+      if (!parseCounts(value, config.counts)) {
+        std::cerr << "Invalid particle counts: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--steps") {
+      config.steps = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--warmup") {
+      config.warmupSteps = std::max(0, std::atoi(value.c_str()));
+    } else if (arg == "--dt") {
+      config.deltaTime = static_cast<float>(std::atof(value.c_str()));
+    } else if (arg == "--seed") {
+      config.seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+    } else if (arg == "--threads") {
+      config.threads = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--engine") {
+      if (value == "stepped") {
+        config.engine = SimulationEngine::TimeStepped;
+      } else if (value == "event") {
+        config.engine = SimulationEngine::EventDriven;
+      } else if (value == "sph") {
+        config.engine = SimulationEngine::Sph;
+      } else if (value == "distributed") {
+        config.engine = SimulationEngine::Distributed;
+      } else {
+        std::cerr << "Unknown engine: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--integrator") {
+      if (value == "euler") {
+        config.integrators = {IntegratorKind::Euler};
+      } else if (value == "verlet") {
+        config.integrators = {IntegratorKind::VelocityVerlet};
+      } else if (value == "leapfrog") {
+        config.integrators = {IntegratorKind::Leapfrog};
+      } else if (value == "all") {
+        config.integrators = {IntegratorKind::Euler, IntegratorKind::VelocityVerlet,
+                              IntegratorKind::Leapfrog};
+      } else {
+        std::cerr << "Unknown integrator: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--max-displacement") {
+      config.maxDisplacement = static_cast<float>(std::atof(value.c_str()));
+      if (!(config.maxDisplacement > 0.0f)) {
+        std::cerr << "Invalid maximum displacement: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--workers") {
+      config.distributed.workers = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--transport") {
+      if (value == "shm") {
+        config.distributed.transport = TransportKind::SharedMemory;
+      } else if (value == "socket") {
+        config.distributed.transport = TransportKind::UnixSocket;
+      } else {
+        std::cerr << "Unknown transport: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--density") {
+      config.density = std::atof(value.c_str());
+      if (!(config.density > 0.0)) {
+        std::cerr << "Invalid density: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--backend") {
+      if (value == "grid") {
+        config.backend = CollisionBackend::UniformGrid;
+      } else if (value == "brute") {
+        config.backend = CollisionBackend::BruteForce;
+      } else {
+        std::cerr << "Unknown backend: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--seeding") {
+      if (value == "poisson") {
+        config.seeding = SeedingMode::PoissonDisk;
+      } else if (value == "lattice") {
+        config.seeding = SeedingMode::JitteredLattice;
+      } else {
+        std::cerr << "Unknown seeding mode: " << value << std::endl;
+        return false;
+      }
+    } else if (arg == "--format") {
+      if (value != "json" && value != "csv") {
+        std::cerr << "Unknown format: " << value << std::endl;
+        return false;
+      }
+      config.format = value;
+    } else if (arg == "--output") {
+      config.output = value;
+    } else if (arg == "--trace") {
+      config.trace = value;
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Keeps the particle density at `density` times that of the interactive
+// default scene (INITIAL_PARTICLE_COUNT particles in a BARRIER_RADIUS square)
+// at every count.
+int boxSizeFor(int count, double density) {
+  double areaPerParticle = static_cast<double>(BARRIER_RADIUS) * BARRIER_RADIUS /
+                           INITIAL_PARTICLE_COUNT / density;
+  return std::max(BARRIER_RADIUS,
+                  static_cast<int>(std::ceil(std::sqrt(count * areaPerParticle))));
+}
+
+BenchResult runBenchmark(const BenchConfig &config, int count,
+                         IntegratorKind integrator) {
+  BenchResult result;
+  result.requested = count;
+  result.integrator = integrator;
+  result.boxSize = boxSizeFor(count, config.density);
+  const int windowSize = result.boxSize + 100;
+
+  auto seedStart = std::chrono::steady_clock::now();
+  Simulation simulation(barrierBounds(windowSize, windowSize, result.boxSize),
+                        config.threads);
+  simulation.settings.engine = config.engine;
+  simulation.settings.collisionBackend = config.backend;
+  simulation.settings.deterministic = config.deterministic;
+  simulation.settings.distributed = config.distributed;
+  simulation.settings.integrator = integrator;
+  simulation.settings.adaptiveSubsteps = config.adaptive;
+  simulation.settings.maxDisplacement = config.maxDisplacement;
+
+  // Same placement as generate_random_particles: 90% of the box, centred
+  const float inner = result.boxSize * 0.9f;
+  SeedingOptions seeding;
+  seeding.mode = config.seeding;
+  seeding.count = count;
+  seeding.region.left = (windowSize - inner) / 2.0f;
+  seeding.region.right = seeding.region.left + inner;
+  seeding.region.top = seeding.region.left;
+  seeding.region.bottom = seeding.region.right;
+  seeding.seed = config.seed;
+  seedParticles(simulation.particles(), seeding, &simulation.workers());
+  result.seedMs = millisecondsSince(seedStart);
+  result.particles = static_cast<int>(simulation.particles().size());
+
+  for (int i = 0; i < config.warmupSteps; ++i) {
+    simulation.step(config.deltaTime);
+  }
+
+  // Penalty springs plus kinetic energy. The distributed workers hold the
+  // particles, so they are gathered first.
+  const bool measureEnergy = config.engine != SimulationEngine::Sph;
+  double energyBefore = 0.0;
+  if (measureEnergy) {
+    simulation.syncParticles();
+    energyBefore = simulation.totalEnergy();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < config.steps; ++i) {
+    simulation.step(config.deltaTime);
+    result.substeps += simulation.substepCount();
+    const PhaseTimings &timings = simulation.timings();
+    result.phases.integrate += timings.integrate;
+    result.phases.barrier += timings.barrier;
+    result.phases.collide += timings.collide;
+    result.collisions.candidatePairs += simulation.collisionCounts().candidatePairs;
+    result.collisions.contacts += simulation.collisionCounts().contacts;
+    if (config.engine == SimulationEngine::Distributed) {
+      result.exchangeMs += simulation.distributedStats().exchangeMs;
+    }
+  }
+  result.totalMs = millisecondsSince(start);
+
+  if (measureEnergy && energyBefore > 0.0) {
+    simulation.syncParticles();
+    result.energyMeasured = true;
+    result.energyDrift = (simulation.totalEnergy() - energyBefore) / energyBefore;
+  }
+  return result;
+}
+
+double stepsPerSecond(const BenchConfig &config, const BenchResult &result) {
+  return config.steps / (result.totalMs / 1000.0);
+}
+
+double nsPerParticleStep(const BenchConfig &config, const BenchResult &result) {
+  if (result.particles == 0) {
+    return 0.0;
+  }
+  return result.totalMs * 1.0e6 /
+         (static_cast<double>(config.steps) * result.particles);
+}
+
+// The drift in scientific notation, or `missing` when it was not measured
+std::string energyDriftText(const BenchResult &result, const char *missing) {
+  if (!result.energyMeasured) {
+    return missing;
+  }
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.6e", result.energyDrift);
+  return text;
+}
+
+void writeJson(std::ostream &out, const BenchConfig &config,
+               const std::vector<BenchResult> &results) {
+  char line[768];
+  out << "{\n";
+  out << "  \"steps\": " << config.steps << ",\n";
+  out << "  \"warmup_steps\": " << config.warmupSteps << ",\n";
+  out << "  \"dt\": " << config.deltaTime << ",\n";
+  out << "  \"seed\": " << config.seed << ",\n";
+  out << "  \"threads\": " << config.threads << ",\n";
+  out << "  \"deterministic\": " << (config.deterministic ? "true" : "false")
+      << ",\n";
+  out << "  \"engine\": \"" << simulationEngineName(config.engine) << "\",\n";
+  out << "  \"adaptive_substeps\": " << (config.adaptive ? "true" : "false")
+      << ",\n";
+  if (config.adaptive) {
+    out << "  \"max_displacement\": " << config.maxDisplacement << ",\n";
+  }
+  if (config.engine == SimulationEngine::Distributed) {
+    out << "  \"workers\": " << config.distributed.workers << ",\n";
+    out << "  \"transport\": \"" << transportKindName(config.distributed.transport)
+        << "\",\n";
+  }
+  out << "  \"density\": " << config.density << ",\n";
+  out << "  \"backend\": \"" << collisionBackendName(config.backend) << "\",\n";
+  out << "  \"seeding\": \"" << seedingModeName(config.seeding) << "\",\n";
+  out << "  \"kernels\": \"" << particleKernelIsa() << "\",\n";
+  out << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    std::snprintf(
+        line, sizeof(line),
+        "    {\"requested\": %d, \"integrator\": \"%s\", \"particles\": %d, "
+        "\"box\": %d, \"seed_ms\": %.3f, \"total_ms\": %.3f, \"steps_per_sec\": %.3f, "
+        "\"ns_per_particle_step\": %.3f, \"integrate_ms\": %.4f, "
+        "\"barrier_ms\": %.4f, \"collide_ms\": %.4f, \"exchange_ms\": %.4f, "
+        "\"pairs_per_step\": %.1f, \"contacts_per_step\": %.1f, "
+        "\"substeps_per_step\": %.2f, \"energy_drift\": %s}%s\n",
+        r.requested, integratorKindName(r.integrator), r.particles, r.boxSize, r.seedMs, r.totalMs,
+        stepsPerSecond(config, r), nsPerParticleStep(config, r),
+        r.phases.integrate / config.steps, r.phases.barrier / config.steps,
+        r.phases.collide / config.steps, r.exchangeMs / config.steps,
+        static_cast<double>(r.collisions.candidatePairs) / config.steps,
+        static_cast<double>(r.collisions.contacts) / config.steps,
+        static_cast<double>(r.substeps) / config.steps,
+        energyDriftText(r, "null").c_str(),
+        i + 1 < results.size() ? "," : "");
+    out << line;
+  }
+  out << "  ]\n}\n";
+}
+
+void writeCsv(std::ostream &out, const BenchConfig &config,
+              const std::vector<BenchResult> &results) {
+  char line[768];
+  out << "requested,particles,box,threads,engine,integrator,backend,steps,"
+         "seed_ms,total_ms,steps_per_sec,ns_per_particle_step,integrate_ms,"
+         "barrier_ms,collide_ms,exchange_ms,pairs_per_step,contacts_per_step,"
+         "substeps_per_step,energy_drift\n";
+  for (const BenchResult &r : results) {
+    std::snprintf(line, sizeof(line),
+                  "%d,%d,%d,%d,%s,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f,"
+                  "%.4f,%.4f,%.1f,%.1f,%.2f,%s\n",
+                  r.requested, r.particles, r.boxSize, config.threads,
+                  simulationEngineName(config.engine),
+                  integratorKindName(r.integrator),
+                  collisionBackendName(config.backend), config.steps, r.seedMs,
+                  r.totalMs, stepsPerSecond(config, r),
+                  nsPerParticleStep(config, r),
+                  r.phases.integrate / config.steps,
+                  r.phases.barrier / config.steps,
+                  r.phases.collide / config.steps,
+                  r.exchangeMs / config.steps,
+                  static_cast<double>(r.collisions.candidatePairs) / config.steps,
+                  static_cast<double>(r.collisions.contacts) / config.steps,
+                  static_cast<double>(r.substeps) / config.steps,
+                  energyDriftText(r, "").c_str());
+    out << line;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  if (!parseArguments(argc, argv, config)) {
+    printUsage();
+    return 1;
+  }
+
+  std::vector<BenchResult> results;
+  for (int count : config.counts) {
+    for (IntegratorKind integrator : config.integrators) {
+      std::cerr << "Running " << count << " particles";
+      if (config.integrators.size() > 1) {
+        std::cerr << " (" << integratorKindName(integrator) << ")";
+      }
+      std::cerr << "..." << std::endl;
+      results.push_back(runBenchmark(config, count, integrator));
+      const BenchResult &r = results.back();
+      std::cerr << "  placed " << r.particles << " in " << r.seedMs << " ms, "
+                << stepsPerSecond(config, r) << " steps/s" << std::endl;
+    }
+  }
+
+  std::ostringstream report;
+  if (config.format == "csv") {
+    writeCsv(report, config, results);
+  } else {
+    writeJson(report, config, results);
+  }
+
+  if (config.output.empty()) {
+    std::cout << report.str();
+  } else {
+    FILE *file = std::fopen(config.output.c_str(), "w");
+    if (!file) {
+      std::cerr << "Could not open " << config.output << " for writing"
+                << std::endl;
+      return 1;
+    }
+    std::fputs(report.str().c_str(), file);
+    std::fclose(file);
+  }
+
+  if (!config.trace.empty()) {
+    std::string error;
+    if (!exportChromeTrace(config.trace, error)) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
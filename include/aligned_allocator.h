@@ -0,0 +1,65 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Minimal allocator returning storage aligned to `Alignment` bytes so that
+// SIMD kernels can stream whole cache lines from the start of each array.
+template <typename T, std::size_t Alignment = 32> struct AlignedAllocator {
+  typedef T value_type;
+
+  template <typename U> struct rebind {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+  T *allocate(std::size_t n) {
+    if (n == 0) {
+      return nullptr;
+    }
+    void *memory = nullptr;
+#ifdef _WIN32
+    memory = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+    if (posix_memalign(&memory, Alignment, n * sizeof(T)) != 0) {
+      memory = nullptr;
+    }
+#endif
+    if (!memory) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(memory);
+  }
+
+  void deallocate(T *pointer, std::size_t) {
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    free(pointer);
+#endif
+  }
+};
+
+template <typename T, typename U, std::size_t A>
+bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) {
+  return true;
+}
+
+template <typename T, typename U, std::size_t A>
+bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) {
+  return false;
+}
+
+typedef std::vector<float, AlignedAllocator<float> > AlignedFloatArray;
+
+#endif // ALIGNED_ALLOCATOR_H
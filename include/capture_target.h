@@ -0,0 +1,49 @@
+#ifndef CAPTURE_TARGET_H
+#define CAPTURE_TARGET_H
+
+#include "frame_capture.h"
+#include <SDL.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Renders frames into an offscreen texture and reads them back into a
+// FrameEncoder buffer, so captured frames never include the UI and do not
+// need a visible window. Frames are taken at a fixed rate of simulated time,
+// independent of both the step rate and the display rate.
+class CaptureTarget {
+public:
+  explicit CaptureTarget(SDL_Renderer *renderer) : renderer(renderer) {}
+  ~CaptureTarget() { stop(); }
+
+  CaptureTarget(const CaptureTarget &) = delete;
+  CaptureTarget &operator=(const CaptureTarget &) = delete;
+
+  bool start(const CaptureOptions &options, std::string &error);
+  // Waits for the queued frames to be written
+  void stop();
+  bool active() const { return encoder.isOpen(); }
+
+  // True once simulated time reaches the next capture tick. Ticks passed
+  // over between two calls are counted as skipped.
+  bool due(double simulationTime);
+  // Draws a frame with `draw` into the offscreen texture and queues it.
+  // Returns false if it was dropped because every buffer was in use.
+  bool capture(const std::function<void()> &draw);
+
+  CaptureStats stats() const { return encoder.stats(); }
+  uint64_t skipped() const { return skippedTicks; }
+  // Render and readback of the last captured frame
+  double captureMs() const { return lastCaptureMs; }
+
+private:
+  SDL_Renderer *renderer;
+  SDL_Texture *texture = nullptr;
+  FrameEncoder encoder;
+  double interval = 0.0;
+  double nextTime = -1.0;
+  uint64_t skippedTicks = 0;
+  double lastCaptureMs = 0.0;
+};
+
+#endif // CAPTURE_TARGET_H
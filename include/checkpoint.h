@@ -0,0 +1,77 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "mapped_file.h"
+#include "particle_system.h"
+#include "simulation.h"
+#include <cstdint>
+#include <string>
+
+// Checkpoints hold the full state needed to restart a run: every particle
+// array, the step count and simulated time, the RNG state and the barrier.
+//
+// Layout (native byte order, checked on load):
+//   CheckpointHeader
+//   x, y, vx, vy, radius, temperature  - particleCount floats each, every
+//                                        array starting on a 64-byte boundary
+// Speeds are not stored; they are recomputed from the velocities.
+const uint32_t CHECKPOINT_VERSION = 1;
+
+enum CheckpointArray {
+  CHECKPOINT_X,
+  CHECKPOINT_Y,
+  CHECKPOINT_VX,
+  CHECKPOINT_VY,
+  CHECKPOINT_RADIUS,
+  CHECKPOINT_TEMPERATURE,
+  CHECKPOINT_ARRAY_COUNT
+};
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder; // 0x01020304 as written by the saving machine
+  uint64_t particleCount;
+  uint64_t stepCount;
+  double simulationTime;
+  uint64_t rngState;
+  uint64_t rngIncrement;
+  float bounds[4]; // left, right, top, bottom
+  uint64_t arrayOffsets[CHECKPOINT_ARRAY_COUNT];
+};
+
+// Writes the simulation's state to `path`. The file is written beside the
+// target and renamed into place, so an interrupted save never leaves a
+// truncated checkpoint behind.
+bool saveCheckpoint(const std::string &path, const Simulation &simulation,
+                    std::string &error);
+
+// A checkpoint mapped into memory. The arrays are used in place, so opening
+// is cheap however large the file is and nothing is copied until restore().
+class MappedCheckpoint {
+public:
+  bool open(const std::string &path, std::string &error);
+  void close() { file.close(); }
+
+  size_t particleCount() const { return header().particleCount; }
+  uint64_t stepCount() const { return header().stepCount; }
+  double simulationTime() const { return header().simulationTime; }
+  BarrierBounds bounds() const;
+  const float *array(CheckpointArray which) const;
+
+  // Replaces the particles, clock, RNG and bounds of `simulation`
+  void restore(Simulation &simulation) const;
+
+private:
+  const CheckpointHeader &header() const {
+    return *reinterpret_cast<const CheckpointHeader *>(file.data());
+  }
+
+  MappedFile file;
+};
+
+// Convenience wrapper: maps `path` and restores it into `simulation`
+bool loadCheckpoint(const std::string &path, Simulation &simulation,
+                    std::string &error);
+
+#endif // CHECKPOINT_H
@@ -2,7 +2,36 @@
 #define COLOR_RAMP_H
 
 #include <SDL.h>
+#include <vector>
 
 SDL_Color velocityToColor(float speed, float maxVelocity);
 
+// velocityToColor sampled into a lookup table, so mapping a speed to a colour
+// is a multiply and a load instead of per-channel float math.
+class ColorRamp {
+public:
+  explicit ColorRamp(float maxVelocity, int size = 256);
+
+  SDL_Color lookup(float speed) const {
+    // Clamped as a float, since converting NaN or a huge value is undefined;
+    // NaN maps to the top of the ramp
+    float position = speed * scale;
+    if (!(position < static_cast<float>(last))) {
+      return table[last];
+    }
+    if (position < 0.0f) {
+      return table[0];
+    }
+    return table[static_cast<int>(position)];
+  }
+
+  float maxVelocity() const { return maximum; }
+
+private:
+  std::vector<SDL_Color> table;
+  float maximum;
+  float scale;
+  int last;
+};
+
 #endif // COLOR_RAMP_H
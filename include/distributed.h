@@ -0,0 +1,122 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "particle_system.h"
+#include "pcg32.h"
+#include "thermostat.h"
+#include "transport.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Simulation;
+
+struct DistributedOptions {
+  // Worker processes; fewer are used if the strips would be narrower than
+  // two halos
+  int workers = 4;
+  TransportKind transport = TransportKind::SharedMemory;
+  // Per direction of each shared-memory link
+  size_t ringBytes = 1 << 20;
+
+  bool operator==(const DistributedOptions &other) const {
+    return workers == other.workers && transport == other.transport &&
+           ringBytes == other.ringBytes;
+  }
+  bool operator!=(const DistributedOptions &other) const { return !(*this == other); }
+};
+
+// From the most recent step
+struct DistributedStats {
+  int workers = 0;
+  bool healthy = false; // no exchange has failed since start()
+  std::vector<uint32_t> owned; // particles per worker
+  uint64_t ghosts = 0;         // halo copies received, all workers
+  uint64_t migrated = 0;       // particles that changed worker
+  // Slowest worker's phases; exchange covers halo and migration
+  double integrateMs = 0.0;
+  double exchangeMs = 0.0;
+  double collideMs = 0.0;
+  // Summed over workers; only counted when the profiler is compiled in
+  uint64_t candidatePairs = 0;
+  uint64_t contacts = 0;
+};
+
+// Time-stepped simulation split across forked worker processes. The barrier
+// is cut into vertical strips, one per worker, and each worker runs its own
+// Simulation on the particles it owns. Every step:
+//
+//   1. workers integrate and reflect off the walls;
+//   2. each sends its neighbours the particles that crossed into their strip
+//      (migration) and copies of those within one halo of the shared edge
+//      (ghosts), in a single message per neighbour;
+//   3. workers collide owned particles against owned and ghost ones, then
+//      drop the ghosts;
+//   4. workers report the kinetic energy of each thermostat group, the
+//      coordinator turns the totals into one set of factors with its own
+//      random stream, and the workers apply them. Berendsen and velocity
+//      rescaling thus act on the whole system, not per strip; Andersen
+//      collisions draw from each worker's stream.
+//
+// The halo is twice the largest radius, so every touching pair that straddles
+// an edge is seen from both sides. The penalty impulse depends only on
+// positions, so both sides compute the same impulse for a pair and apply it
+// to their own particle, matching the single-process result. A worker also
+// keeps the particles it just sent away as ghosts, which covers pairs between
+// a migrant and its old strip.
+//
+// The coordinator (the process that calls start()) only sends commands,
+// chooses the thermostat factors and gathers particles on request; it owns no
+// particles between gathers.
+class DistributedEngine {
+public:
+  DistributedEngine() {}
+  ~DistributedEngine() { stop(); }
+
+  DistributedEngine(const DistributedEngine &) = delete;
+  DistributedEngine &operator=(const DistributedEngine &) = delete;
+
+  // Forks the workers. Each takes the particles in its strip of `source` and
+  // copies its settings and thermostat as they are at the fork.
+  bool start(const Simulation &source, const DistributedOptions &options,
+             std::string &error);
+  // Tells the workers to exit and reaps them
+  void stop();
+  bool running() const { return transport != nullptr; }
+  // As passed to start(); stats().workers says how many were used
+  const DistributedOptions &options() const { return current; }
+
+  // Steps the workers and applies `thermostat` across all of them, leaving
+  // the combined histogram and temperatures in it. Draws from `rng`.
+  bool step(float deltaTime, Thermostat &thermostat, Pcg32 &rng, std::string &error);
+  // Replaces `system` with every worker's particles. Handles into `system`
+  // go stale, since the order changes.
+  bool gather(ParticleSystem &system, std::string &error);
+
+  const DistributedStats &stats() const { return lastStats; }
+
+private:
+  bool childrenAlive();
+  // `values` are appended to the command after deltaTime
+  bool command(uint32_t command, float deltaTime, std::string &error,
+               const std::vector<float> *values = nullptr);
+
+  DistributedOptions current;
+  std::unique_ptr<TransportFabric> fabric;
+  std::unique_ptr<Transport> transport;
+  std::vector<int> children; // process ids, 0 once reaped
+  int workers = 0;
+  bool healthy = false; // no exchange has failed since start()
+  std::vector<char> commandBuffer;
+  std::vector<std::vector<char>> replies;
+  std::vector<OutgoingMessage> outgoing;
+  std::vector<IncomingMessage> incoming;
+  std::vector<double> groupEnergy;
+  std::vector<size_t> groupCount;
+  std::vector<SpeedHistogram> histograms;
+  DistributedStats lastStats;
+};
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,47 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include "constants.h"
+#include "particle_system.h"
+#include "pcg32.h"
+#include <cstddef>
+#include <cstdint>
+
+// Rectangle that spawns particles at a steady rate
+struct Emitter {
+  BarrierBounds region = {0.0f, 0.0f, 0.0f, 0.0f};
+  // Particles per second
+  float rate = 1000.0f;
+  float velocityX = 0.0f;
+  float velocityY = 0.0f;
+  // Each velocity component gets a uniform offset in [-jitter, jitter]
+  float velocityJitter = 20.0f;
+  float temperature = 10.0f;
+  float radius = PARTICLE_RADIUS;
+  bool enabled = true;
+  // Fraction of a particle carried over to the next step
+  float pending = 0.0f;
+};
+
+// Rectangle that removes every particle whose centre enters it
+struct Sink {
+  BarrierBounds region = {0.0f, 0.0f, 0.0f, 0.0f};
+  bool enabled = true;
+};
+
+// Particles added and removed by emitters and sinks
+struct SourceCounts {
+  uint64_t emitted = 0;
+  uint64_t absorbed = 0;
+};
+
+// Appends the particles `emitter` releases over deltaTime, at most `limit`
+// of them, and returns how many. Writes straight into the arrays, so nothing
+// is allocated while the system has spare capacity.
+size_t emitParticles(ParticleSystem &system, Emitter &emitter, float deltaTime,
+                     size_t limit, Pcg32 &rng);
+
+// Swap-removes every particle inside the sink and returns how many
+size_t absorbParticles(ParticleSystem &system, const Sink &sink);
+
+#endif // EMITTER_H
@@ -0,0 +1,118 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Rendered frames are 8-bit RGB, rows top to bottom with no padding
+enum class CaptureFormat {
+  // One headerless .rgb file per frame
+  Raw,
+  // One binary .ppm file per frame
+  Ppm,
+  // One .png file per frame, deflated with run-length matches only, which is
+  // cheap and still shrinks the mostly empty background a lot
+  Png,
+  // Raw frames written to the standard input of an external command, such
+  // as an ffmpeg reading rawvideo
+  Pipe
+};
+
+const char *captureFormatName(CaptureFormat format);
+
+struct CaptureOptions {
+  CaptureFormat format = CaptureFormat::Png;
+  // Sequences: path prefix that the frame number and extension are appended
+  // to. Pipe: the command to run, where {width}, {height} and {fps} are
+  // replaced by the frame size and rate.
+  std::string target = "fluid-sim-frame";
+  int width = 0;
+  int height = 0;
+  // Frames per second of simulated time; only passed on to the pipe command
+  // here, the caller decides when to capture
+  float framesPerSecond = 30.0f;
+  // Frame buffers shared by the renderer and the encoder. When all are in
+  // use new frames are dropped rather than stalling rendering.
+  int queueDepth = 4;
+};
+
+struct CaptureStats {
+  uint64_t framesCaptured = 0; // queued for encoding
+  uint64_t framesDropped = 0;  // no free buffer, or writing had failed
+  uint64_t framesWritten = 0;
+  uint64_t bytesWritten = 0;
+  int framesQueued = 0;
+  double encodeMs = 0.0; // last frame's encode and write
+  bool failed = false;   // a write failed; later frames are dropped
+};
+
+// Writes captured frames on a background thread. The caller renders straight
+// into a buffer from acquire() and hands it back with submit(), so capturing
+// costs one readback and no copies or I/O on the rendering thread.
+class FrameEncoder {
+public:
+  FrameEncoder() {}
+  ~FrameEncoder() { close(); }
+
+  FrameEncoder(const FrameEncoder &) = delete;
+  FrameEncoder &operator=(const FrameEncoder &) = delete;
+
+  bool open(const CaptureOptions &options, std::string &error);
+  // Writes out the frames still queued, then closes the output
+  void close();
+  bool isOpen() const { return opened; }
+  const CaptureOptions &options() const { return settings; }
+
+  // A free frame buffer of height * pitch() bytes, or nullptr (counted as a
+  // drop) if every buffer is queued. Must be followed by submit() or cancel().
+  uint8_t *acquire();
+  void submit();
+  // Returns the acquired buffer unused, e.g. when the readback failed
+  void cancel();
+  int pitch() const { return settings.width * 3; }
+
+  CaptureStats stats() const;
+
+private:
+  void run();
+  bool encode(const std::vector<uint8_t> &frame, uint64_t index);
+
+  CaptureOptions settings;
+  bool opened = false;
+  FILE *pipe = nullptr;
+
+  std::thread thread;
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  bool closing = false;
+  std::vector<std::vector<uint8_t>> frames;
+  std::vector<int> freeFrames;
+  std::deque<int> queuedFrames;
+  int acquired = -1;
+
+  // Encoder state, only touched by the background thread
+  std::vector<uint8_t> buffer;
+  std::vector<uint8_t> scanlines;
+  uint64_t nextIndex = 0;
+
+  std::atomic<uint64_t> framesCaptured{0};
+  std::atomic<uint64_t> framesDropped{0};
+  std::atomic<uint64_t> framesWritten{0};
+  std::atomic<uint64_t> bytesWritten{0};
+  std::atomic<double> encodeMs{0.0};
+  std::atomic<bool> writeFailed{false};
+};
+
+// Encodes an RGB image as PNG into `out` (replacing its contents).
+// `scratch` holds the filtered scanlines, kept by the caller for reuse.
+void encodePng(const uint8_t *pixels, int width, int height,
+               std::vector<uint8_t> &out, std::vector<uint8_t> &scratch);
+
+#endif // FRAME_CAPTURE_H
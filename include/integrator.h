@@ -0,0 +1,77 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "particle_system.h"
+#include <cstddef>
+
+// Time integration schemes of the time-stepped engine. Every scheme makes one
+// penalty force evaluation per (sub)step, between its beforeForces() and
+// afterForces() halves.
+enum class IntegratorKind {
+  // Drift with the old velocity, then kick with the new forces. The
+  // original scheme: first order, but symplectic.
+  Euler,
+  // Half kick with the previous forces, drift, half kick with the new ones.
+  // Second order; the forces are kept from one step to the next.
+  VelocityVerlet,
+  // Half drift, kick at the midpoint, half drift. Second order and needs no
+  // forces from the previous step.
+  Leapfrog
+};
+
+const char *integratorKindName(IntegratorKind kind);
+
+// The schemes as policies for Simulation's stepping template, so each gets
+// its own step loop with the halves inlined and nothing decided per particle.
+// Both halves run over [begin, end) of the particles with the accelerations
+// of the last force evaluation.
+struct EulerIntegrator {
+  static const bool USES_PREVIOUS_FORCES = false;
+  static const bool DRIFTS_AFTER_FORCES = false;
+
+  static void beforeForces(ParticleSystem &system, const float *, const float *,
+                           float deltaTime, size_t begin, size_t end) {
+    system.integrate(deltaTime, begin, end);
+  }
+  static void afterForces(ParticleSystem &system, const float *accelerationX,
+                          const float *accelerationY, float deltaTime,
+                          size_t begin, size_t end) {
+    system.kick(accelerationX, accelerationY, deltaTime, begin, end);
+  }
+};
+
+struct VelocityVerletIntegrator {
+  static const bool USES_PREVIOUS_FORCES = true;
+  static const bool DRIFTS_AFTER_FORCES = false;
+
+  static void beforeForces(ParticleSystem &system, const float *accelerationX,
+                           const float *accelerationY, float deltaTime,
+                           size_t begin, size_t end) {
+    system.kick(accelerationX, accelerationY, 0.5f * deltaTime, begin, end);
+    system.integrate(deltaTime, begin, end);
+  }
+  static void afterForces(ParticleSystem &system, const float *accelerationX,
+                          const float *accelerationY, float deltaTime,
+                          size_t begin, size_t end) {
+    system.kick(accelerationX, accelerationY, 0.5f * deltaTime, begin, end);
+  }
+};
+
+struct LeapfrogIntegrator {
+  static const bool USES_PREVIOUS_FORCES = false;
+  // The closing half drift can cross a wall, so walls are reflected again
+  static const bool DRIFTS_AFTER_FORCES = true;
+
+  static void beforeForces(ParticleSystem &system, const float *, const float *,
+                           float deltaTime, size_t begin, size_t end) {
+    system.integrate(0.5f * deltaTime, begin, end);
+  }
+  static void afterForces(ParticleSystem &system, const float *accelerationX,
+                          const float *accelerationY, float deltaTime,
+                          size_t begin, size_t end) {
+    system.kick(accelerationX, accelerationY, deltaTime, begin, end);
+    system.integrate(0.5f * deltaTime, begin, end);
+  }
+};
+
+#endif // INTEGRATOR_H
@@ -2,7 +2,6 @@
 #define PARTICLE_H
 
 #include "constants.h"
-#include <SDL.h>
 #include <random>
 #include <vector>
 
@@ -19,8 +18,6 @@ struct Particle {
 
 void calculateParticleVelocity(Particle &particle);
 
-void DrawParticle(SDL_Renderer *renderer, Particle &particle, SDL_Color color);
-
 void UpdateParticle(Particle &particle, float deltaTime, int window_width,
                   int window_height, int barrier_radius);
 
@@ -34,4 +31,12 @@ std::vector<Particle> generate_random_particles(int count, int window_width,
                                             int barrier_radius,
                                             int particle_radius);
 
+// Same as above but reproducible: the generator is seeded with `seed`
+// instead of std::random_device.
+std::vector<Particle> generate_random_particles(int count, int window_width,
+                                            int window_height,
+                                            int barrier_radius,
+                                            int particle_radius,
+                                            unsigned int seed);
+
 #endif // PARTICLE_H
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef PARTICLE_RENDERER_H
+#define PARTICLE_RENDERER_H
+
+#include "color_ramp.h"
+#include "particle.h"
+#include "particle_snapshot.h"
+#include <SDL.h>
+#include <vector>
+
+void DrawParticle(SDL_Renderer *renderer, Particle &particle, SDL_Color color);
+
+enum class RenderBackend { Gfx, Batched };
+
+const char *renderBackendName(RenderBackend backend);
+
+// Draws a snapshot's particles with one of two backends:
+//  - Gfx: one SDL2_gfx aacircleRGBA call per particle (software raster)
+//  - Batched: a textured quad per particle, all submitted in a single
+//    SDL_RenderGeometry call using a pre-baked anti-aliased disc texture
+class ParticleRenderer {
+public:
+  ParticleRenderer(SDL_Renderer *renderer, float maxVelocity);
+  ~ParticleRenderer();
+
+  ParticleRenderer(const ParticleRenderer &) = delete;
+  ParticleRenderer &operator=(const ParticleRenderer &) = delete;
+
+  void draw(const ParticleSnapshot &snapshot, RenderBackend backend);
+
+  // CPU time spent in the last draw() call
+  double lastDrawMs() const { return drawMs; }
+
+private:
+  void drawGfx(const ParticleSnapshot &snapshot);
+  void drawBatched(const ParticleSnapshot &snapshot);
+  void bakeCircleTexture();
+
+  SDL_Renderer *renderer;
+  SDL_Texture *circleTexture = nullptr;
+  ColorRamp ramp;
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+  double drawMs = 0.0;
+};
+
+#endif // PARTICLE_RENDERER_H
@@ -0,0 +1,37 @@
+#ifndef PARTICLE_SNAPSHOT_H
+#define PARTICLE_SNAPSHOT_H
+
+#include "simulation.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only copy of the state the viewer needs, published after each batch
+// of physics steps or decoded from a recorded trajectory.
+struct ParticleSnapshot {
+  std::vector<float> x, y;
+  std::vector<float> radius;
+  std::vector<float> speed; // drives the colour ramp
+
+  uint64_t stepCount = 0;
+  double simulationTime = 0.0;
+  float averageSpeed = 0.0f;
+  float stepsPerSecond = 0.0f;
+  int threadCount = 1;
+  PhaseTimings timings;
+  int substeps = 1; // time-stepped engine only
+  CollisionCounts collisions;
+  EventStats events; // event-driven engine only
+  SourceCounts sources;
+  // From the thermostat; time-stepped engine only
+  SpeedHistogram speedHistogram;
+  std::vector<float> temperatures;
+  DistributedStats distributed; // distributed engine only
+  std::string distributedError;
+  uint64_t distributedFallbacks = 0;
+  BarrierBounds bounds = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  size_t size() const { return x.size(); }
+};
+
+#endif // PARTICLE_SNAPSHOT_H
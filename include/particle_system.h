@@ -0,0 +1,166 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include "aligned_allocator.h"
+#include "particle.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Inner edges of the square barrier, as used by checkBarrierCollision.
+struct BarrierBounds {
+  float left, right, top, bottom;
+};
+
+BarrierBounds barrierBounds(int window_width, int window_height,
+                            int barrier_radius);
+
+// Reference to one particle stored inside a ParticleSystem. Lets code written
+// against the Particle struct read and write individual fields in place.
+struct ParticleRef {
+  float &x, &y;
+  float &vx, &vy;
+  float &speed;
+  float &radius;
+  float &temperature;
+
+  operator Particle() const;
+  ParticleRef &operator=(const Particle &particle);
+};
+
+// Stable reference to a particle in a ParticleSystem. Dense indices move
+// when particles are removed; a handle keeps finding its particle until that
+// particle is removed, after which it is stale and lookups fail, even once
+// its slot has been reused.
+struct ParticleHandle {
+  static const uint32_t NONE = 0xffffffffu;
+
+  uint32_t slot = NONE;
+  uint32_t generation = 0;
+
+  bool operator==(const ParticleHandle &other) const {
+    return slot == other.slot && generation == other.generation;
+  }
+  bool operator!=(const ParticleHandle &other) const { return !(*this == other); }
+};
+
+// Structure-of-arrays particle container. Each field lives in its own
+// 32-byte aligned array so the batch kernels below only touch the fields they
+// need and can be vectorized.
+//
+// The arrays stay dense: removal swaps the last particle into the hole. A
+// slot table on the side maps handles to dense indices, and freed slots are
+// recycled with their generation bumped, so once capacity is reserved,
+// adding and removing particles does not allocate.
+class ParticleSystem {
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  ParticleSystem() {}
+  explicit ParticleSystem(const std::vector<Particle> &particles);
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+  size_t capacity() const { return x.capacity(); }
+  void reserve(size_t capacity);
+  // New particles are zeroed and get fresh handles; dropped ones are removed
+  void resize(size_t count);
+  void clear();
+
+  ParticleHandle add(const Particle &particle);
+  // Swap-removes the particle at dense index i, so the last particle moves to i
+  void remove(size_t i);
+  // Returns false if the handle is stale
+  bool remove(ParticleHandle handle);
+
+  ParticleHandle handle(size_t i) const;
+  bool contains(ParticleHandle handle) const { return indexOf(handle) != npos; }
+  // Dense index of the particle, or npos if the handle is stale
+  size_t indexOf(ParticleHandle handle) const;
+  Particle get(size_t i) const;
+  void set(size_t i, const Particle &particle);
+  ParticleRef operator[](size_t i);
+  std::vector<Particle> toParticles() const;
+
+  // Batch kernels. The ranged overloads process [begin, end) so callers can
+  // split the work into chunks.
+  void integrate(float deltaTime);
+  void integrate(float deltaTime, size_t begin, size_t end);
+  // Adds (accelerationX, accelerationY) * deltaTime to the velocities
+  void kick(const float *accelerationX, const float *accelerationY,
+            float deltaTime, size_t begin, size_t end);
+  void reflectWalls(const BarrierBounds &bounds);
+  void reflectWalls(const BarrierBounds &bounds, size_t begin, size_t end);
+  void computeSpeeds();
+  void computeSpeeds(size_t begin, size_t end);
+
+  AlignedFloatArray x, y;
+  AlignedFloatArray vx, vy;
+  AlignedFloatArray speed;
+  AlignedFloatArray radius;
+  AlignedFloatArray temperature;
+
+private:
+  uint32_t acquireSlot(uint32_t index);
+  void releaseSlot(uint32_t slot);
+
+  // slotIndex[slot] is the dense index of the slot's particle (NONE when
+  // free); denseSlot is the inverse
+  std::vector<uint32_t> slotIndex, slotGeneration, freeSlots;
+  std::vector<uint32_t> denseSlot;
+};
+
+// Acceleration per pixel of overlap between two touching particles (unit
+// masses). The original response added overlap * 5 to the velocities once a
+// step; this is that at the reference rate of 120 steps per second, as a
+// force that scales with the step.
+const float PENALTY_STIFFNESS = 600.0f;
+const float PENALTY_REFERENCE_STEP = 1.0f / 120.0f;
+
+// Penalty acceleration between two overlapping particles. Returns false when
+// they do not touch; otherwise (accelerationX, accelerationY) pushes particle
+// j and its negation pushes particle i. The matching potential is
+// PENALTY_STIFFNESS * overlap^2 / 2.
+inline bool penaltyAcceleration(const ParticleSystem &system, size_t i, size_t j,
+                                float &accelerationX, float &accelerationY) {
+  float dx = system.x[j] - system.x[i];
+  float dy = system.y[j] - system.y[i];
+  float distance = std::sqrt(dx * dx + dy * dy);
+  float radii = system.radius[i] + system.radius[j];
+
+  if (!(distance < radii)) {
+    return false;
+  }
+
+  float overlap = radii - distance;
+  float nx = dx / distance;
+  float ny = dy / distance;
+  float forceStrength = overlap * PENALTY_STIFFNESS;
+
+  accelerationX = nx * forceStrength;
+  accelerationY = ny * forceStrength;
+  return true;
+}
+
+// Applies one reference step of the penalty response to both velocities,
+// matching CheckCollision(Particle &, Particle &). Returns whether the pair
+// was in contact.
+inline bool CheckCollision(ParticleSystem &system, size_t i, size_t j) {
+  float accelerationX, accelerationY;
+  if (penaltyAcceleration(system, i, j, accelerationX, accelerationY)) {
+    const float impulseX = accelerationX * PENALTY_REFERENCE_STEP;
+    const float impulseY = accelerationY * PENALTY_REFERENCE_STEP;
+    system.vx[i] -= impulseX;
+    system.vy[i] -= impulseY;
+    system.vx[j] += impulseX;
+    system.vy[j] += impulseY;
+    return true;
+  }
+  return false;
+}
+
+// Name of the instruction set the batch kernels were compiled for.
+const char *particleKernelIsa();
+
+#endif // PARTICLE_SYSTEM_H
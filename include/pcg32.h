@@ -0,0 +1,43 @@
+#ifndef PCG32_H
+#define PCG32_H
+
+#include <cstdint>
+
+// PCG32 generator (O'Neill, pcg-random.org). The whole state is two 64-bit
+// words, so it is cheap to give every tile or particle its own stream and
+// trivial to save and restore.
+struct Pcg32 {
+  uint64_t state = 0x853c49e6748fea9bULL;
+  uint64_t increment = 0xda3e39cb94b95bdbULL;
+
+  Pcg32() {}
+  Pcg32(uint64_t seed, uint64_t stream) { reseed(seed, stream); }
+
+  void reseed(uint64_t seed, uint64_t stream) {
+    state = 0;
+    increment = (stream << 1u) | 1u;
+    next();
+    state += seed;
+    next();
+  }
+
+  uint32_t next() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + increment;
+    uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+    uint32_t rotation = static_cast<uint32_t>(old >> 59u);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  // Uniform in [0, 1)
+  float nextFloat() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+  float uniform(float low, float high) { return low + (high - low) * nextFloat(); }
+
+  // Uniform in [0, bound)
+  uint32_t nextBelow(uint32_t bound) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(next()) * bound) >> 32);
+  }
+};
+
+#endif // PCG32_H
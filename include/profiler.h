@@ -0,0 +1,85 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped timers and counters for the hot paths. Each thread records into its
+// own fixed-size ring, so recording is a handful of relaxed stores with no
+// locks or allocation. Build with FLUID_SIM_PROFILER=0 to compile every
+// PROFILE_* macro out entirely.
+#ifndef FLUID_SIM_PROFILER
+#define FLUID_SIM_PROFILER 1
+#endif
+
+enum class ProfileEventKind { Scope, Counter };
+
+// A recorded event, as returned by collectProfileEvents(). Times are in
+// nanoseconds since the profiler's epoch.
+struct ProfileEvent {
+  const char *name;
+  ProfileEventKind kind;
+  int thread;
+  uint64_t start; // scopes: entry time; counters: sample time
+  uint64_t end;   // scopes: exit time; counters: same as start
+  int64_t value;  // counters only
+};
+
+// Per-name totals over a window of events
+struct ProfileSummary {
+  const char *name;
+  int calls;
+  double totalMs;
+  double maxMs;
+};
+
+uint64_t profileNow();
+
+// Labels the calling thread in the profiler window and exported traces.
+void setProfileThreadName(const std::string &name);
+
+void recordProfileScope(const char *name, uint64_t start, uint64_t end);
+void recordProfileCounter(const char *name, int64_t value);
+
+// Gathers the events from every thread that were recorded at or after
+// `since`, oldest first per thread. Safe to call while threads record.
+void collectProfileEvents(std::vector<ProfileEvent> &events, uint64_t since = 0);
+
+// Totals scopes by name, in order of first appearance
+void summarizeProfile(const std::vector<ProfileEvent> &events,
+                      std::vector<ProfileSummary> &summaries);
+
+// Writes every buffered event in the Chrome trace event format, for
+// chrome://tracing or ui.perfetto.dev.
+bool exportChromeTrace(const std::string &path, std::string &error);
+
+// Times the enclosing scope. `name` must outlive the profiler (use literals).
+class ProfileScope {
+public:
+  explicit ProfileScope(const char *name) : name(name), start(profileNow()) {}
+  ~ProfileScope() { recordProfileScope(name, start, profileNow()); }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  const char *name;
+  uint64_t start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if FLUID_SIM_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) recordProfileCounter(name, value)
+// Bookkeeping that only exists to feed the profiler
+#define PROFILE_ONLY(...) __VA_ARGS__
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_ONLY(...)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,45 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+
+// Fixed-capacity history that overwrites its oldest entry once full. Storage
+// is inline, so pushing never allocates.
+template <typename T, size_t Capacity> class RingBuffer {
+public:
+  void push(const T &value) {
+    items[head] = value;
+    head = (head + 1) % Capacity;
+    if (count < Capacity) {
+      ++count;
+    }
+  }
+
+  void clear() {
+    head = 0;
+    count = 0;
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  static size_t capacity() { return Capacity; }
+
+  // Index 0 is the oldest entry
+  const T &operator[](size_t i) const {
+    return items[(head + Capacity - count + i) % Capacity];
+  }
+  const T &back() const { return items[(head + Capacity - 1) % Capacity]; }
+
+  // Raw storage and the position of the oldest entry in it, for consumers
+  // such as ImGui::PlotLines that take a wrapped array plus an offset.
+  const T *data() const { return items; }
+  T *data() { return items; }
+  size_t offset() const { return count < Capacity ? 0 : head; }
+
+private:
+  T items[Capacity];
+  size_t head = 0;
+  size_t count = 0;
+};
+
+#endif // RING_BUFFER_H
@@ -0,0 +1,48 @@
+#ifndef SEEDING_H
+#define SEEDING_H
+
+#include "constants.h"
+#include "particle_system.h"
+#include "thread_pool.h"
+#include <cstdint>
+
+enum class SeedingMode {
+  // Blue-noise placement (Bridson's algorithm on a background grid). Avoids
+  // particles already in the system.
+  PoissonDisk,
+  // Regular lattice with each point jittered inside its cell. Densest and
+  // fastest; ignores particles already in the system.
+  JitteredLattice
+};
+
+const char *seedingModeName(SeedingMode mode);
+
+struct SeedingOptions {
+  SeedingMode mode = SeedingMode::PoissonDisk;
+  int count = 0;
+  // Rectangle the particles must fit inside, edges included
+  BarrierBounds region = {0.0f, 0.0f, 0.0f, 0.0f};
+  float particleRadius = PARTICLE_RADIUS;
+  // Minimum centre distance as a multiple of the two radii
+  float spacing = 1.1f;
+  // Velocity components are uniform in [-maxSpeed, maxSpeed]
+  float maxSpeed = 100.0f;
+  // Temperatures are uniform in [0, maxTemperature]
+  float maxTemperature = 100.0f;
+  uint64_t seed = 0;
+};
+
+struct SeedingResult {
+  int requested = 0;
+  int placed = 0;
+};
+
+// Appends options.count new particles to `system`. Fewer are placed only when
+// the region cannot hold that many at the requested spacing. The result
+// depends only on the options (including the seed), never on the number of
+// threads in `pool`, which may be null to run on the calling thread.
+SeedingResult seedParticles(ParticleSystem &system,
+                            const SeedingOptions &options,
+                            ThreadPool *pool = nullptr);
+
+#endif // SEEDING_H
@@ -0,0 +1,222 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "aligned_allocator.h"
+#include "distributed.h"
+#include "emitter.h"
+#include "event_driven.h"
+#include "integrator.h"
+#include "particle_system.h"
+#include "pcg32.h"
+#include "profiler.h"
+#include "spatial_grid.h"
+#include "sph.h"
+#include "thermostat.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class SimulationEngine {
+  // Fixed-step integration with penalty-force collisions
+  TimeStepped,
+  // Exact hard-sphere dynamics, jumping between predicted collisions
+  EventDriven,
+  // Weakly compressible smoothed-particle hydrodynamics
+  Sph,
+  // Time-stepped, split across worker processes (see DistributedEngine)
+  Distributed
+};
+
+const char *simulationEngineName(SimulationEngine engine);
+
+struct SimulationSettings {
+  SimulationEngine engine = SimulationEngine::TimeStepped;
+  // Time-stepped engine only
+  CollisionBackend collisionBackend = CollisionBackend::UniformGrid;
+  IntegratorKind integrator = IntegratorKind::Euler;
+  // Split each step into the fewest equal substeps that keep the fastest
+  // particle's move within maxDisplacement times the smallest radius, and
+  // resolve the penalty spring, up to maxSubsteps
+  bool adaptiveSubsteps = false;
+  float maxDisplacement = 0.25f;
+  int maxSubsteps = 16;
+  // Resolve collisions in an order that does not depend on the thread count,
+  // so that results are bitwise identical however many threads are used.
+  bool deterministic = false;
+  // Emitters stop adding particles at this count. Storage for it is reserved
+  // the first time an emitter runs, so steady emission does not allocate.
+  size_t particleLimit = 500000;
+  // Distributed engine only
+  DistributedOptions distributed;
+
+  bool operator==(const SimulationSettings &other) const {
+    return engine == other.engine && collisionBackend == other.collisionBackend &&
+           integrator == other.integrator &&
+           adaptiveSubsteps == other.adaptiveSubsteps &&
+           maxDisplacement == other.maxDisplacement &&
+           maxSubsteps == other.maxSubsteps && deterministic == other.deterministic &&
+           particleLimit == other.particleLimit && distributed == other.distributed;
+  }
+  bool operator!=(const SimulationSettings &other) const { return !(*this == other); }
+};
+
+// Wall-clock cost of each phase of the most recent step, in milliseconds,
+// summed over its substeps.
+// The event-driven engine has no separate phases and reports its whole cost
+// as collide. SPH reports its whole cost as integrate. The distributed engine
+// reports its slowest worker's integrate and collide; its halo exchange is in
+// DistributedStats.
+struct PhaseTimings {
+  double integrate = 0.0;
+  double barrier = 0.0;
+  double collide = 0.0;
+};
+
+// Narrow-phase work done by the most recent step. The time-stepped paths only
+// count when the profiler is compiled in. The event-driven engine always
+// counts: pairs are collision-time predictions, contacts are collisions. SPH
+// reports its neighbour-list length as pairs and no contacts. The distributed
+// engine sums its workers' counts.
+struct CollisionCounts {
+  uint64_t candidatePairs = 0;
+  uint64_t contacts = 0;
+};
+
+// Owns the particle state and runs the integrate / barrier / collide phases
+// of a step across a worker pool, with the integrator chosen in the settings
+// and optionally in substeps, or hands the step to the event-driven
+// engine, the SPH solver or the worker processes. Emitters and sinks run
+// first in every step, except with the distributed engine.
+//
+// With the distributed engine the particles live in the workers, and
+// particles() only holds them as of the last syncParticles(). Call that
+// before reading them and particlesEdited() after changing them.
+class Simulation {
+public:
+  explicit Simulation(const BarrierBounds &bounds, int threadCount = 1);
+
+  void step(float deltaTime);
+
+  // Individual phases of a time-stepped step. computeForces() fills the
+  // penalty accelerations; collide() computes them and applies them for
+  // deltaTime, which is the second half of an Euler step.
+  void integrate(float deltaTime);
+  void reflectWalls();
+  void computeForces();
+  void collide(float deltaTime);
+
+  // Substeps the last time-stepped step was split into
+  int substepCount() const { return substeps; }
+  // Kinetic plus penalty potential energy, for unit masses. Rebuilds the
+  // collision grid, so call it between steps.
+  double totalEnergy();
+
+  // Runs the thermostat (see ThermostatSettings) over every particle
+  void applyThermostat(float deltaTime);
+
+  ParticleSystem &particles() { return system; }
+  const ParticleSystem &particles() const { return system; }
+  const BarrierBounds &bounds() const { return barrier; }
+  void setBounds(const BarrierBounds &bounds) { barrier = bounds; }
+  const PhaseTimings &timings() const { return phaseTimings; }
+  const CollisionCounts &collisionCounts() const { return collisions; }
+  const EventStats &eventStats() const { return events.stats(); }
+  // Totals since construction
+  const SourceCounts &sourceCounts() const { return sources; }
+  SphSolver &sphSolver() { return sph; }
+  const SphSolver &sphSolver() const { return sph; }
+  Thermostat &thermostat() { return thermo; }
+  const Thermostat &thermostat() const { return thermo; }
+
+  // Copies the particles back from the distributed workers if they have
+  // stepped since the last call. Invalidates particle handles when it does.
+  void syncParticles();
+  // The workers restart from particles() before the next distributed step
+  void particlesEdited() {
+    domainsDirty = true;
+    forcesValid = false;
+  }
+  const DistributedStats &distributedStats() const { return domains.stats(); }
+  // Why the distributed engine last fell back to the time-stepped one
+  const std::string &distributedError() const { return domainError; }
+  // How many times the distributed engine has fallen back to time stepping
+  uint64_t distributedFallbacks() const { return fallbacks; }
+
+  void setThreadCount(int threadCount);
+  int threadCount() const { return pool.threadCount(); }
+  // The pool the phases run on, for other bulk work between steps
+  ThreadPool &workers() { return pool; }
+
+  // Steps taken and simulated seconds elapsed; advanced by step()
+  uint64_t stepCount() const { return steps; }
+  double time() const { return elapsed; }
+  void setClock(uint64_t stepCount, double time) {
+    steps = stepCount;
+    elapsed = time;
+  }
+
+  // Random stream for stochastic phases. Saved with checkpoints so restarts
+  // continue the same sequence.
+  Pcg32 &random() { return rng; }
+  const Pcg32 &random() const { return rng; }
+
+  SimulationSettings settings;
+  std::vector<Emitter> emitters;
+  std::vector<Sink> sinks;
+
+private:
+  template <typename Integrator> void advanceStepped(float deltaTime);
+  template <typename Integrator> void substep(float deltaTime);
+  int chooseSubsteps(float deltaTime);
+  void collideGridColored();
+  void collideGridImpulseBuffers();
+  void collideBruteForceGather();
+  void collideSerial();
+  void advanceEvents(float deltaTime);
+  void advanceSph(float deltaTime);
+  // False if the workers could not step and the engine fell back
+  bool advanceDistributed(float deltaTime);
+  // Whether the settings, thermostat or thread count differ from the copies
+  // the workers were forked with
+  bool workersOutdated() const;
+  void stopDistributed();
+  void updateSources(float deltaTime);
+  void addCollisionCounts(uint64_t candidatePairs, uint64_t contacts);
+
+  BarrierBounds barrier;
+  ParticleSystem system;
+  SpatialGrid grid;
+  EventDrivenEngine events;
+  SphSolver sph;
+  DistributedEngine domains;
+  bool particlesStale = false;
+  bool domainsDirty = false;
+  std::string domainError;
+  uint64_t fallbacks = 0;
+  SimulationSettings domainSettings;
+  ThermostatSettings domainThermostat;
+  int domainThreads = 0;
+  Thermostat thermo;
+  ThreadPool pool;
+  // Penalty accelerations from the last computeForces(). Velocity Verlet
+  // reuses them at the start of the next step while forcesValid holds.
+  AlignedFloatArray accelerationX, accelerationY;
+  bool forcesValid = false;
+  int substeps = 1;
+  // Per-thread acceleration sums for the non-deterministic parallel path
+  std::vector<AlignedFloatArray> partialX, partialY;
+  // Per-thread fastest squared speed and smallest radius for substepping
+  std::vector<float> threadSpeed, threadRadius;
+  PhaseTimings phaseTimings;
+  CollisionCounts collisions;
+  SourceCounts sources;
+  // Totals from the worker threads while collide() runs
+  std::atomic<uint64_t> pairTally, contactTally;
+  Pcg32 rng;
+  uint64_t steps = 0;
+  double elapsed = 0.0;
+};
+
+#endif // SIMULATION_H
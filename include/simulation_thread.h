@@ -0,0 +1,87 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include "particle_snapshot.h"
+#include "simulation.h"
+#include "trajectory.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs a Simulation on its own thread at a fixed timestep. Wall-clock time
+// is fed into an accumulator and consumed in whole steps of 1 / stepRate, so
+// physics is independent of how fast frames are drawn. Everything else only
+// talks to it through posted commands and published snapshots.
+class SimulationThread {
+public:
+  typedef std::function<void(Simulation &)> Command;
+
+  SimulationThread(const BarrierBounds &bounds, int threadCount);
+  ~SimulationThread();
+
+  SimulationThread(const SimulationThread &) = delete;
+  SimulationThread &operator=(const SimulationThread &) = delete;
+
+  void start();
+  void stop();
+
+  // Queues a change to the simulation. Commands run on the physics thread,
+  // in order, between steps. Ones that change the particles must call
+  // Simulation::particlesEdited().
+  void post(Command command);
+
+  void setStepRate(float stepsPerSecond);
+  float stepRate() const { return rate.load(); }
+
+  // While paused no steps are taken, but commands still run and publish a
+  // fresh snapshot.
+  void setPaused(bool paused) { pausedFlag.store(paused); }
+  bool paused() const { return pausedFlag.load(); }
+
+  // Records a trajectory frame every `everySteps` steps until stopped.
+  // Replaces any recording already in progress.
+  // Positions are quantized over `bounds` when the options compress them.
+  bool startRecording(const std::string &path, const BarrierBounds &bounds,
+                      const TrajectoryOptions &options, int everySteps,
+                      std::string &error);
+  void stopRecording();
+  bool recording() const { return recordingActive.load(); }
+  TrajectoryStats recordingStats() const;
+
+  // Latest published snapshot. Only call from one (the rendering) thread.
+  const ParticleSnapshot &latestSnapshot();
+
+private:
+  void run();
+  bool applyCommands();
+  void recordFrame();
+  void publishSnapshot(float stepsPerSecond);
+
+  Simulation simulation;
+  TripleBuffer<ParticleSnapshot> snapshots;
+
+  std::thread thread;
+  std::atomic<bool> running;
+  std::atomic<float> rate;
+  std::atomic<bool> pausedFlag;
+
+  // Swapped in and out by the UI thread, used by the physics thread
+  mutable std::mutex recorderMutex;
+  std::unique_ptr<TrajectoryWriter> recorder;
+  std::atomic<bool> recordingActive;
+  TrajectoryStats lastRecordingStats; // of the most recently stopped recording
+  int recordEverySteps = 1;
+  int stepsSinceFrame = 0;
+
+  std::mutex commandMutex;
+  std::vector<Command> pendingCommands;
+  std::vector<Command> runningCommands;
+};
+
+#endif // SIMULATION_THREAD_H
@@ -0,0 +1,134 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include "particle.h"
+#include "particle_system.h"
+#include <algorithm>
+#include <vector>
+
+enum class CollisionBackend { BruteForce, UniformGrid };
+
+const char *collisionBackendName(CollisionBackend backend);
+
+// Uniform grid broad phase. Cells are at least one particle diameter wide, so
+// any overlapping pair lives in the same or an adjacent cell. The grid is
+// rebuilt every step with a counting sort, which leaves the particle indices
+// of each cell contiguous in cellParticles.
+class SpatialGrid {
+public:
+  void build(const std::vector<Particle> &particles);
+  void build(const ParticleSystem &system);
+
+  // Builds from raw position/radius arrays. `stride` is the distance in
+  // floats between consecutive particles, so both interleaved (Particle) and
+  // structure-of-arrays storage can be indexed without copying.
+  void build(const float *x, const float *y, const float *radius, int count,
+             int stride = 1);
+
+  // Calls fn(i, j) once for every pair of particles in the same or
+  // neighbouring cells. Only the "forward" half of the 3x3 neighbourhood is
+  // visited so each pair is reported exactly once.
+  template <typename Fn> void forEachCandidatePair(Fn fn) const;
+
+  // Pairs owned by a single cell: those inside it plus those shared with its
+  // forward neighbours. The writes this produces stay within columns
+  // cx - 1 .. cx + 1 and rows cy .. cy + 1, which is what allows cells three
+  // columns or two rows apart to be processed concurrently.
+  template <typename Fn>
+  void forEachCandidatePairInCell(int cx, int cy, Fn fn) const;
+
+  // Calls fn(i) for every particle in the cells overlapping the square of
+  // half-width `range` centred on (px, py).
+  template <typename Fn>
+  void forEachNear(float px, float py, float range, Fn fn) const;
+
+  int columns() const { return cols; }
+  int rows() const { return rowCount; }
+  float cellSize() const { return size; }
+
+private:
+  int cellIndex(float px, float py) const;
+
+  float size = 0.0f;
+  float originX = 0.0f;
+  float originY = 0.0f;
+  int cols = 0;
+  int rowCount = 0;
+  std::vector<int> cellStart;     // cols * rows + 1 prefix offsets
+  std::vector<int> cellParticles; // particle indices sorted by cell
+  std::vector<int> particleCell;  // cell of each particle
+  std::vector<int> scatterOffsets;
+};
+
+template <typename Fn>
+void SpatialGrid::forEachCandidatePairInCell(int cx, int cy, Fn fn) const {
+  // Forward neighbours: right, below-left, below, below-right
+  static const int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+  int cell = cy * cols + cx;
+  int begin = cellStart[cell];
+  int end = cellStart[cell + 1];
+  if (begin == end) {
+    return;
+  }
+
+  for (int a = begin; a < end; ++a) {
+    for (int b = a + 1; b < end; ++b) {
+      fn(cellParticles[a], cellParticles[b]);
+    }
+  }
+
+  for (const auto &offset : offsets) {
+    int nx = cx + offset[0];
+    int ny = cy + offset[1];
+    if (nx < 0 || nx >= cols || ny >= rowCount) {
+      continue;
+    }
+    int neighbour = ny * cols + nx;
+    int nBegin = cellStart[neighbour];
+    int nEnd = cellStart[neighbour + 1];
+    for (int a = begin; a < end; ++a) {
+      for (int b = nBegin; b < nEnd; ++b) {
+        fn(cellParticles[a], cellParticles[b]);
+      }
+    }
+  }
+}
+
+template <typename Fn> void SpatialGrid::forEachCandidatePair(Fn fn) const {
+  for (int cy = 0; cy < rowCount; ++cy) {
+    for (int cx = 0; cx < cols; ++cx) {
+      forEachCandidatePairInCell(cx, cy, fn);
+    }
+  }
+}
+
+template <typename Fn>
+void SpatialGrid::forEachNear(float px, float py, float range, Fn fn) const {
+  if (cols == 0) {
+    return;
+  }
+  // Positions outside the grid were clamped into its edge cells on build,
+  // so clamping the query the same way still finds them.
+  int x0 = std::max(0, std::min(cols - 1, static_cast<int>((px - range - originX) / size)));
+  int x1 = std::max(0, std::min(cols - 1, static_cast<int>((px + range - originX) / size)));
+  int y0 = std::max(0, std::min(rowCount - 1, static_cast<int>((py - range - originY) / size)));
+  int y1 = std::max(0, std::min(rowCount - 1, static_cast<int>((py + range - originY) / size)));
+  for (int cy = y0; cy <= y1; ++cy) {
+    for (int cx = x0; cx <= x1; ++cx) {
+      int cell = cy * cols + cx;
+      for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+        fn(cellParticles[k]);
+      }
+    }
+  }
+}
+
+// Runs the narrow phase (CheckCollision) over all particle pairs using the
+// selected broad phase.
+void resolveCollisions(std::vector<Particle> &particles,
+                       CollisionBackend backend, SpatialGrid &grid);
+void resolveCollisions(ParticleSystem &system, CollisionBackend backend,
+                       SpatialGrid &grid);
+
+#endif // SPATIAL_GRID_H
@@ -0,0 +1,87 @@
+#ifndef SPH_H
+#define SPH_H
+
+#include "aligned_allocator.h"
+#include "particle_system.h"
+#include "thread_pool.h"
+#include <vector>
+
+enum class SphKernel {
+  // Poly6 for density, Spiky gradient for forces (Mueller et al. 2003)
+  Poly6Spiky,
+  // Monaghan's M4 cubic B-spline
+  CubicSpline,
+  // Wendland C2; resists particle clumping under high pressure
+  WendlandC2
+};
+
+const char *sphKernelName(SphKernel kernel);
+
+// Weakly compressible SPH parameters. Lengths are in pixels, times in
+// seconds. Every particle has the same mass.
+struct SphSettings {
+  SphKernel kernel = SphKernel::WendlandC2;
+  // Kernel support radius
+  float smoothingLength = 16.0f;
+  // Spacing of the fluid at rest; sets the rest density
+  float restSpacing = 6.0f;
+  float particleMass = 1.0f;
+  // Pressure = stiffness * (density - restDensity), clamped at zero. The
+  // speed of sound is about sqrt(stiffness) px/s; substeps need to stay
+  // under about 0.4 * smoothingLength / sqrt(stiffness) seconds.
+  float stiffness = 1.0e6f;
+  // Kinematic viscosity, in px^2 / s
+  float viscosity = 40.0f;
+  float gravityX = 0.0f;
+  float gravityY = 400.0f;
+  // Fraction of the normal velocity kept when bouncing off a wall
+  float wallRestitution = 0.3f;
+  int substeps = 2;
+};
+
+// Fluid solver over the existing particle set and barrier. Each step builds
+// one neighbour list (CSR: a start offset per particle into a flat index
+// array), padded by how far particles can move in the step so that every
+// substep reuses it. Each pass then runs over contiguous per-neighbour
+// arrays, and every particle only writes its own outputs, so the passes
+// split across the pool without atomics. Buffers only grow, so steady-state
+// steps do not allocate.
+class SphSolver {
+public:
+  void step(ParticleSystem &system, const BarrierBounds &bounds,
+            float deltaTime, ThreadPool &pool);
+
+  SphSettings settings;
+
+  // Density computed in the last substep, for display
+  const AlignedFloatArray &densities() const { return density; }
+  float restDensity() const { return rest; }
+  size_t neighbourCount() const { return neighbourIndex.size(); }
+
+private:
+  void updateRestDensity();
+  void buildNeighbours(const ParticleSystem &system, const BarrierBounds &bounds,
+                       float searchRadius, ThreadPool &pool);
+  template <typename Kernel>
+  void substep(ParticleSystem &system, const BarrierBounds &bounds,
+               float deltaTime, ThreadPool &pool);
+
+  float rest = 0.0f;
+  SphKernel restKernel = SphKernel::WendlandC2;
+  float restSmoothing = 0.0f, restSpacing = 0.0f, restMass = 0.0f;
+
+  // Counting sort of particles into cells one search radius wide, with
+  // their positions in cell order
+  std::vector<int> cellStart, cellCursor, cellParticles, particleCell;
+  AlignedFloatArray cellX, cellY;
+
+  // Neighbour lists; dx/dy/r are refreshed by the density pass and reused
+  // by the force pass
+  std::vector<int> neighbourStart, neighbourIndex;
+  AlignedFloatArray neighbourDx, neighbourDy, neighbourR;
+
+  AlignedFloatArray density, pressureTerm;
+  AlignedFloatArray accelerationX, accelerationY;
+};
+
+#endif // SPH_H
@@ -0,0 +1,145 @@
+#ifndef THERMOSTAT_H
+#define THERMOSTAT_H
+
+#include "particle_system.h"
+#include "pcg32.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class ThermostatMode {
+  // Sets every speed to the one implied by its own particle's temperature,
+  // keeping the direction. The original behaviour.
+  PerParticle,
+  // Scales each group's velocities towards its target with time constant tau
+  Berendsen,
+  // Bussi-Donadio-Parrinello stochastic rescaling: Berendsen plus a noise
+  // term, so the kinetic energy follows the canonical distribution
+  VelocityRescale,
+  // Redraws random particles' velocities from the Maxwell-Boltzmann
+  // distribution at the target
+  Andersen,
+  Off
+};
+
+const char *thermostatModeName(ThermostatMode mode);
+
+// Speed per degree. Matches the original mapping of 0..100 degrees onto
+// 0..200 px/s. Units are pixels and unit masses rather than SI, so instead of
+// boltzmannConstant the kinetic temperature of a group is its RMS speed
+// divided by this.
+const float SPEED_PER_DEGREE = 2.0f;
+
+// Area with its own target. Particles outside every region use the global
+// target; where regions overlap, the first one wins.
+struct ThermostatRegion {
+  BarrierBounds region = {0.0f, 0.0f, 0.0f, 0.0f};
+  float temperature = 20.0f;
+
+  bool operator==(const ThermostatRegion &other) const {
+    return region.left == other.region.left && region.right == other.region.right &&
+           region.top == other.region.top && region.bottom == other.region.bottom &&
+           temperature == other.temperature;
+  }
+};
+
+struct ThermostatSettings {
+  ThermostatMode mode = ThermostatMode::PerParticle;
+  float temperature = 20.0f;
+  std::vector<ThermostatRegion> regions;
+  // Coupling time of Berendsen and velocity rescaling, in seconds
+  float timeConstant = 0.5f;
+  // Andersen collisions per particle per second
+  float collisionRate = 2.0f;
+  // Speed histogram covers [0, histogramMaxSpeed); faster particles land in
+  // the last bin
+  float histogramMaxSpeed = 400.0f;
+  int histogramBins = 64;
+
+  bool operator==(const ThermostatSettings &other) const {
+    return mode == other.mode && temperature == other.temperature &&
+           regions == other.regions && timeConstant == other.timeConstant &&
+           collisionRate == other.collisionRate &&
+           histogramMaxSpeed == other.histogramMaxSpeed &&
+           histogramBins == other.histogramBins;
+  }
+  bool operator!=(const ThermostatSettings &other) const { return !(*this == other); }
+};
+
+// Speed distribution gathered while the thermostat writes the speeds, so it
+// costs no extra pass over the particles.
+struct SpeedHistogram {
+  std::vector<float> counts;
+  float binWidth = 0.0f;
+  size_t particles = 0;
+  float meanSquaredSpeed = 0.0f;
+
+  // Count the 2D Maxwell-Boltzmann distribution with the same mean squared
+  // speed predicts for a bin
+  float expected(int bin) const;
+};
+
+// Applies one of the thermostats above after a step. Each runs as at most two
+// batch passes over the velocity arrays: one that sums kinetic energy per
+// group, then one that scales velocities, writes speeds and bins them. The
+// passes use SIMD without trig and split across the pool.
+class Thermostat {
+public:
+  void apply(ParticleSystem &system, float deltaTime, ThreadPool &pool,
+             Pcg32 &rng);
+
+  ThermostatSettings settings;
+
+  const SpeedHistogram &histogram() const { return speeds; }
+  // Kinetic temperature of each group measured before the last apply():
+  // outside every region first, then one per region. Empty in the Per
+  // Particle and Off modes, which skip that pass.
+  const std::vector<float> &temperatures() const { return measured; }
+
+  // apply() in three parts, for particles split across processes. Every part
+  // calls measureGroups() on its particles and reports groupEnergies() and
+  // groupCounts(). The totals go to chooseFactors() once, with one random
+  // stream, and every part passes the resulting factors() to applyFactors().
+  // mergeHistograms() then combines the parts' histograms.
+  void measureGroups(const ParticleSystem &system, ThreadPool &pool);
+  // 1 + the number of regions
+  int groupTotal() const { return 1 + static_cast<int>(settings.regions.size()); }
+  const std::vector<double> &groupEnergies() const { return groupEnergy; }
+  const std::vector<size_t> &groupCounts() const { return groupCount; }
+  void chooseFactors(const std::vector<double> &energy, const std::vector<size_t> &count,
+                     float deltaTime, Pcg32 &rng);
+  const std::vector<float> &factors() const { return factor; }
+  // Andersen draws from `rng` per particle, so each part can use its own
+  void applyFactors(ParticleSystem &system, const std::vector<float> &factors,
+                    float deltaTime, ThreadPool &pool, Pcg32 &rng);
+  void mergeHistograms(const std::vector<SpeedHistogram> &parts);
+
+private:
+  int groupOf(float x, float y) const;
+  float groupTarget(int group) const;
+  void measure(const ParticleSystem &system, ThreadPool &pool);
+  void scaleGroups(ParticleSystem &system, ThreadPool &pool);
+  void rescaleToOwnTemperature(ParticleSystem &system, ThreadPool &pool);
+  void andersen(ParticleSystem &system, float deltaTime, Pcg32 &rng);
+  void beginHistogram(int threads);
+  void finishHistogram(const ParticleSystem &system);
+
+  // Group of each particle; only filled when there are regions
+  std::vector<int> group;
+  // Per chunk, per group sums from measure(). Chunks have a fixed size and
+  // are added up in order, so the totals do not depend on the thread count.
+  std::vector<double> chunkEnergy;
+  std::vector<size_t> chunkCount;
+  std::vector<double> groupEnergy;
+  std::vector<size_t> groupCount;
+  std::vector<float> factor;
+  std::vector<float> measured;
+  // Per thread histograms and sums of squared speeds, merged into speeds
+  std::vector<uint32_t> threadBins;
+  std::vector<double> threadSquares;
+  int groups = 1;
+  SpeedHistogram speeds;
+};
+
+#endif // THERMOSTAT_H
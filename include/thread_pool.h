@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that execute fork/join batches of tasks. The
+// calling thread takes part in every batch as thread 0, so a pool of N
+// threads spawns N - 1 workers and a pool of one runs everything inline.
+class ThreadPool {
+public:
+  explicit ThreadPool(int threadCount = 1);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Joins the current workers and starts threadCount - 1 new ones. Must not
+  // be called while a batch is running.
+  void resize(int threadCount);
+  int threadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+  // Runs task(taskIndex, threadIndex) for every taskIndex in [0, taskCount)
+  // and returns once all of them have finished. Tasks are handed out
+  // dynamically, so which thread runs a given task is not fixed.
+  void run(int taskCount, const std::function<void(int, int)> &task);
+
+  // Splits [0, count) into contiguous chunks whose sizes are multiples of
+  // `grain` and runs body(begin, end, threadIndex) on each of them.
+  void parallelFor(size_t count, size_t grain,
+                   const std::function<void(size_t, size_t, int)> &body);
+
+  static int hardwareThreads();
+
+private:
+  // Workers start from the generation current when they were spawned, so a
+  // pool resized after use does not wake them for a job that already ran
+  void workerLoop(int threadIndex, unsigned startGeneration);
+  void drain(const std::function<void(int, int)> &task, int taskCount,
+             int threadIndex);
+  void stopWorkers();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+
+  const std::function<void(int, int)> *job = nullptr;
+  int jobTasks = 0;
+  std::atomic<int> nextTask;
+  int pendingWorkers = 0;
+  unsigned generation = 0;
+  bool stopping = false;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,170 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "mapped_file.h"
+#include "particle_snapshot.h"
+#include "particle_system.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Trajectory files record what the viewer needs (position, radius, speed)
+// every few steps so a run can be scrubbed without re-simulating it.
+//
+// Layout (native byte order, checked on open):
+//   TrajectoryHeader
+//   frames, each a TrajectoryFrameHeader followed by its payload
+// Frames carry their own size, so a file cut short by a crash is readable
+// up to the last complete frame.
+enum class TrajectoryCompression {
+  // 4 floats per particle
+  Raw,
+  // 16-bit positions over the barrier, 16-bit speed and radius over the
+  // frame's range: 8 bytes per particle
+  Quantized,
+  // Quantized, but positions are stored as varint deltas from the previous
+  // frame; every keyframeInterval-th frame is a plain quantized keyframe
+  DeltaQuantized
+};
+
+const char *trajectoryCompressionName(TrajectoryCompression compression);
+
+const uint32_t TRAJECTORY_VERSION = 1;
+
+struct TrajectoryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t compression;
+  uint32_t keyframeInterval;
+  float bounds[4]; // left, right, top, bottom
+};
+
+const uint32_t TRAJECTORY_KEYFRAME = 1;
+
+struct TrajectoryFrameHeader {
+  uint32_t size; // payload bytes following this header
+  uint32_t flags;
+  uint64_t stepCount;
+  double simulationTime;
+  uint32_t particleCount;
+  uint32_t reserved;
+};
+
+struct TrajectoryOptions {
+  TrajectoryCompression compression = TrajectoryCompression::DeltaQuantized;
+  int keyframeInterval = 30;
+  // Frames waiting to be encoded. When all are in use new frames are
+  // dropped rather than stalling the caller.
+  int queueDepth = 8;
+};
+
+struct TrajectoryStats {
+  uint64_t framesWritten = 0;
+  uint64_t framesDropped = 0;
+  uint64_t bytesWritten = 0;
+};
+
+// Appends frames to a trajectory file. submit() only copies the arrays into
+// a free queue slot; encoding and file I/O happen on a background thread.
+class TrajectoryWriter {
+public:
+  TrajectoryWriter() {}
+  ~TrajectoryWriter() { close(); }
+
+  TrajectoryWriter(const TrajectoryWriter &) = delete;
+  TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+  bool open(const std::string &path, const BarrierBounds &bounds,
+            const TrajectoryOptions &options, std::string &error);
+  // Writes out the frames still queued, then closes the file
+  void close();
+  bool isOpen() const { return file != nullptr; }
+
+  // Queues the current state. Returns false if the frame was dropped.
+  // `system` speeds must be up to date.
+  bool submit(const ParticleSystem &system, uint64_t stepCount,
+              double simulationTime);
+
+  TrajectoryStats stats() const;
+
+private:
+  struct Frame {
+    uint64_t stepCount = 0;
+    double simulationTime = 0.0;
+    std::vector<float> x, y, radius, speed;
+  };
+
+  void run();
+  void encode(const Frame &frame);
+
+  FILE *file = nullptr;
+  TrajectoryHeader header;
+  TrajectoryOptions options;
+  BarrierBounds bounds = {0.0f, 0.0f, 0.0f, 0.0f};
+
+  std::thread thread;
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  bool closing = false;
+  std::vector<Frame> frames;
+  std::vector<int> freeFrames;
+  std::deque<int> queuedFrames;
+
+  // Encoder state, only touched by the background thread
+  std::vector<uint8_t> buffer;
+  std::vector<uint16_t> previousX, previousY;
+  uint64_t framesSinceKeyframe = 0;
+  bool writeFailed = false;
+
+  std::atomic<uint64_t> framesWritten{0};
+  std::atomic<uint64_t> framesDropped{0};
+  std::atomic<uint64_t> bytesWritten{0};
+};
+
+// Random access to a recorded trajectory. The file is memory-mapped and
+// indexed once on open; delta frames are rebuilt from the nearest keyframe,
+// or from the previously decoded frame when scrubbing forwards.
+class TrajectoryReader {
+public:
+  bool open(const std::string &path, std::string &error);
+  void close();
+  bool isOpen() const { return file.isOpen(); }
+
+  size_t frameCount() const { return index.size(); }
+  TrajectoryCompression compression() const;
+  BarrierBounds bounds() const;
+  uint64_t frameStep(size_t frame) const { return index[frame].stepCount; }
+  double frameTime(size_t frame) const { return index[frame].simulationTime; }
+
+  // Fills the position, radius, speed and clock fields of `snapshot`
+  bool decode(size_t frame, ParticleSnapshot &snapshot);
+
+private:
+  struct FrameEntry {
+    size_t offset; // start of the payload
+    uint32_t size;
+    uint32_t flags;
+    uint64_t stepCount;
+    double simulationTime;
+    uint32_t particleCount;
+  };
+
+  bool decodePositions(size_t frame);
+
+  MappedFile file;
+  TrajectoryHeader header;
+  std::vector<FrameEntry> index;
+
+  // Quantized positions of the last frame rebuilt by decodePositions()
+  std::vector<uint16_t> currentX, currentY;
+  size_t currentFrame = static_cast<size_t>(-1);
+};
+
+#endif // TRAJECTORY_H
@@ -0,0 +1,74 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Message passing between the processes of one machine, used by the
+// distributed engine. Processes are numbered by rank and only talk over the
+// links the fabric was created with.
+enum class TransportKind {
+  // Single-producer single-consumer byte rings in one shared mapping, with
+  // futex wake-ups on Linux
+  SharedMemory,
+  // One AF_UNIX stream socket pair per link
+  UnixSocket
+};
+
+const char *transportKindName(TransportKind kind);
+
+struct OutgoingMessage {
+  int peer;
+  const char *data;
+  size_t size;
+};
+
+struct IncomingMessage {
+  int peer;
+  std::vector<char> *data; // replaced with the message
+};
+
+class Transport {
+public:
+  virtual ~Transport() {}
+
+  // Sends every outgoing message and receives one message from each incoming
+  // peer. All transfers progress together, so two peers sending each other
+  // more than a buffer's worth at the same time cannot deadlock. Returns
+  // false if a peer went away or the liveness check failed.
+  virtual bool exchange(const std::vector<OutgoingMessage> &outgoing,
+                        std::vector<IncomingMessage> &incoming) = 0;
+
+  // Called whenever exchange() has waited a while without progress; returning
+  // false abandons the exchange
+  void setLivenessCheck(const std::function<bool()> &check) { alive = check; }
+
+  // Makes every pending and future exchange() on every rank fail
+  virtual void abort() = 0;
+
+protected:
+  std::function<bool()> alive;
+};
+
+// Every channel between the ranks, created before forking so each process
+// inherits them. After the fork each process takes its own endpoint.
+class TransportFabric {
+public:
+  virtual ~TransportFabric() {}
+
+  // The channels of `rank`. Releases the ones this process does not use.
+  virtual std::unique_ptr<Transport> endpoint(int rank) = 0;
+};
+
+// `links` are the pairs of ranks that may talk, in both directions.
+// ringBytes sizes each direction of a shared-memory link.
+std::unique_ptr<TransportFabric>
+createTransportFabric(TransportKind kind, int ranks,
+                      const std::vector<std::pair<int, int>> &links,
+                      size_t ringBytes, std::string &error);
+
+#endif // TRANSPORT_H
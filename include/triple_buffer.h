@@ -0,0 +1,44 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single-producer / single-consumer triple buffer. The writer fills
+// its back slot and publishes it; the reader picks up the most recently
+// published slot. Neither side ever waits on the other, and the reader
+// always sees a complete value, skipping any it was too slow to observe.
+template <typename T> class TripleBuffer {
+public:
+  // Writer side: the slot to fill next. Contents are whatever was published
+  // two rounds ago, so storage inside T can be reused without reallocating.
+  T &writeBuffer() { return slots[backIndex]; }
+
+  void publish() {
+    int previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+    backIndex = previous & INDEX_MASK;
+  }
+
+  // Reader side: swaps in the newest published slot if there is one.
+  // Returns true if readBuffer() changed.
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    int previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+    frontIndex = previous & INDEX_MASK;
+    return true;
+  }
+
+  const T &readBuffer() const { return slots[frontIndex]; }
+
+private:
+  static const int INDEX_MASK = 3;
+  static const int FRESH = 4;
+
+  T slots[3];
+  std::atomic<int> middle{1};
+  int backIndex = 0;
+  int frontIndex = 2;
+};
+
+#endif // TRIPLE_BUFFER_H
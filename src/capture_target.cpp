@@ -0,0 +1,80 @@
+#include "capture_target.h"
+#include "profiler.h"
+
+#include <chrono>
+#include <cmath>
+
+bool CaptureTarget::start(const CaptureOptions &options, std::string &error) {
+  stop();
+  if (!(options.framesPerSecond > 0.0f)) {
+    error = "Capture rate must be positive";
+    return false;
+  }
+  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                              SDL_TEXTUREACCESS_TARGET, options.width,
+                              options.height);
+  if (!texture) {
+    error = std::string("Could not create capture texture: ") + SDL_GetError();
+    return false;
+  }
+  if (!encoder.open(options, error)) {
+    SDL_DestroyTexture(texture);
+    texture = nullptr;
+    return false;
+  }
+  interval = 1.0 / options.framesPerSecond;
+  nextTime = -1.0;
+  skippedTicks = 0;
+  lastCaptureMs = 0.0;
+  return true;
+}
+
+void CaptureTarget::stop() {
+  encoder.close();
+  if (texture) {
+    SDL_DestroyTexture(texture);
+    texture = nullptr;
+  }
+}
+
+bool CaptureTarget::due(double simulationTime) {
+  if (!active()) {
+    return false;
+  }
+  // Start on the first frame seen, and again if time went backwards (a
+  // checkpoint was loaded)
+  if (nextTime < 0.0 || simulationTime < nextTime - 2.0 * interval) {
+    nextTime = simulationTime;
+  }
+  if (simulationTime < nextTime) {
+    return false;
+  }
+  const double behind = std::floor((simulationTime - nextTime) / interval);
+  skippedTicks += static_cast<uint64_t>(behind);
+  nextTime += (behind + 1.0) * interval;
+  return true;
+}
+
+bool CaptureTarget::capture(const std::function<void()> &draw) {
+  PROFILE_SCOPE("Capture frame");
+  // Claim a buffer first, so a dropped frame costs no drawing
+  uint8_t *pixels = encoder.acquire();
+  if (!pixels) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  SDL_SetRenderTarget(renderer, texture);
+  draw();
+  bool read = SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGB24,
+                                   pixels, encoder.pitch()) == 0;
+  SDL_SetRenderTarget(renderer, nullptr);
+  if (!read) {
+    encoder.cancel();
+    return false;
+  }
+  encoder.submit();
+  lastCaptureMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return true;
+}
@@ -0,0 +1,188 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = {'F', 'L', 'U', 'I', 'D', 'C', 'K', 'P'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Arrays start on cache-line boundaries so mapped data can be streamed with
+// aligned vector loads.
+const uint64_t ARRAY_ALIGNMENT = 64;
+
+uint64_t alignUp(uint64_t offset) {
+  return (offset + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT;
+}
+
+const AlignedFloatArray &systemArray(const ParticleSystem &system,
+                                     int which) {
+  switch (which) {
+  case CHECKPOINT_X:
+    return system.x;
+  case CHECKPOINT_Y:
+    return system.y;
+  case CHECKPOINT_VX:
+    return system.vx;
+  case CHECKPOINT_VY:
+    return system.vy;
+  case CHECKPOINT_RADIUS:
+    return system.radius;
+  default:
+    return system.temperature;
+  }
+}
+
+AlignedFloatArray &systemArray(ParticleSystem &system, int which) {
+  return const_cast<AlignedFloatArray &>(
+      systemArray(static_cast<const ParticleSystem &>(system), which));
+}
+
+} // namespace
+
+bool saveCheckpoint(const std::string &path, const Simulation &simulation,
+                    std::string &error) {
+  const ParticleSystem &system = simulation.particles();
+  const uint64_t count = system.size();
+  const BarrierBounds &bounds = simulation.bounds();
+
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.particleCount = count;
+  header.stepCount = simulation.stepCount();
+  header.simulationTime = simulation.time();
+  header.rngState = simulation.random().state;
+  header.rngIncrement = simulation.random().increment;
+  header.bounds[0] = bounds.left;
+  header.bounds[1] = bounds.right;
+  header.bounds[2] = bounds.top;
+  header.bounds[3] = bounds.bottom;
+  uint64_t offset = alignUp(sizeof(header));
+  for (int i = 0; i < CHECKPOINT_ARRAY_COUNT; ++i) {
+    header.arrayOffsets[i] = offset;
+    offset = alignUp(offset + count * sizeof(float));
+  }
+
+  const std::string temporaryPath = path + ".tmp";
+  FILE *file = std::fopen(temporaryPath.c_str(), "wb");
+  if (!file) {
+    error = "Could not create " + temporaryPath;
+    return false;
+  }
+
+  static const char padding[ARRAY_ALIGNMENT] = {};
+  uint64_t written = 0;
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  written += sizeof(header);
+  for (int i = 0; ok && i < CHECKPOINT_ARRAY_COUNT; ++i) {
+    size_t gap = static_cast<size_t>(header.arrayOffsets[i] - written);
+    ok = std::fwrite(padding, 1, gap, file) == gap;
+    const AlignedFloatArray &values = systemArray(system, i);
+    ok = ok && (count == 0 ||
+                std::fwrite(values.data(), sizeof(float), count, file) == count);
+    written = header.arrayOffsets[i] + count * sizeof(float);
+  }
+  ok = (std::fclose(file) == 0) && ok;
+  if (!ok) {
+    std::remove(temporaryPath.c_str());
+    error = "Could not write " + temporaryPath;
+    return false;
+  }
+
+#ifdef _WIN32
+  std::remove(path.c_str());
+#endif
+  if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    std::remove(temporaryPath.c_str());
+    error = "Could not replace " + path;
+    return false;
+  }
+  return true;
+}
+
+bool MappedCheckpoint::open(const std::string &path, std::string &error) {
+  if (!file.open(path, error)) {
+    return false;
+  }
+  if (file.size() < sizeof(CheckpointHeader) ||
+      std::memcmp(header().magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+    error = path + " is not a checkpoint";
+    file.close();
+    return false;
+  }
+  if (header().byteOrder != BYTE_ORDER_MARK) {
+    error = path + " was written on a machine with a different byte order";
+    file.close();
+    return false;
+  }
+  if (header().version != CHECKPOINT_VERSION) {
+    error = path + " has unsupported checkpoint version " +
+            std::to_string(header().version);
+    file.close();
+    return false;
+  }
+  // Checked before multiplying so a corrupt count cannot wrap around
+  if (header().particleCount > file.size() / sizeof(float)) {
+    error = path + " is truncated or corrupt";
+    file.close();
+    return false;
+  }
+  const uint64_t arrayBytes = header().particleCount * sizeof(float);
+  for (int i = 0; i < CHECKPOINT_ARRAY_COUNT; ++i) {
+    uint64_t offset = header().arrayOffsets[i];
+    if (offset % sizeof(float) != 0 || offset > file.size() ||
+        arrayBytes > file.size() - offset) {
+      error = path + " is truncated or corrupt";
+      file.close();
+      return false;
+    }
+  }
+  return true;
+}
+
+BarrierBounds MappedCheckpoint::bounds() const {
+  BarrierBounds bounds;
+  bounds.left = header().bounds[0];
+  bounds.right = header().bounds[1];
+  bounds.top = header().bounds[2];
+  bounds.bottom = header().bounds[3];
+  return bounds;
+}
+
+const float *MappedCheckpoint::array(CheckpointArray which) const {
+  return reinterpret_cast<const float *>(file.data() +
+                                         header().arrayOffsets[which]);
+}
+
+void MappedCheckpoint::restore(Simulation &simulation) const {
+  ParticleSystem &system = simulation.particles();
+  const size_t count = particleCount();
+  system.resize(count);
+  for (int i = 0; i < CHECKPOINT_ARRAY_COUNT; ++i) {
+    if (count > 0) {
+      std::memcpy(systemArray(system, i).data(),
+                  array(static_cast<CheckpointArray>(i)),
+                  count * sizeof(float));
+    }
+  }
+  system.computeSpeeds();
+
+  simulation.setBounds(bounds());
+  simulation.setClock(stepCount(), simulationTime());
+  simulation.random().state = header().rngState;
+  simulation.random().increment = header().rngIncrement;
+  simulation.particlesEdited();
+}
+
+bool loadCheckpoint(const std::string &path, Simulation &simulation,
+                    std::string &error) {
+  MappedCheckpoint checkpoint;
+  if (!checkpoint.open(path, error)) {
+    return false;
+  }
+  checkpoint.restore(simulation);
+  return true;
+}
@@ -12,4 +12,12 @@ SDL_Color velocityToColor(float speed, float maxVelocity) {
   Uint8 blue = static_cast<Uint8>(255 * (1 - ratio)); // Keeping blue constant
 
   return {red, green, blue, 255};
-}
\ No newline at end of file
+}
+
+ColorRamp::ColorRamp(float maxVelocity, int size)
+    : table(size), maximum(maxVelocity),
+      scale((size - 1) / maxVelocity), last(size - 1) {
+  for (int i = 0; i < size; ++i) {
+    table[i] = velocityToColor(maxVelocity * i / (size - 1), maxVelocity);
+  }
+}
@@ -0,0 +1,656 @@
+#include "distributed.h"
+
+#include "simulation.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum : uint32_t {
+  COMMAND_STEP = 1,
+  COMMAND_GATHER = 2,
+  COMMAND_STOP = 3,
+  COMMAND_THERMOSTAT = 4
+};
+
+// x, y, vx, vy, radius, temperature
+const size_t PARTICLE_BYTES = 6 * sizeof(float);
+
+// Sent to the coordinator after every step, followed by each thermostat
+// group's kinetic energy sum (double) and particle count (uint64_t)
+struct StepReport {
+  uint32_t owned;
+  uint32_t ghosts;
+  uint32_t migrated;
+  uint32_t groups;
+  double integrateMs;
+  double exchangeMs;
+  double collideMs;
+  uint64_t candidatePairs;
+  uint64_t contacts;
+};
+
+const size_t GROUP_BYTES = sizeof(double) + sizeof(uint64_t);
+
+// Sent after applying the thermostat, followed by `bins` float counts
+struct ThermostatReport {
+  uint32_t bins;
+  float binWidth;
+  float meanSquaredSpeed;
+  uint32_t padding;
+  uint64_t particles;
+};
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void appendU32(std::vector<char> &out, uint32_t value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+uint32_t readU32(const char *data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+void packParticle(std::vector<char> &out, const ParticleSystem &system, size_t i) {
+  const float fields[6] = {system.x[i],  system.y[i],      system.vx[i],
+                           system.vy[i], system.radius[i], system.temperature[i]};
+  const char *bytes = reinterpret_cast<const char *>(fields);
+  out.insert(out.end(), bytes, bytes + PARTICLE_BYTES);
+}
+
+// Appends `count` packed particles to the end of `system`
+void unpackParticles(const char *data, size_t count, ParticleSystem &system) {
+  const size_t first = system.size();
+  system.resize(first + count);
+  for (size_t k = 0; k < count; ++k) {
+    float fields[6];
+    std::memcpy(fields, data + k * PARTICLE_BYTES, PARTICLE_BYTES);
+    const size_t i = first + k;
+    system.x[i] = fields[0];
+    system.y[i] = fields[1];
+    system.vx[i] = fields[2];
+    system.vy[i] = fields[3];
+    system.radius[i] = fields[4];
+    system.temperature[i] = fields[5];
+  }
+  system.computeSpeeds(first, first + count);
+}
+
+#ifndef _WIN32
+
+// Message between neighbouring workers: the migrant count, the halo count,
+// then the migrants and the halo particles
+class NeighbourMessage {
+public:
+  void begin() {
+    bytes.assign(2 * sizeof(uint32_t), 0);
+    migrants = 0;
+    halo = 0;
+  }
+  void addMigrant(const ParticleSystem &system, size_t i) {
+    packParticle(bytes, system, i);
+    ++migrants;
+  }
+  void addHalo(const ParticleSystem &system, size_t i) {
+    packParticle(bytes, system, i);
+    ++halo;
+  }
+  void finish() {
+    std::memcpy(bytes.data(), &migrants, sizeof(migrants));
+    std::memcpy(bytes.data() + sizeof(migrants), &halo, sizeof(halo));
+  }
+
+  std::vector<char> bytes;
+  uint32_t migrants = 0;
+  uint32_t halo = 0;
+};
+
+class Worker {
+public:
+  Worker(int rank, int workers, int coordinator, const Simulation &source,
+         float low, float high, float halo, int threads)
+      : rank(rank), workers(workers), coordinator(coordinator), low(low),
+        high(high), halo(halo), local(source.bounds(), threads) {
+    local.settings = source.settings;
+    local.settings.engine = SimulationEngine::TimeStepped;
+    local.thermostat().settings = source.thermostat().settings;
+    // Each worker draws its own stream for the stochastic thermostats
+    Pcg32 seeds = source.random();
+    local.random().reseed(seeds.next(), static_cast<uint64_t>(rank) + 1);
+
+    const ParticleSystem &particles = source.particles();
+    ParticleSystem &owned = local.particles();
+    for (size_t i = 0; i < particles.size(); ++i) {
+      if (particles.x[i] >= low && particles.x[i] < high) {
+        owned.add(particles.get(i));
+      }
+    }
+  }
+
+  // Serves commands until told to stop or the coordinator goes away
+  int run(Transport &link) {
+    std::vector<OutgoingMessage> noMessages;
+    std::vector<IncomingMessage> commandIn(1, IncomingMessage{coordinator, &commandBytes});
+    for (;;) {
+      if (!link.exchange(noMessages, commandIn) || commandBytes.size() < sizeof(uint32_t)) {
+        return 1;
+      }
+      const uint32_t command = readU32(commandBytes.data());
+      if (command == COMMAND_STOP) {
+        return 0;
+      }
+      if (command == COMMAND_STEP && commandBytes.size() >= sizeof(uint32_t) + sizeof(float)) {
+        float deltaTime;
+        std::memcpy(&deltaTime, commandBytes.data() + sizeof(uint32_t), sizeof(deltaTime));
+        if (!step(link, deltaTime)) {
+          return 1;
+        }
+      } else if (command == COMMAND_THERMOSTAT &&
+                 commandBytes.size() >= sizeof(uint32_t) + sizeof(float)) {
+        if (!thermostat(link)) {
+          return 1;
+        }
+      } else if (command == COMMAND_GATHER) {
+        if (!gather(link)) {
+          return 1;
+        }
+      } else {
+        std::cerr << "Worker " << rank << ": unknown command " << command << std::endl;
+        return 1;
+      }
+    }
+  }
+
+private:
+  bool step(Transport &link, float deltaTime) {
+    StepReport report = StepReport();
+    ParticleSystem &particles = local.particles();
+
+    auto start = std::chrono::steady_clock::now();
+    local.integrate(deltaTime);
+    local.reflectWalls();
+    report.integrateMs = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    toLeft.begin();
+    toRight.begin();
+    // Particles that crossed an edge go to that neighbour. Walking backwards
+    // keeps the swap-remove from moving an unvisited particle.
+    for (size_t i = particles.size(); i-- > 0;) {
+      const float x = particles.x[i];
+      if (x < low) {
+        toLeft.addMigrant(particles, i);
+        particles.remove(i);
+      } else if (x >= high) {
+        toRight.addMigrant(particles, i);
+        particles.remove(i);
+      }
+    }
+    for (size_t i = 0; i < particles.size(); ++i) {
+      const float x = particles.x[i];
+      if (rank > 0 && x < low + halo) {
+        toLeft.addHalo(particles, i);
+      }
+      if (rank + 1 < workers && x >= high - halo) {
+        toRight.addHalo(particles, i);
+      }
+    }
+    toLeft.finish();
+    toRight.finish();
+
+    outgoing.clear();
+    incoming.clear();
+    if (rank > 0) {
+      outgoing.push_back(OutgoingMessage{rank - 1, toLeft.bytes.data(), toLeft.bytes.size()});
+      incoming.push_back(IncomingMessage{rank - 1, &fromLeft});
+    }
+    if (rank + 1 < workers) {
+      outgoing.push_back(OutgoingMessage{rank + 1, toRight.bytes.data(), toRight.bytes.size()});
+      incoming.push_back(IncomingMessage{rank + 1, &fromRight});
+    }
+    if (!link.exchange(outgoing, incoming)) {
+      return false;
+    }
+    report.migrated = toLeft.migrants + toRight.migrants;
+
+    // Arriving migrants become owned, then halos and the particles that just
+    // left are appended as ghosts
+    std::vector<char> *received[2] = {rank > 0 ? &fromLeft : nullptr,
+                                      rank + 1 < workers ? &fromRight : nullptr};
+    for (std::vector<char> *message : received) {
+      if (message && !unpack(*message, true)) {
+        return false;
+      }
+    }
+    const size_t owned = particles.size();
+    for (std::vector<char> *message : received) {
+      if (message) {
+        unpack(*message, false);
+      }
+    }
+    unpackParticles(toLeft.bytes.data() + 2 * sizeof(uint32_t), toLeft.migrants, particles);
+    unpackParticles(toRight.bytes.data() + 2 * sizeof(uint32_t), toRight.migrants, particles);
+    report.ghosts = static_cast<uint32_t>(particles.size() - owned);
+    report.exchangeMs = millisecondsSince(start);
+
+    local.collide(deltaTime);
+    report.collideMs = local.timings().collide;
+    report.candidatePairs = local.collisionCounts().candidatePairs;
+    report.contacts = local.collisionCounts().contacts;
+    particles.resize(owned);
+    report.owned = static_cast<uint32_t>(owned);
+
+    // The coordinator turns every worker's sums into one set of factors
+    Thermostat &thermostat = local.thermostat();
+    thermostat.measureGroups(particles, local.workers());
+    report.groups = static_cast<uint32_t>(thermostat.groupTotal());
+    reply.clear();
+    const char *bytes = reinterpret_cast<const char *>(&report);
+    reply.insert(reply.end(), bytes, bytes + sizeof(report));
+    for (uint32_t g = 0; g < report.groups; ++g) {
+      const double energy = thermostat.groupEnergies()[g];
+      const uint64_t count = thermostat.groupCounts()[g];
+      bytes = reinterpret_cast<const char *>(&energy);
+      reply.insert(reply.end(), bytes, bytes + sizeof(energy));
+      bytes = reinterpret_cast<const char *>(&count);
+      reply.insert(reply.end(), bytes, bytes + sizeof(count));
+    }
+
+    outgoing.clear();
+    outgoing.push_back(OutgoingMessage{coordinator, reply.data(), reply.size()});
+    incoming.clear();
+    return link.exchange(outgoing, incoming);
+  }
+
+  // Applies the factors that follow the time step in the command
+  bool thermostat(Transport &link) {
+    float deltaTime;
+    std::memcpy(&deltaTime, commandBytes.data() + sizeof(uint32_t), sizeof(deltaTime));
+    const size_t header = sizeof(uint32_t) + sizeof(float);
+    factors.resize((commandBytes.size() - header) / sizeof(float));
+    if (!factors.empty()) {
+      std::memcpy(factors.data(), commandBytes.data() + header, factors.size() * sizeof(float));
+    }
+    Thermostat &thermostat = local.thermostat();
+    if (factors.size() != static_cast<size_t>(thermostat.groupTotal())) {
+      std::cerr << "Worker " << rank << ": thermostat factors do not match the groups"
+                << std::endl;
+      return false;
+    }
+    thermostat.applyFactors(local.particles(), factors, deltaTime, local.workers(),
+                            local.random());
+
+    const SpeedHistogram &histogram = thermostat.histogram();
+    ThermostatReport report = ThermostatReport();
+    report.bins = static_cast<uint32_t>(histogram.counts.size());
+    report.binWidth = histogram.binWidth;
+    report.meanSquaredSpeed = histogram.meanSquaredSpeed;
+    report.particles = histogram.particles;
+    reply.clear();
+    const char *bytes = reinterpret_cast<const char *>(&report);
+    reply.insert(reply.end(), bytes, bytes + sizeof(report));
+    bytes = reinterpret_cast<const char *>(histogram.counts.data());
+    reply.insert(reply.end(), bytes, bytes + histogram.counts.size() * sizeof(float));
+
+    outgoing.clear();
+    outgoing.push_back(OutgoingMessage{coordinator, reply.data(), reply.size()});
+    incoming.clear();
+    return link.exchange(outgoing, incoming);
+  }
+
+  // Appends either the migrants or the halo of a neighbour's message
+  bool unpack(const std::vector<char> &message, bool migrants) {
+    if (message.size() < 2 * sizeof(uint32_t)) {
+      std::cerr << "Worker " << rank << ": truncated neighbour message" << std::endl;
+      return false;
+    }
+    const uint32_t migrantCount = readU32(message.data());
+    const uint32_t haloCount = readU32(message.data() + sizeof(uint32_t));
+    if (message.size() != 2 * sizeof(uint32_t) + (size_t(migrantCount) + haloCount) * PARTICLE_BYTES) {
+      std::cerr << "Worker " << rank << ": malformed neighbour message" << std::endl;
+      return false;
+    }
+    const char *data = message.data() + 2 * sizeof(uint32_t);
+    if (migrants) {
+      unpackParticles(data, migrantCount, local.particles());
+    } else {
+      unpackParticles(data + size_t(migrantCount) * PARTICLE_BYTES, haloCount, local.particles());
+    }
+    return true;
+  }
+
+  bool gather(Transport &link) {
+    const ParticleSystem &particles = local.particles();
+    reply.clear();
+    reply.reserve(sizeof(uint32_t) + particles.size() * PARTICLE_BYTES);
+    appendU32(reply, static_cast<uint32_t>(particles.size()));
+    for (size_t i = 0; i < particles.size(); ++i) {
+      packParticle(reply, particles, i);
+    }
+    outgoing.clear();
+    outgoing.push_back(OutgoingMessage{coordinator, reply.data(), reply.size()});
+    incoming.clear();
+    return link.exchange(outgoing, incoming);
+  }
+
+  int rank, workers, coordinator;
+  float low, high, halo;
+  Simulation local;
+  NeighbourMessage toLeft, toRight;
+  std::vector<char> fromLeft, fromRight, commandBytes, reply;
+  std::vector<float> factors;
+  std::vector<OutgoingMessage> outgoing;
+  std::vector<IncomingMessage> incoming;
+};
+
+#endif
+
+} // namespace
+
+#ifndef _WIN32
+
+bool DistributedEngine::start(const Simulation &source,
+                              const DistributedOptions &options,
+                              std::string &error) {
+  stop();
+  const ParticleSystem &particles = source.particles();
+  const BarrierBounds &bounds = source.bounds();
+
+  // A halo of two radii catches every pair that can touch across an edge.
+  // Strips are kept at least two halos wide.
+  float maxRadius = 1.0f;
+  for (float radius : particles.radius) {
+    maxRadius = std::max(maxRadius, radius);
+  }
+  const float halo = 2.0f * maxRadius;
+  const float width = bounds.right - bounds.left;
+  const int widest = std::max(1, static_cast<int>(width / (2.0f * halo)));
+  const int strips = std::max(1, std::min(options.workers, widest));
+  const float stripWidth = width / strips;
+
+  std::vector<std::pair<int, int>> links;
+  for (int k = 0; k + 1 < strips; ++k) {
+    links.push_back(std::make_pair(k, k + 1));
+  }
+  for (int k = 0; k < strips; ++k) {
+    links.push_back(std::make_pair(k, strips));
+  }
+  fabric = createTransportFabric(options.transport, strips + 1, links,
+                                 options.ringBytes, error);
+  if (!fabric) {
+    return false;
+  }
+
+  const pid_t coordinator = getpid();
+  const int threads = std::max(1, source.threadCount() / strips);
+  // Anything buffered would otherwise be written once per process
+  std::cout.flush();
+  std::cerr.flush();
+  for (int rank = 0; rank < strips; ++rank) {
+    const float low = rank == 0 ? -FLT_MAX : bounds.left + stripWidth * rank;
+    const float high = rank + 1 == strips ? FLT_MAX : bounds.left + stripWidth * (rank + 1);
+    pid_t child = fork();
+    if (child < 0) {
+      error = std::string("fork failed: ") + std::strerror(errno);
+      stop();
+      return false;
+    }
+    if (child == 0) {
+      std::unique_ptr<Transport> link = fabric->endpoint(rank);
+      link->setLivenessCheck([coordinator] { return getppid() == coordinator; });
+      int status;
+      {
+        Worker worker(rank, strips, strips, source, low, high, halo, threads);
+        status = worker.run(*link);
+      }
+      // Skip the parent's exit handlers and destructors
+      _exit(status);
+    }
+    children.push_back(child);
+  }
+
+  current = options;
+  workers = strips;
+  transport = fabric->endpoint(strips);
+  transport->setLivenessCheck([this] { return childrenAlive(); });
+  healthy = true;
+  replies.resize(strips);
+  lastStats = DistributedStats();
+  lastStats.workers = strips;
+  lastStats.owned.assign(strips, 0);
+  return true;
+}
+
+void DistributedEngine::stop() {
+  if (!transport && children.empty()) {
+    fabric.reset();
+    return;
+  }
+  // Healthy workers exit on their own; after a failure the rest may be stuck
+  // waiting on the one that went away, so don't wait for them
+  std::string ignored;
+  const bool graceful = transport && healthy && command(COMMAND_STOP, 0.0f, ignored);
+  auto deadline = std::chrono::steady_clock::now() +
+                  (graceful ? std::chrono::seconds(1) : std::chrono::seconds(0));
+  for (;;) {
+    bool waiting = false;
+    for (int &child : children) {
+      if (child > 0 && waitpid(child, nullptr, WNOHANG) == 0) {
+        waiting = true;
+      } else {
+        child = 0;
+      }
+    }
+    if (!waiting || std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    usleep(1000);
+  }
+  if (transport) {
+    transport->abort();
+  }
+  for (int child : children) {
+    if (child > 0) {
+      kill(child, SIGKILL);
+      waitpid(child, nullptr, 0);
+    }
+  }
+  children.clear();
+  transport.reset();
+  fabric.reset();
+}
+
+bool DistributedEngine::childrenAlive() {
+  for (int &child : children) {
+    if (child <= 0 || waitpid(child, nullptr, WNOHANG) != 0) {
+      child = 0;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sends a command to every worker and, unless it is STOP, waits for all of
+// their replies in the same exchange
+bool DistributedEngine::command(uint32_t command, float deltaTime, std::string &error,
+                                const std::vector<float> *values) {
+  commandBuffer.clear();
+  appendU32(commandBuffer, command);
+  const char *bytes = reinterpret_cast<const char *>(&deltaTime);
+  commandBuffer.insert(commandBuffer.end(), bytes, bytes + sizeof(deltaTime));
+  if (values) {
+    bytes = reinterpret_cast<const char *>(values->data());
+    commandBuffer.insert(commandBuffer.end(), bytes, bytes + values->size() * sizeof(float));
+  }
+
+  outgoing.clear();
+  incoming.clear();
+  for (int k = 0; k < workers; ++k) {
+    outgoing.push_back(OutgoingMessage{k, commandBuffer.data(), commandBuffer.size()});
+    if (command != COMMAND_STOP) {
+      incoming.push_back(IncomingMessage{k, &replies[k]});
+    }
+  }
+  if (!transport->exchange(outgoing, incoming)) {
+    error = "A distributed worker stopped responding";
+    healthy = false;
+    return false;
+  }
+  return true;
+}
+
+bool DistributedEngine::step(float deltaTime, Thermostat &thermostat, Pcg32 &rng,
+                             std::string &error) {
+  PROFILE_SCOPE("Distributed step");
+  if (!running()) {
+    error = "Distributed engine is not running";
+    return false;
+  }
+  if (!command(COMMAND_STEP, deltaTime, error)) {
+    return false;
+  }
+  DistributedStats &stats = lastStats;
+  stats.ghosts = 0;
+  stats.migrated = 0;
+  stats.integrateMs = stats.exchangeMs = stats.collideMs = 0.0;
+  stats.candidatePairs = stats.contacts = 0;
+  const int groups = thermostat.groupTotal();
+  groupEnergy.assign(groups, 0.0);
+  groupCount.assign(groups, 0);
+  for (int k = 0; k < workers; ++k) {
+    StepReport report;
+    if (replies[k].size() >= sizeof(StepReport)) {
+      std::memcpy(&report, replies[k].data(), sizeof(report));
+    }
+    if (replies[k].size() < sizeof(StepReport) || report.groups != static_cast<uint32_t>(groups) ||
+        replies[k].size() != sizeof(StepReport) + groups * GROUP_BYTES) {
+      error = "Malformed step report from worker " + std::to_string(k);
+      healthy = false;
+      return false;
+    }
+    // Summed in rank order, so the totals do not depend on timing
+    const char *sums = replies[k].data() + sizeof(StepReport);
+    for (int g = 0; g < groups; ++g) {
+      double energy;
+      uint64_t count;
+      std::memcpy(&energy, sums + g * GROUP_BYTES, sizeof(energy));
+      std::memcpy(&count, sums + g * GROUP_BYTES + sizeof(energy), sizeof(count));
+      groupEnergy[g] += energy;
+      groupCount[g] += static_cast<size_t>(count);
+    }
+    stats.owned[k] = report.owned;
+    stats.ghosts += report.ghosts;
+    // Each migrant is reported by the worker it left
+    stats.migrated += report.migrated;
+    stats.integrateMs = std::max(stats.integrateMs, report.integrateMs);
+    stats.exchangeMs = std::max(stats.exchangeMs, report.exchangeMs);
+    stats.collideMs = std::max(stats.collideMs, report.collideMs);
+    stats.candidatePairs += report.candidatePairs;
+    stats.contacts += report.contacts;
+  }
+  PROFILE_COUNTER("Ghost particles", static_cast<int64_t>(stats.ghosts));
+  PROFILE_COUNTER("Migrated particles", static_cast<int64_t>(stats.migrated));
+
+  // One set of factors for the whole system, as in a single process
+  thermostat.chooseFactors(groupEnergy, groupCount, deltaTime, rng);
+  if (!command(COMMAND_THERMOSTAT, deltaTime, error, &thermostat.factors())) {
+    return false;
+  }
+  histograms.resize(workers);
+  for (int k = 0; k < workers; ++k) {
+    const std::vector<char> &reply = replies[k];
+    ThermostatReport report;
+    if (reply.size() >= sizeof(report)) {
+      std::memcpy(&report, reply.data(), sizeof(report));
+    }
+    if (reply.size() < sizeof(report) ||
+        reply.size() != sizeof(report) + size_t(report.bins) * sizeof(float)) {
+      error = "Malformed thermostat report from worker " + std::to_string(k);
+      healthy = false;
+      return false;
+    }
+    SpeedHistogram &histogram = histograms[k];
+    histogram.counts.resize(report.bins);
+    if (report.bins > 0) {
+      std::memcpy(histogram.counts.data(), reply.data() + sizeof(report),
+                  report.bins * sizeof(float));
+    }
+    histogram.binWidth = report.binWidth;
+    histogram.meanSquaredSpeed = report.meanSquaredSpeed;
+    histogram.particles = static_cast<size_t>(report.particles);
+  }
+  thermostat.mergeHistograms(histograms);
+  return true;
+}
+
+bool DistributedEngine::gather(ParticleSystem &system, std::string &error) {
+  PROFILE_SCOPE("Distributed gather");
+  if (!running()) {
+    error = "Distributed engine is not running";
+    return false;
+  }
+  if (!command(COMMAND_GATHER, 0.0f, error)) {
+    return false;
+  }
+  for (int k = 0; k < workers; ++k) {
+    const std::vector<char> &reply = replies[k];
+    if (reply.size() < sizeof(uint32_t) ||
+        reply.size() != sizeof(uint32_t) + size_t(readU32(reply.data())) * PARTICLE_BYTES) {
+      error = "Malformed particles from worker " + std::to_string(k);
+      healthy = false;
+      return false;
+    }
+  }
+  system.clear();
+  for (int k = 0; k < workers; ++k) {
+    unpackParticles(replies[k].data() + sizeof(uint32_t), readU32(replies[k].data()), system);
+  }
+  return true;
+}
+
+#else
+
+bool DistributedEngine::start(const Simulation &, const DistributedOptions &,
+                              std::string &error) {
+  error = "The distributed engine needs POSIX processes";
+  return false;
+}
+
+void DistributedEngine::stop() {}
+
+bool DistributedEngine::childrenAlive() { return false; }
+
+bool DistributedEngine::command(uint32_t, float, std::string &error,
+                                const std::vector<float> *) {
+  error = "The distributed engine needs POSIX processes";
+  return false;
+}
+
+bool DistributedEngine::step(float, Thermostat &, Pcg32 &, std::string &error) {
+  return command(COMMAND_STEP, 0.0f, error);
+}
+
+bool DistributedEngine::gather(ParticleSystem &, std::string &error) {
+  return command(COMMAND_GATHER, 0.0f, error);
+}
+
+#endif
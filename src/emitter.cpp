@@ -0,0 +1,51 @@
+#include "emitter.h"
+
+#include <algorithm>
+#include <cmath>
+
+size_t emitParticles(ParticleSystem &system, Emitter &emitter, float deltaTime,
+                     size_t limit, Pcg32 &rng) {
+  if (!emitter.enabled || !(emitter.rate > 0.0f)) {
+    emitter.pending = 0.0f;
+    return 0;
+  }
+  float due = emitter.pending + emitter.rate * deltaTime;
+  size_t count = static_cast<size_t>(due);
+  emitter.pending = due - static_cast<float>(count);
+  count = std::min(count, limit);
+  if (count == 0) {
+    return 0;
+  }
+
+  const BarrierBounds &region = emitter.region;
+  const float jitter = emitter.velocityJitter;
+  const size_t first = system.size();
+  system.resize(first + count);
+  for (size_t i = first; i < first + count; ++i) {
+    system.x[i] = rng.uniform(region.left, region.right);
+    system.y[i] = rng.uniform(region.top, region.bottom);
+    system.vx[i] = emitter.velocityX + rng.uniform(-jitter, jitter);
+    system.vy[i] = emitter.velocityY + rng.uniform(-jitter, jitter);
+    system.speed[i] = std::sqrt(system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i]);
+    system.radius[i] = emitter.radius;
+    system.temperature[i] = emitter.temperature;
+  }
+  return count;
+}
+
+size_t absorbParticles(ParticleSystem &system, const Sink &sink) {
+  if (!sink.enabled) {
+    return 0;
+  }
+  const BarrierBounds &region = sink.region;
+  size_t absorbed = 0;
+  // Walk backwards so the particle swapped into a hole was already tested
+  for (size_t i = system.size(); i-- > 0;) {
+    if (system.x[i] >= region.left && system.x[i] <= region.right &&
+        system.y[i] >= region.top && system.y[i] <= region.bottom) {
+      system.remove(i);
+      ++absorbed;
+    }
+  }
+  return absorbed;
+}
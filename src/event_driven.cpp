@@ -0,0 +1,406 @@
+#include "event_driven.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const double NEVER = 1e300;
+
+// Stale events are left in the queue until popped. Once they outnumber the
+// particles by this factor the queue is swept.
+const size_t QUEUE_SLACK = 8;
+
+// Safety valve for pathological input (e.g. a tight cluster of overlapping
+// particles bouncing in place): past this many events per particle in one
+// advance(), the remaining work is dropped and the queue rebuilt.
+const size_t EVENT_BUDGET_PER_PARTICLE = 256;
+
+bool sameArray(const AlignedFloatArray &current, const std::vector<float> &written) {
+  return current.size() == written.size() &&
+         (written.empty() ||
+          std::memcmp(current.data(), written.data(), written.size() * sizeof(float)) == 0);
+}
+
+} // namespace
+
+void EventDrivenEngine::advance(ParticleSystem &system,
+                                const BarrierBounds &bounds, double deltaTime) {
+  lastStats = EventStats();
+  if (!valid || !matchesSystem(system, bounds)) {
+    PROFILE_SCOPE("Event queue rebuild");
+    rebuild(system, bounds);
+  }
+
+  const double target = now + deltaTime;
+  const size_t budget = EVENT_BUDGET_PER_PARTICLE * px.size() + 100000;
+  size_t processed = 0;
+  while (!queue.empty() && queue.front().time <= target) {
+    std::pop_heap(queue.begin(), queue.end(), Later());
+    Event event = queue.back();
+    queue.pop_back();
+
+    if (collisions[event.a] != event.countA ||
+        (event.type == PAIR && collisions[event.b] != event.countB)) {
+      ++lastStats.staleEvents;
+      continue;
+    }
+
+    now = std::max(now, event.time);
+    switch (event.type) {
+    case PAIR:
+      collidePair(event.a, event.b);
+      ++lastStats.pairCollisions;
+      break;
+    case WALL:
+      collideWall(event.a, event.b);
+      ++lastStats.wallCollisions;
+      break;
+    case CELL:
+      crossCell(event.a, event.b);
+      ++lastStats.cellCrossings;
+      break;
+    }
+
+    if (queue.size() > QUEUE_SLACK * px.size() + 1024) {
+      compactQueue();
+    }
+    if (++processed > budget) {
+      valid = false;
+      break;
+    }
+  }
+
+  // Sample every particle at exactly the target time
+  now = target;
+  for (size_t i = 0; i < px.size(); ++i) {
+    moveTo(static_cast<int>(i), target);
+  }
+  writeBack(system);
+  lastStats.queueSize = queue.size();
+}
+
+bool EventDrivenEngine::matchesSystem(const ParticleSystem &system,
+                                      const BarrierBounds &bounds) const {
+  return bounds.left == walls.left && bounds.right == walls.right &&
+         bounds.top == walls.top && bounds.bottom == walls.bottom &&
+         sameArray(system.x, writtenX) && sameArray(system.y, writtenY) &&
+         sameArray(system.vx, writtenVx) && sameArray(system.vy, writtenVy) &&
+         sameArray(system.radius, writtenRadius);
+}
+
+void EventDrivenEngine::rebuild(const ParticleSystem &system,
+                                const BarrierBounds &bounds) {
+  const size_t count = system.size();
+  walls = bounds;
+  now = 0.0;
+
+  px.resize(count);
+  py.resize(count);
+  vx.resize(count);
+  vy.resize(count);
+  t0.assign(count, 0.0);
+  radius.resize(count);
+  collisions.assign(count, 0);
+
+  const double width = std::max(1e-6, static_cast<double>(bounds.right - bounds.left));
+  const double height = std::max(1e-6, static_cast<double>(bounds.bottom - bounds.top));
+  double maxRadius = 0.0;
+  for (size_t i = 0; i < count; ++i) {
+    radius[i] = system.radius[i];
+    vx[i] = system.vx[i];
+    vy[i] = system.vy[i];
+    maxRadius = std::max(maxRadius, radius[i]);
+    // Hard walls: anything outside (or straddling) them is pulled inside
+    double r = std::min(radius[i], std::min(width, height) / 2);
+    px[i] = std::max(bounds.left + r, std::min<double>(system.x[i], bounds.right - r));
+    py[i] = std::max(bounds.top + r, std::min<double>(system.y[i], bounds.bottom - r));
+  }
+
+  // At least a diameter wide, and no more cells than particles
+  double size = std::max(2.0 * maxRadius,
+                         std::sqrt(width * height / std::max<size_t>(count, 1)));
+  columns = std::max(1, static_cast<int>(width / size));
+  rows = std::max(1, static_cast<int>(height / size));
+  cellWidth = width / columns;
+  cellHeight = height / rows;
+  cellHead.assign(static_cast<size_t>(columns) * rows, -1);
+  next.assign(count, -1);
+  prev.assign(count, -1);
+  particleCell.assign(count, 0);
+  for (size_t i = 0; i < count; ++i) {
+    insertIntoCell(static_cast<int>(i), cellOf(px[i], py[i]));
+  }
+
+  queue.clear();
+  for (size_t i = 0; i < count; ++i) {
+    int p = static_cast<int>(i);
+    int cx = particleCell[i] % columns;
+    int cy = particleCell[i] / columns;
+    for (int ny = cy - 1; ny <= cy + 1; ++ny) {
+      for (int nx = cx - 1; nx <= cx + 1; ++nx) {
+        predictWithCell(p, nx, ny, true);
+      }
+    }
+    predictWalls(p);
+    predictCellCrossing(p);
+  }
+  valid = true;
+}
+
+void EventDrivenEngine::writeBack(ParticleSystem &system) {
+  const size_t count = px.size();
+  for (size_t i = 0; i < count; ++i) {
+    system.x[i] = static_cast<float>(px[i]);
+    system.y[i] = static_cast<float>(py[i]);
+    system.vx[i] = static_cast<float>(vx[i]);
+    system.vy[i] = static_cast<float>(vy[i]);
+  }
+  writtenX.assign(system.x.begin(), system.x.end());
+  writtenY.assign(system.y.begin(), system.y.end());
+  writtenVx.assign(system.vx.begin(), system.vx.end());
+  writtenVy.assign(system.vy.begin(), system.vy.end());
+  writtenRadius.assign(system.radius.begin(), system.radius.end());
+}
+
+void EventDrivenEngine::moveTo(int i, double t) {
+  double elapsed = t - t0[i];
+  px[i] += vx[i] * elapsed;
+  py[i] += vy[i] * elapsed;
+  t0[i] = t;
+}
+
+int EventDrivenEngine::cellOf(double x, double y) const {
+  int cx = static_cast<int>((x - walls.left) / cellWidth);
+  int cy = static_cast<int>((y - walls.top) / cellHeight);
+  cx = std::max(0, std::min(cx, columns - 1));
+  cy = std::max(0, std::min(cy, rows - 1));
+  return cy * columns + cx;
+}
+
+void EventDrivenEngine::insertIntoCell(int i, int cell) {
+  particleCell[i] = cell;
+  prev[i] = -1;
+  next[i] = cellHead[cell];
+  if (next[i] >= 0) {
+    prev[next[i]] = i;
+  }
+  cellHead[cell] = i;
+}
+
+void EventDrivenEngine::removeFromCell(int i) {
+  if (prev[i] >= 0) {
+    next[prev[i]] = next[i];
+  } else {
+    cellHead[particleCell[i]] = next[i];
+  }
+  if (next[i] >= 0) {
+    prev[next[i]] = prev[i];
+  }
+}
+
+void EventDrivenEngine::push(const Event &event) {
+  queue.push_back(event);
+  std::push_heap(queue.begin(), queue.end(), Later());
+}
+
+void EventDrivenEngine::compactQueue() {
+  auto stale = [this](const Event &event) {
+    return collisions[event.a] != event.countA ||
+           (event.type == PAIR && collisions[event.b] != event.countB);
+  };
+  queue.erase(std::remove_if(queue.begin(), queue.end(), stale), queue.end());
+  std::make_heap(queue.begin(), queue.end(), Later());
+}
+
+void EventDrivenEngine::predictAll(int i) {
+  int cx = particleCell[i] % columns;
+  int cy = particleCell[i] / columns;
+  for (int ny = cy - 1; ny <= cy + 1; ++ny) {
+    for (int nx = cx - 1; nx <= cx + 1; ++nx) {
+      predictWithCell(i, nx, ny);
+    }
+  }
+  predictWalls(i);
+  predictCellCrossing(i);
+}
+
+void EventDrivenEngine::predictWithCell(int i, int cx, int cy, bool onlyHigher) {
+  if (cx < 0 || cy < 0 || cx >= columns || cy >= rows) {
+    return;
+  }
+  for (int j = cellHead[cy * columns + cx]; j >= 0; j = next[j]) {
+    if (j != i && (!onlyHigher || j > i)) {
+      predictPair(i, j);
+    }
+  }
+}
+
+// Solves |dr + dv t| = ri + rj for the first contact time t >= 0
+void EventDrivenEngine::predictPair(int i, int j) {
+  ++lastStats.predictions;
+  double xi = px[i] + vx[i] * (now - t0[i]);
+  double yi = py[i] + vy[i] * (now - t0[i]);
+  double xj = px[j] + vx[j] * (now - t0[j]);
+  double yj = py[j] + vy[j] * (now - t0[j]);
+  double dx = xj - xi, dy = yj - yi;
+  double dvx = vx[j] - vx[i], dvy = vy[j] - vy[i];
+
+  double b = dx * dvx + dy * dvy;
+  if (b >= 0.0) {
+    return; // not approaching
+  }
+  double sigma = radius[i] + radius[j];
+  double c = dx * dx + dy * dy - sigma * sigma;
+  double dv2 = dvx * dvx + dvy * dvy;
+  double t;
+  if (c <= 0.0) {
+    t = 0.0; // already touching and closing in: collide now
+  } else {
+    double discriminant = b * b - dv2 * c;
+    if (discriminant <= 0.0) {
+      return; // passes by
+    }
+    t = c / (-b + std::sqrt(discriminant));
+  }
+
+  Event event = {now + t, i, j, collisions[i], collisions[j], PAIR};
+  push(event);
+}
+
+void EventDrivenEngine::predictWalls(int i) {
+  double x = px[i] + vx[i] * (now - t0[i]);
+  double y = py[i] + vy[i] * (now - t0[i]);
+  double r = radius[i];
+
+  double tx = NEVER, ty = NEVER;
+  int sideX = 0, sideY = 2;
+  if (vx[i] > 0.0) {
+    tx = (walls.right - r - x) / vx[i];
+    sideX = 1;
+  } else if (vx[i] < 0.0) {
+    tx = (walls.left + r - x) / vx[i];
+  }
+  if (vy[i] > 0.0) {
+    ty = (walls.bottom - r - y) / vy[i];
+    sideY = 3;
+  } else if (vy[i] < 0.0) {
+    ty = (walls.top + r - y) / vy[i];
+  }
+
+  // Only the first wall matters: hitting it bumps the collision count and
+  // re-predicts the rest
+  double t = std::min(tx, ty);
+  if (t >= NEVER) {
+    return;
+  }
+  Event event = {now + std::max(0.0, t), i, tx <= ty ? sideX : sideY,
+                 collisions[i], 0, WALL};
+  push(event);
+}
+
+void EventDrivenEngine::predictCellCrossing(int i) {
+  double x = px[i] + vx[i] * (now - t0[i]);
+  double y = py[i] + vy[i] * (now - t0[i]);
+  int cx = particleCell[i] % columns;
+  int cy = particleCell[i] / columns;
+
+  double tx = NEVER, ty = NEVER;
+  int directionX = 0, directionY = 2;
+  if (vx[i] > 0.0 && cx + 1 < columns) {
+    tx = (walls.left + (cx + 1) * cellWidth - x) / vx[i];
+    directionX = 1;
+  } else if (vx[i] < 0.0 && cx > 0) {
+    tx = (walls.left + cx * cellWidth - x) / vx[i];
+  }
+  if (vy[i] > 0.0 && cy + 1 < rows) {
+    ty = (walls.top + (cy + 1) * cellHeight - y) / vy[i];
+    directionY = 3;
+  } else if (vy[i] < 0.0 && cy > 0) {
+    ty = (walls.top + cy * cellHeight - y) / vy[i];
+  }
+
+  double t = std::min(tx, ty);
+  if (t >= NEVER) {
+    return;
+  }
+  Event event = {now + std::max(0.0, t), i, tx <= ty ? directionX : directionY,
+                 collisions[i], 0, CELL};
+  push(event);
+}
+
+// Elastic collision between equal masses: the normal components of the two
+// velocities are exchanged.
+void EventDrivenEngine::collidePair(int i, int j) {
+  moveTo(i, now);
+  moveTo(j, now);
+  double dx = px[j] - px[i], dy = py[j] - py[i];
+  double distance = std::sqrt(dx * dx + dy * dy);
+  if (distance > 0.0) {
+    double nx = dx / distance, ny = dy / distance;
+    double approach = (vx[j] - vx[i]) * nx + (vy[j] - vy[i]) * ny;
+    if (approach < 0.0) {
+      vx[i] += approach * nx;
+      vy[i] += approach * ny;
+      vx[j] -= approach * nx;
+      vy[j] -= approach * ny;
+    }
+  }
+  ++collisions[i];
+  ++collisions[j];
+  predictAll(i);
+  predictAll(j);
+}
+
+void EventDrivenEngine::collideWall(int i, int side) {
+  moveTo(i, now);
+  double r = radius[i];
+  switch (side) {
+  case 0:
+    px[i] = walls.left + r;
+    vx[i] = std::fabs(vx[i]);
+    break;
+  case 1:
+    px[i] = walls.right - r;
+    vx[i] = -std::fabs(vx[i]);
+    break;
+  case 2:
+    py[i] = walls.top + r;
+    vy[i] = std::fabs(vy[i]);
+    break;
+  default:
+    py[i] = walls.bottom - r;
+    vy[i] = -std::fabs(vy[i]);
+    break;
+  }
+  ++collisions[i];
+  predictAll(i);
+}
+
+// Moves the particle one cell over and predicts collisions with the row or
+// column of cells that has just come within reach.
+void EventDrivenEngine::crossCell(int i, int direction) {
+  moveTo(i, now);
+  int cx = particleCell[i] % columns;
+  int cy = particleCell[i] / columns;
+  int stepX = direction == 0 ? -1 : direction == 1 ? 1 : 0;
+  int stepY = direction == 2 ? -1 : direction == 3 ? 1 : 0;
+  cx = std::max(0, std::min(cx + stepX, columns - 1));
+  cy = std::max(0, std::min(cy + stepY, rows - 1));
+
+  removeFromCell(i);
+  insertIntoCell(i, cy * columns + cx);
+
+  if (stepX != 0) {
+    for (int ny = cy - 1; ny <= cy + 1; ++ny) {
+      predictWithCell(i, cx + stepX, ny);
+    }
+  } else {
+    for (int nx = cx - 1; nx <= cx + 1; ++nx) {
+      predictWithCell(i, nx, cy + stepY);
+    }
+  }
+  predictCellCrossing(i);
+}
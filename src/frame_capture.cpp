@@ -0,0 +1,450 @@
+#include "frame_capture.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+namespace {
+
+const uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+// Deflate's length and distance alphabets (RFC 1951, 3.2.5)
+const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10,  11,  13,
+                                  15, 17, 19, 23, 27, 31, 35, 43,  51,  59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t DISTANCE_BASE[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,   25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513,  769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const size_t MAX_MATCH = 258;
+const size_t MAX_DISTANCE = 32768;
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  static uint32_t table[256];
+  static bool built = [] {
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[n] = c;
+    }
+    return true;
+  }();
+  (void)built;
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+uint32_t adler32(const uint8_t *data, size_t size) {
+  uint32_t a = 1, b = 0;
+  while (size > 0) {
+    // Largest run before the sums can overflow 32 bits
+    size_t run = std::min<size_t>(size, 5552);
+    size -= run;
+    for (size_t i = 0; i < run; ++i) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+void appendBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+  out.push_back(static_cast<uint8_t>(value >> 24));
+  out.push_back(static_cast<uint8_t>(value >> 16));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+// Deflate writes bits least significant first, but Huffman codes most
+// significant first
+class BitWriter {
+public:
+  explicit BitWriter(std::vector<uint8_t> &out) : out(out) {}
+
+  void bits(uint32_t value, int count) {
+    accumulator |= static_cast<uint64_t>(value) << used;
+    used += count;
+    while (used >= 8) {
+      out.push_back(static_cast<uint8_t>(accumulator));
+      accumulator >>= 8;
+      used -= 8;
+    }
+  }
+
+  void code(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; ++i) {
+      reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    bits(reversed, length);
+  }
+
+  void flush() {
+    if (used > 0) {
+      out.push_back(static_cast<uint8_t>(accumulator));
+    }
+    accumulator = 0;
+    used = 0;
+  }
+
+private:
+  std::vector<uint8_t> &out;
+  uint64_t accumulator = 0;
+  int used = 0;
+};
+
+// Fixed Huffman literal/length codes (RFC 1951, 3.2.6)
+void writeSymbol(BitWriter &writer, int symbol) {
+  if (symbol < 144) {
+    writer.code(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    writer.code(0x190 + (symbol - 144), 9);
+  } else if (symbol < 280) {
+    writer.code(symbol - 256, 7);
+  } else {
+    writer.code(0xc0 + (symbol - 280), 8);
+  }
+}
+
+template <size_t N> int baseIndex(const uint16_t (&bases)[N], size_t value) {
+  int index = static_cast<int>(N) - 1;
+  while (bases[index] > value) {
+    --index;
+  }
+  return index;
+}
+
+void writeMatch(BitWriter &writer, size_t length, size_t distance) {
+  int lengthCode = baseIndex(LENGTH_BASE, length);
+  writeSymbol(writer, 257 + lengthCode);
+  writer.bits(static_cast<uint32_t>(length - LENGTH_BASE[lengthCode]), LENGTH_EXTRA[lengthCode]);
+  int distanceCode = baseIndex(DISTANCE_BASE, distance);
+  writer.code(distanceCode, 5);
+  writer.bits(static_cast<uint32_t>(distance - DISTANCE_BASE[distanceCode]),
+              DISTANCE_EXTRA[distanceCode]);
+}
+
+size_t matchLength(const uint8_t *data, size_t at, size_t size, size_t distance) {
+  if (distance == 0 || distance > at || distance > MAX_DISTANCE) {
+    return 0;
+  }
+  const size_t limit = std::min(MAX_MATCH, size - at);
+  size_t length = 0;
+  while (length < limit && data[at + length] == data[at + length - distance]) {
+    ++length;
+  }
+  return length;
+}
+
+// One fixed-Huffman block that only looks for repeats of the previous pixel
+// and of the pixel above. Rendered frames are mostly flat background and
+// flat discs, which this covers without a hash table.
+void deflateRuns(const uint8_t *data, size_t size, size_t rowBytes,
+                 std::vector<uint8_t> &out) {
+  out.push_back(0x78); // zlib: deflate, 32K window
+  out.push_back(0x01);
+  BitWriter writer(out);
+  writer.bits(1, 1); // final block
+  writer.bits(1, 2); // fixed Huffman codes
+  size_t at = 0;
+  while (at < size) {
+    size_t length = matchLength(data, at, size, 3);
+    size_t distance = 3;
+    size_t above = matchLength(data, at, size, rowBytes);
+    if (above > length) {
+      length = above;
+      distance = rowBytes;
+    }
+    if (length >= 3) {
+      writeMatch(writer, length, distance);
+      at += length;
+    } else {
+      writeSymbol(writer, data[at]);
+      ++at;
+    }
+  }
+  writeSymbol(writer, 256);
+  writer.flush();
+  appendBigEndian(out, adler32(data, size));
+}
+
+void appendChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data,
+                 size_t size) {
+  appendBigEndian(out, static_cast<uint32_t>(size));
+  const size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + size);
+  appendBigEndian(out, crc32(out.data() + start, size + 4));
+}
+
+// Replaces every {name} in `text`
+std::string substitute(std::string text, const std::string &name,
+                       const std::string &value) {
+  const std::string key = "{" + name + "}";
+  for (size_t at = text.find(key); at != std::string::npos;
+       at = text.find(key, at + value.size())) {
+    text.replace(at, key.size(), value);
+  }
+  return text;
+}
+
+const char *extensionOf(CaptureFormat format) {
+  switch (format) {
+  case CaptureFormat::Raw:
+    return ".rgb";
+  case CaptureFormat::Ppm:
+    return ".ppm";
+  case CaptureFormat::Png:
+    return ".png";
+  case CaptureFormat::Pipe:
+    break;
+  }
+  return "";
+}
+
+} // namespace
+
+const char *captureFormatName(CaptureFormat format) {
+  switch (format) {
+  case CaptureFormat::Raw:
+    return "Raw RGB";
+  case CaptureFormat::Ppm:
+    return "PPM";
+  case CaptureFormat::Png:
+    return "PNG";
+  case CaptureFormat::Pipe:
+    return "Pipe to Command";
+  }
+  return "Unknown";
+}
+
+void encodePng(const uint8_t *pixels, int width, int height,
+               std::vector<uint8_t> &out, std::vector<uint8_t> &scratch) {
+  // Every scanline starts with its filter type; 0 leaves the bytes as they are
+  const size_t rowBytes = static_cast<size_t>(width) * 3;
+  scratch.resize((rowBytes + 1) * height);
+  for (int row = 0; row < height; ++row) {
+    uint8_t *line = scratch.data() + (rowBytes + 1) * row;
+    line[0] = 0;
+    std::memcpy(line + 1, pixels + rowBytes * row, rowBytes);
+  }
+
+  out.clear();
+  out.insert(out.end(), PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+  std::vector<uint8_t> header;
+  appendBigEndian(header, static_cast<uint32_t>(width));
+  appendBigEndian(header, static_cast<uint32_t>(height));
+  const uint8_t format[5] = {8, 2, 0, 0, 0}; // 8-bit RGB, no interlace
+  header.insert(header.end(), format, format + 5);
+  appendChunk(out, "IHDR", header.data(), header.size());
+
+  // Deflate straight after the chunk's length and type, then patch the length
+  const size_t lengthAt = out.size();
+  appendBigEndian(out, 0);
+  out.insert(out.end(), {'I', 'D', 'A', 'T'});
+  deflateRuns(scratch.data(), scratch.size(), rowBytes + 1, out);
+  const size_t dataSize = out.size() - lengthAt - 8;
+  for (int i = 0; i < 4; ++i) {
+    out[lengthAt + i] = static_cast<uint8_t>(dataSize >> (24 - 8 * i));
+  }
+  appendBigEndian(out, crc32(out.data() + lengthAt + 4, dataSize + 4));
+  appendChunk(out, "IEND", nullptr, 0);
+}
+
+bool FrameEncoder::open(const CaptureOptions &options, std::string &error) {
+  close();
+  if (options.width <= 0 || options.height <= 0) {
+    error = "Capture size must be positive";
+    return false;
+  }
+  settings = options;
+  settings.queueDepth = std::max(1, options.queueDepth);
+
+  if (settings.format == CaptureFormat::Pipe) {
+    std::string command = settings.target;
+    command = substitute(command, "width", std::to_string(settings.width));
+    command = substitute(command, "height", std::to_string(settings.height));
+    command = substitute(command, "fps", std::to_string(settings.framesPerSecond));
+#ifndef _WIN32
+    // A command that exits early must fail the write, not kill the viewer
+    std::signal(SIGPIPE, SIG_IGN);
+    pipe = popen(command.c_str(), "w");
+#else
+    pipe = popen(command.c_str(), "wb");
+#endif
+    if (!pipe) {
+      error = "Could not start " + command;
+      return false;
+    }
+  }
+
+  framesCaptured.store(0);
+  framesDropped.store(0);
+  framesWritten.store(0);
+  bytesWritten.store(0);
+  encodeMs.store(0.0);
+  writeFailed.store(false);
+  nextIndex = 0;
+
+  const size_t frameBytes = static_cast<size_t>(pitch()) * settings.height;
+  frames.assign(settings.queueDepth, std::vector<uint8_t>(frameBytes));
+  freeFrames.clear();
+  for (int i = 0; i < settings.queueDepth; ++i) {
+    freeFrames.push_back(i);
+  }
+  queuedFrames.clear();
+  acquired = -1;
+  closing = false;
+  opened = true;
+  thread = std::thread(&FrameEncoder::run, this);
+  return true;
+}
+
+void FrameEncoder::close() {
+  if (!opened) {
+    return;
+  }
+  cancel();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  ready.notify_one();
+  thread.join();
+  if (pipe) {
+    pclose(pipe);
+    pipe = nullptr;
+  }
+  opened = false;
+}
+
+uint8_t *FrameEncoder::acquire() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (freeFrames.empty() || writeFailed.load()) {
+    framesDropped.fetch_add(1);
+    return nullptr;
+  }
+  acquired = freeFrames.back();
+  freeFrames.pop_back();
+  return frames[acquired].data();
+}
+
+void FrameEncoder::submit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (acquired < 0) {
+      return;
+    }
+    queuedFrames.push_back(acquired);
+    acquired = -1;
+  }
+  framesCaptured.fetch_add(1);
+  ready.notify_one();
+}
+
+void FrameEncoder::cancel() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (acquired >= 0) {
+    freeFrames.push_back(acquired);
+    acquired = -1;
+  }
+}
+
+CaptureStats FrameEncoder::stats() const {
+  CaptureStats stats;
+  stats.framesCaptured = framesCaptured.load();
+  stats.framesDropped = framesDropped.load();
+  stats.framesWritten = framesWritten.load();
+  stats.bytesWritten = bytesWritten.load();
+  stats.encodeMs = encodeMs.load();
+  stats.failed = writeFailed.load();
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.framesQueued = static_cast<int>(queuedFrames.size());
+  return stats;
+}
+
+void FrameEncoder::run() {
+  PROFILE_ONLY(setProfileThreadName("Frame encoder");)
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    ready.wait(lock, [this] { return closing || !queuedFrames.empty(); });
+    if (queuedFrames.empty()) {
+      break; // closing with nothing left to write
+    }
+    int slot = queuedFrames.front();
+    queuedFrames.pop_front();
+
+    lock.unlock();
+    if (writeFailed.load() || !encode(frames[slot], nextIndex)) {
+      writeFailed.store(true);
+      framesDropped.fetch_add(1);
+    }
+    ++nextIndex;
+    lock.lock();
+    freeFrames.push_back(slot);
+  }
+}
+
+bool FrameEncoder::encode(const std::vector<uint8_t> &frame, uint64_t index) {
+  PROFILE_SCOPE("Encode capture");
+  auto start = std::chrono::steady_clock::now();
+  const uint8_t *data = frame.data();
+  size_t size = frame.size();
+  if (settings.format == CaptureFormat::Ppm) {
+    const std::string header = "P6\n" + std::to_string(settings.width) + " " +
+                               std::to_string(settings.height) + "\n255\n";
+    buffer.assign(header.begin(), header.end());
+    buffer.insert(buffer.end(), frame.begin(), frame.end());
+    data = buffer.data();
+    size = buffer.size();
+  } else if (settings.format == CaptureFormat::Png) {
+    encodePng(frame.data(), settings.width, settings.height, buffer, scanlines);
+    data = buffer.data();
+    size = buffer.size();
+  }
+
+  bool written;
+  if (pipe) {
+    written = std::fwrite(data, 1, size, pipe) == size;
+  } else {
+    char number[32];
+    std::snprintf(number, sizeof(number), "_%06llu",
+                  static_cast<unsigned long long>(index));
+    const std::string path = settings.target + number + extensionOf(settings.format);
+    FILE *file = std::fopen(path.c_str(), "wb");
+    written = file && std::fwrite(data, 1, size, file) == size;
+    if (file) {
+      written = std::fclose(file) == 0 && written;
+    }
+  }
+  if (written) {
+    framesWritten.fetch_add(1);
+    bytesWritten.fetch_add(size);
+  }
+  encodeMs.store(millisecondsSince(start));
+  return written;
+}
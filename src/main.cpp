@@ -1,16 +1,83 @@
 #include <SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <imgui.h>
 #include <imgui_impl_sdl2.h>
 #include <imgui_impl_sdlrenderer2.h>
 #include <iostream>
 #include <math.h>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
-#include "color_ramp.h"
+#include "capture_target.h"
+#include "checkpoint.h"
 #include "constants.h"
 #include "particle.h"
+#include "particle_renderer.h"
+#include "particle_system.h"
+#include "profiler.h"
+#include "ring_buffer.h"
+#include "seeding.h"
+#include "simulation.h"
+#include "simulation_thread.h"
+#include "spatial_grid.h"
+#include "thread_pool.h"
+#include "trajectory.h"
 
 int main(int argc, char *argv[]) {
+  // Offscreen mode renders captured frames only, with the window hidden, and
+  // exits after `duration` simulated seconds. Without a display, also set
+  // SDL_VIDEODRIVER=offscreen (or dummy, which uses the software renderer).
+  bool offscreen = false;
+  double duration = 10.0;
+  CaptureOptions captureOptions;
+  captureOptions.width = WINDOW_WIDTH;
+  captureOptions.height = WINDOW_HEIGHT;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--offscreen") {
+      offscreen = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Usage: fluid-sim [--offscreen] [--duration SECONDS] "
+                   "[--capture PATH] [--capture-format raw|ppm|png|pipe] "
+                   "[--capture-fps N] [--capture-queue N]"
+                << std::endl;
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (arg == "--duration") {
+      duration = std::atof(value.c_str());
+    } else if (arg == "--capture") {
+      captureOptions.target = value;
+    } else if (arg == "--capture-format") {
+      if (value == "raw") {
+        captureOptions.format = CaptureFormat::Raw;
+      } else if (value == "ppm") {
+        captureOptions.format = CaptureFormat::Ppm;
+      } else if (value == "png") {
+        captureOptions.format = CaptureFormat::Png;
+      } else if (value == "pipe") {
+        captureOptions.format = CaptureFormat::Pipe;
+      } else {
+        std::cerr << "Unknown capture format: " << value << std::endl;
+        return 1;
+      }
+    } else if (arg == "--capture-fps") {
+      captureOptions.framesPerSecond = static_cast<float>(std::atof(value.c_str()));
+    } else if (arg == "--capture-queue") {
+      captureOptions.queueDepth = std::max(1, std::atoi(value.c_str()));
+    } else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError()
               << std::endl;
@@ -19,7 +86,8 @@ int main(int argc, char *argv[]) {
 
   SDL_Window *window = SDL_CreateWindow(
       "SDL Particle with ImGui", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-      WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+      WINDOW_WIDTH, WINDOW_HEIGHT,
+      offscreen ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
   if (!window) {
     std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError()
               << std::endl;
@@ -28,7 +96,9 @@ int main(int argc, char *argv[]) {
   }
 
   SDL_Renderer *renderer =
-      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+      SDL_CreateRenderer(window, -1,
+                         SDL_RENDERER_TARGETTEXTURE |
+                             (offscreen ? 0 : SDL_RENDERER_ACCELERATED));
   if (!renderer) {
     std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError()
               << std::endl;
@@ -45,18 +115,28 @@ int main(int argc, char *argv[]) {
   ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
   ImGui_ImplSDLRenderer2_Init(renderer);
 
-  std::vector<Particle> particles =
-      generate_random_particles(INITIAL_PARTICLE_COUNT, WINDOW_WIDTH,
-                                WINDOW_HEIGHT, BARRIER_RADIUS, PARTICLE_RADIUS);
+  PROFILE_ONLY(setProfileThreadName("UI");)
+
+  // Physics runs on its own thread at a fixed timestep; this thread only
+  // draws the latest snapshot and forwards UI changes as commands.
+  int threadCount = ThreadPool::hardwareThreads();
+  SimulationThread simulation(
+      barrierBounds(WINDOW_WIDTH, WINDOW_HEIGHT, BARRIER_RADIUS), threadCount);
+  simulation.post([](Simulation &sim) {
+    sim.particles() = ParticleSystem(
+        generate_random_particles(INITIAL_PARTICLE_COUNT, WINDOW_WIDTH,
+                                  WINDOW_HEIGHT, BARRIER_RADIUS,
+                                  PARTICLE_RADIUS));
+    sim.particlesEdited();
+  });
+  simulation.start();
 
   bool quit = false;
   SDL_Event event;
   Uint32 lastFrame = SDL_GetTicks(), currentFrame;
-  float deltaTime = 0.0f;
 
   const int TARGET_FPS = 120;
   const int FRAME_DELAY = 1000 / TARGET_FPS;
-  int frameTime = 0;
 
   static float posX = static_cast<float>(WINDOW_WIDTH) / 2;
   static float posY = static_cast<float>(WINDOW_HEIGHT) / 2;
@@ -65,11 +145,138 @@ int main(int argc, char *argv[]) {
   static float temperature = 0.0f;
   static float radius = 10.0f;
 
-  while (!quit) {
-    currentFrame = SDL_GetTicks();
-    deltaTime = (currentFrame - lastFrame) / 1000.0f;
-    lastFrame = currentFrame;
+  SimulationSettings settings;
+  uint64_t seenFallbacks = 0;
+  float stepRate = simulation.stepRate();
+
+  float maxVelocity =
+      100.0f; // Adjust this based on your particles' velocity range
+  std::unique_ptr<ParticleRenderer> particleRenderer(
+      new ParticleRenderer(renderer, maxVelocity));
+  RenderBackend renderBackend = RenderBackend::Batched;
+
+  // Offscreen frame capture, independent of what the window shows
+  std::unique_ptr<CaptureTarget> capture(new CaptureTarget(renderer));
+  char capturePath[256];
+  std::snprintf(capturePath, sizeof(capturePath), "%s", captureOptions.target.c_str());
+  std::string captureStatus;
+
+  // Bulk spawning; each batch uses the next seed so batches differ
+  int spawnCount = 10000;
+  SeedingMode spawnMode = SeedingMode::PoissonDisk;
+  uint64_t spawnSeed = std::random_device()();
+  std::atomic<int> lastSpawnRequested(0);
+  std::atomic<int> lastSpawnPlaced(0);
+
+  // Checkpoints are saved and loaded by commands on the physics thread, which
+  // report back through this status line
+  char checkpointPath[256] = "fluid-sim.ckp";
+  std::mutex checkpointStatusMutex;
+  std::string checkpointStatus;
+
+  // Mirrors the solver's settings; edits are posted as commands
+  SphSettings sphSettings;
+
+  // Mirrors the thermostat's settings; edits are posted as commands
+  ThermostatSettings thermostatSettings;
+  std::vector<float> expectedSpeeds;
+
+  // Handles of particles added with the button, newest last
+  std::mutex addedMutex;
+  std::vector<ParticleHandle> addedParticles;
+
+  // Mirrors of the simulation's emitters and sinks
+  std::vector<Emitter> emitterList;
+  std::vector<Sink> sinkList;
+  float regionX = static_cast<float>(WINDOW_WIDTH) / 2;
+  float regionY = static_cast<float>(WINDOW_HEIGHT) / 2;
+  float regionSize = 40.0f;
+
+  // Trajectory recording
+  char recordingPath[256] = "fluid-sim.trj";
+  TrajectoryOptions recordingOptions;
+  int recordEverySteps = 2;
+  std::string recordingStatus;
+
+  // Playback of a recorded trajectory replaces the live view while open
+  char playbackPath[256] = "fluid-sim.trj";
+  TrajectoryReader playback;
+  ParticleSnapshot playbackSnapshot;
+  std::string playbackStatus;
+  int playbackFrame = 0;
+  bool playbackPlaying = false;
+  double playbackTime = 0.0;
+  bool paused = false;
+
+  // Histories for the plots, one entry per drawn frame
+  RingBuffer<float, 50> velocities;
+  RingBuffer<float, 240> frameTimes;
+  RingBuffer<float, 240> pairHistory;
+  RingBuffer<float, 240> contactHistory;
+
+#if FLUID_SIM_PROFILER
+  // Profiler window: totals over the last second, refreshed a few times a
+  // second so the table is readable
+  const uint64_t PROFILE_WINDOW_NS = 1000000000ULL;
+  std::vector<ProfileEvent> profileEvents;
+  std::vector<ProfileSummary> profileSummaries;
+  Uint32 lastProfileRefresh = 0;
+  char tracePath[256] = "fluid-sim-trace.json";
+  std::string traceStatus;
+#endif
+
+  // Everything but the UI: what the window shows and what capture records
+  auto drawScene = [&](const ParticleSnapshot &frame) {
+    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+    SDL_RenderClear(renderer);
+
+    // Draw barrier rectangle
+    SDL_Color barrierColor = {0, 0, 0, 255};
+    SDL_SetRenderDrawColor(renderer, barrierColor.r, barrierColor.g,
+                           barrierColor.b, barrierColor.a);
+
+    SDL_Rect barrierRect;
+    barrierRect.x = WINDOW_WIDTH / 2 - BARRIER_RADIUS / 2;
+    barrierRect.y = WINDOW_HEIGHT / 2 - BARRIER_RADIUS / 2;
+    barrierRect.w = BARRIER_RADIUS; // Width of the rectangle
+    barrierRect.h = BARRIER_RADIUS; // Height of the rectangle
+
+    SDL_RenderDrawRect(renderer, &barrierRect);
+
+    // Outline emitters in green and sinks in red
+    auto drawRegion = [renderer](const BarrierBounds &region) {
+      SDL_Rect rect;
+      rect.x = static_cast<int>(region.left);
+      rect.y = static_cast<int>(region.top);
+      rect.w = static_cast<int>(region.right - region.left);
+      rect.h = static_cast<int>(region.bottom - region.top);
+      SDL_RenderDrawRect(renderer, &rect);
+    };
+    SDL_SetRenderDrawColor(renderer, 60, 200, 90, 255);
+    for (const Emitter &emitter : emitterList) {
+      drawRegion(emitter.region);
+    }
+    SDL_SetRenderDrawColor(renderer, 220, 60, 60, 255);
+    for (const Sink &sink : sinkList) {
+      drawRegion(sink.region);
+    }
+
+    // Draw the particles of the latest snapshot
+    {
+      PROFILE_SCOPE("Draw particles");
+      particleRenderer->draw(frame, renderBackend);
+    }
+  };
+
+  if (offscreen) {
+    std::string error;
+    if (!capture->start(captureOptions, error)) {
+      std::cerr << "Could not start capture: " << error << std::endl;
+      quit = true;
+    }
+  }
 
+  while (!quit) {
     while (SDL_PollEvent(&event)) {
       ImGui_ImplSDL2_ProcessEvent(&event);
       if (event.type == SDL_QUIT) {
@@ -77,113 +284,737 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    // Simulation update
-    for (size_t i = 0; i < particles.size(); ++i) {
-      UpdateParticle(particles[i], deltaTime, WINDOW_WIDTH, WINDOW_HEIGHT,
-                     BARRIER_RADIUS);
-      checkBarrierCollision(particles[i], WINDOW_WIDTH, WINDOW_HEIGHT,
-                            BARRIER_RADIUS);
-      for (size_t j = i + 1; j < particles.size(); ++j) {
-        CheckCollision(particles[i], particles[j]);
+    if (offscreen) {
+      // No UI and no presenting: just capture ticks until the duration is up
+      const ParticleSnapshot &snapshot = simulation.latestSnapshot();
+      if (capture->due(snapshot.simulationTime)) {
+        capture->capture([&] { drawScene(snapshot); });
+      }
+      if (snapshot.simulationTime >= duration) {
+        quit = true;
+      } else {
+        SDL_Delay(1);
       }
+      continue;
     }
 
-    frameTime += SDL_GetTicks() - currentFrame;
+    currentFrame = SDL_GetTicks();
+    if (currentFrame - lastFrame < static_cast<Uint32>(FRAME_DELAY)) {
+      SDL_Delay(1);
+      continue;
+    }
+    const double frameSeconds = (currentFrame - lastFrame) / 1000.0;
+    lastFrame = currentFrame;
+    PROFILE_SCOPE("Frame");
+    frameTimes.push(static_cast<float>(frameSeconds * 1000.0));
 
-    if (frameTime >= FRAME_DELAY) {
-      // Rendering
-      ImGui_ImplSDL2_NewFrame(window);
-      ImGui_ImplSDLRenderer2_NewFrame();
-      ImGui::NewFrame();
+    if (playback.isOpen() && playbackPlaying) {
+      // Advance through the recording in simulated time, looping at the end
+      const int lastIndex = static_cast<int>(playback.frameCount()) - 1;
+      playbackTime += frameSeconds;
+      int frame = playbackFrame;
+      while (frame < lastIndex && playback.frameTime(frame + 1) <= playbackTime) {
+        ++frame;
+      }
+      if (frame == lastIndex && playbackTime > playback.frameTime(lastIndex)) {
+        frame = 0;
+        playbackTime = playback.frameTime(0);
+      }
+      if (frame != playbackFrame) {
+        playbackFrame = frame;
+        playback.decode(playbackFrame, playbackSnapshot);
+      }
+    }
+
+    const ParticleSnapshot &liveSnapshot = simulation.latestSnapshot();
+    const ParticleSnapshot &snapshot =
+        playback.isOpen() ? playbackSnapshot : liveSnapshot;
 
-      // ImGui UI
-      ImGui::Begin("Control Panel");
-      // Add ImGui widgets here.
-      if (ImGui::Button("Delete All Particles")) {
-        particles.clear(); // Clears all elements from the particles vector
+    // The physics thread switches to time stepping when the distributed
+    // workers fail; follow it so the next settings change does not post the
+    // distributed engine again
+    if (liveSnapshot.distributedFallbacks != seenFallbacks) {
+      seenFallbacks = liveSnapshot.distributedFallbacks;
+      if (settings.engine == SimulationEngine::Distributed) {
+        settings.engine = SimulationEngine::TimeStepped;
       }
+    }
+
+    // Rendering
+    PROFILE_ONLY(uint64_t buildStart = profileNow();)
+    ImGui_ImplSDL2_NewFrame(window);
+    ImGui_ImplSDLRenderer2_NewFrame();
+    ImGui::NewFrame();
+
+    // ImGui UI
+    ImGui::Begin("Control Panel");
+    // Add ImGui widgets here.
+    if (ImGui::Button("Delete All Particles")) {
+      // Clears all particles from the system
+      simulation.post([](Simulation &sim) {
+        sim.particles().clear();
+        sim.particlesEdited();
+      });
+    }
+
+    // Fixed-step penalty collisions, exact event-driven hard spheres, SPH, or
+    // fixed-step split across worker processes
+    bool settingsChanged = false;
+    int engineIndex = static_cast<int>(settings.engine);
+    const char *engineNames[] = {
+        simulationEngineName(SimulationEngine::TimeStepped),
+        simulationEngineName(SimulationEngine::EventDriven),
+        simulationEngineName(SimulationEngine::Sph),
+        simulationEngineName(SimulationEngine::Distributed)};
+    if (ImGui::Combo("Engine", &engineIndex, engineNames, 4)) {
+      settings.engine = static_cast<SimulationEngine>(engineIndex);
+      settingsChanged = true;
+    }
 
-      // Labeled input fields for new particle properties
-      ImGui::Text("New Particle Properties");
-      ImGui::SliderFloat("Position X", &posX, 0.0f, WINDOW_WIDTH);
-      ImGui::SliderFloat("Position Y", &posY, -100.0f, WINDOW_HEIGHT);
-      ImGui::SliderFloat("Velocity X", &velX, -100.0f, 100.0f);
-      ImGui::SliderFloat("Velocity Y", &velY, -100.0f, 100.0f);
-      ImGui::SliderFloat("Temperature", &temperature, 1.0f, 30.0f);
-      ImGui::SliderFloat("Radius", &radius, 1.0f, 30.0f);
+    // Broad phase used by the collision pass
+    int backendIndex = static_cast<int>(settings.collisionBackend);
+    const char *backendNames[] = {
+        collisionBackendName(CollisionBackend::BruteForce),
+        collisionBackendName(CollisionBackend::UniformGrid)};
+    if (ImGui::Combo("Collision Backend", &backendIndex, backendNames, 2)) {
+      settings.collisionBackend = static_cast<CollisionBackend>(backendIndex);
+      settingsChanged = true;
+    }
+
+    // Worker threads used by every simulation phase
+    if (ImGui::SliderInt("Worker Threads", &threadCount, 1,
+                         ThreadPool::hardwareThreads())) {
+      int count = threadCount;
+      simulation.post([count](Simulation &sim) { sim.setThreadCount(count); });
+    }
+    settingsChanged |= ImGui::Checkbox("Deterministic", &settings.deterministic);
 
-      // Button to add the particle
-      if (ImGui::Button("Add Particle")) {
-        Particle newParticle(posX, posY, velX, velY,
-                             temperature, radius);     // Creating a new Particle instance
-        particles.push_back(newParticle); // Add the new particle to the vector
+    // Time integration of the time-stepped engine, optionally split into
+    // substeps sized by the fastest particle
+    if (settings.engine == SimulationEngine::TimeStepped &&
+        ImGui::CollapsingHeader("Integrator")) {
+      int integratorIndex = static_cast<int>(settings.integrator);
+      const char *integratorNames[] = {
+          integratorKindName(IntegratorKind::Euler),
+          integratorKindName(IntegratorKind::VelocityVerlet),
+          integratorKindName(IntegratorKind::Leapfrog)};
+      if (ImGui::Combo("Scheme", &integratorIndex, integratorNames, 3)) {
+        settings.integrator = static_cast<IntegratorKind>(integratorIndex);
+        settingsChanged = true;
       }
+      settingsChanged |= ImGui::Checkbox("Adaptive Substeps", &settings.adaptiveSubsteps);
+      if (settings.adaptiveSubsteps) {
+        settingsChanged |= ImGui::SliderFloat("Max Displacement", &settings.maxDisplacement,
+                                              0.05f, 1.0f, "%.2f radii");
+        settingsChanged |= ImGui::SliderInt("Max Substeps", &settings.maxSubsteps, 1, 64);
+      }
+    }
 
-      ImGui::End();
+    // Worker processes, each owning a vertical strip of the barrier
+    if (settings.engine == SimulationEngine::Distributed &&
+        ImGui::CollapsingHeader("Distributed")) {
+      DistributedOptions &options = settings.distributed;
+      settingsChanged |= ImGui::SliderInt("Worker Processes", &options.workers, 1, 16);
+      int transportIndex = static_cast<int>(options.transport);
+      const char *transportNames[] = {
+          transportKindName(TransportKind::SharedMemory),
+          transportKindName(TransportKind::UnixSocket)};
+      if (ImGui::Combo("Transport", &transportIndex, transportNames, 2)) {
+        options.transport = static_cast<TransportKind>(transportIndex);
+        settingsChanged = true;
+      }
+    }
+    if (settingsChanged) {
+      SimulationSettings updated = settings;
+      simulation.post([updated](Simulation &sim) { sim.settings = updated; });
+    }
 
-      float averageVelocity = 0.0f;
-      if (!particles.empty()) {
-        float totalVelocity = 0.0f;
-        for (const Particle &particle : particles) {
-          totalVelocity +=
-              sqrt(particle.vx * particle.vx + particle.vy * particle.vy);
-        }
-        averageVelocity = totalVelocity / particles.size();
+    // Fluid parameters, only used by the SPH engine
+    if (settings.engine == SimulationEngine::Sph &&
+        ImGui::CollapsingHeader("SPH Fluid")) {
+      bool sphChanged = false;
+      int kernelIndex = static_cast<int>(sphSettings.kernel);
+      const char *kernelNames[] = {sphKernelName(SphKernel::Poly6Spiky),
+                                   sphKernelName(SphKernel::CubicSpline),
+                                   sphKernelName(SphKernel::WendlandC2)};
+      if (ImGui::Combo("Kernel", &kernelIndex, kernelNames, 3)) {
+        sphSettings.kernel = static_cast<SphKernel>(kernelIndex);
+        sphChanged = true;
       }
+      sphChanged |= ImGui::SliderFloat("Smoothing Length", &sphSettings.smoothingLength, 4.0f, 40.0f);
+      sphChanged |= ImGui::SliderFloat("Rest Spacing", &sphSettings.restSpacing, 2.0f, 20.0f);
+      sphChanged |= ImGui::SliderFloat("Stiffness", &sphSettings.stiffness, 1.0e4f, 4.0e6f);
+      sphChanged |= ImGui::SliderFloat("Viscosity", &sphSettings.viscosity, 0.0f, 400.0f);
+      sphChanged |= ImGui::SliderFloat("Gravity", &sphSettings.gravityY, -1000.0f, 1000.0f);
+      sphChanged |= ImGui::SliderFloat("Wall Restitution", &sphSettings.wallRestitution, 0.0f, 1.0f);
+      sphChanged |= ImGui::SliderInt("Substeps", &sphSettings.substeps, 1, 8);
+      if (sphChanged) {
+        SphSettings updated = sphSettings;
+        simulation.post([updated](Simulation &sim) { sim.sphSolver().settings = updated; });
+      }
+    }
+
+    // Fixed physics timestep, independent of the frame rate
+    if (ImGui::SliderFloat("Physics Rate (Hz)", &stepRate, 30.0f, 480.0f)) {
+      simulation.setStepRate(stepRate);
+    }
+    if (ImGui::Checkbox("Pause Physics", &paused)) {
+      simulation.setPaused(paused || playback.isOpen());
+    }
 
-      ImGui::Begin("Particle Information");
+    // How particles are drawn
+    int renderIndex = static_cast<int>(renderBackend);
+    const char *renderNames[] = {renderBackendName(RenderBackend::Gfx),
+                                 renderBackendName(RenderBackend::Batched)};
+    if (ImGui::Combo("Render Backend", &renderIndex, renderNames, 2)) {
+      renderBackend = static_cast<RenderBackend>(renderIndex);
+    }
 
-      ImGui::Text("Average Particle Velocity: %.2f", averageVelocity);
+    // Labeled input fields for new particle properties
+    ImGui::Text("New Particle Properties");
+    ImGui::SliderFloat("Position X", &posX, 0.0f, WINDOW_WIDTH);
+    ImGui::SliderFloat("Position Y", &posY, -100.0f, WINDOW_HEIGHT);
+    ImGui::SliderFloat("Velocity X", &velX, -100.0f, 100.0f);
+    ImGui::SliderFloat("Velocity Y", &velY, -100.0f, 100.0f);
+    ImGui::SliderFloat("Temperature", &temperature, 1.0f, 30.0f);
+    ImGui::SliderFloat("Radius", &radius, 1.0f, 30.0f);
 
-      // Assuming you have an ImGui plot function available
-      static std::vector<float> velocities;
-      velocities.push_back(averageVelocity); // Store the average velocity
-      if (velocities.size() > 50) { // Limit the number of displayed points
-        velocities.erase(velocities.begin());
+    // Button to add the particle
+    if (ImGui::Button("Add Particle")) {
+      Particle newParticle(posX, posY, velX, velY,
+                           temperature, radius);     // Creating a new Particle instance
+      simulation.post([newParticle, &addedMutex, &addedParticles](Simulation &sim) {
+        ParticleHandle handle = sim.particles().add(newParticle); // Add the new particle to the system
+        sim.particlesEdited();
+        std::lock_guard<std::mutex> lock(addedMutex);
+        addedParticles.push_back(handle);
+      });
+    }
+    ImGui::SameLine();
+    // Handles stay valid while other particles come and go; ones whose
+    // particle was already absorbed are skipped
+    if (ImGui::Button("Remove Last Added")) {
+      simulation.post([&addedMutex, &addedParticles](Simulation &sim) {
+        std::lock_guard<std::mutex> lock(addedMutex);
+        while (!addedParticles.empty()) {
+          ParticleHandle handle = addedParticles.back();
+          addedParticles.pop_back();
+          if (sim.particles().remove(handle)) {
+            sim.particlesEdited();
+            break;
+          }
+        }
+      });
+    }
+
+    // Temperature control; only runs with the time-stepped engines, not the
+    // event-driven or SPH ones. The distributed engine applies it across all
+    // of its workers as part of each step.
+    if (ImGui::CollapsingHeader("Thermostat")) {
+      bool thermostatChanged = false;
+      int modeIndex = static_cast<int>(thermostatSettings.mode);
+      const char *modeNames[] = {
+          thermostatModeName(ThermostatMode::PerParticle),
+          thermostatModeName(ThermostatMode::Berendsen),
+          thermostatModeName(ThermostatMode::VelocityRescale),
+          thermostatModeName(ThermostatMode::Andersen),
+          thermostatModeName(ThermostatMode::Off)};
+      if (ImGui::Combo("Mode", &modeIndex, modeNames, 5)) {
+        thermostatSettings.mode = static_cast<ThermostatMode>(modeIndex);
+        thermostatChanged = true;
+      }
+      thermostatChanged |= ImGui::SliderFloat("Target Temperature", &thermostatSettings.temperature, 0.0f, 100.0f);
+      thermostatChanged |= ImGui::SliderFloat("Time Constant (s)", &thermostatSettings.timeConstant, 0.01f, 5.0f);
+      thermostatChanged |= ImGui::SliderFloat("Collision Rate (1/s)", &thermostatSettings.collisionRate, 0.0f, 20.0f);
+      ImGui::SliderFloat("Region X##thermostat", &regionX, 0.0f, WINDOW_WIDTH);
+      ImGui::SliderFloat("Region Y##thermostat", &regionY, 0.0f, WINDOW_HEIGHT);
+      ImGui::SliderFloat("Region Size##thermostat", &regionSize, 4.0f, 400.0f);
+      if (ImGui::Button("Add Region")) {
+        ThermostatRegion region;
+        region.region = {regionX - regionSize / 2, regionX + regionSize / 2,
+                         regionY - regionSize / 2, regionY + regionSize / 2};
+        region.temperature = thermostatSettings.temperature;
+        thermostatSettings.regions.push_back(region);
+        thermostatChanged = true;
+      }
+      for (size_t i = 0; i < thermostatSettings.regions.size(); ++i) {
+        ImGui::PushID(static_cast<int>(2000 + i));
+        thermostatChanged |= ImGui::SliderFloat("Region Temperature",
+                                                &thermostatSettings.regions[i].temperature,
+                                                0.0f, 100.0f);
+        ImGui::SameLine();
+        if (ImGui::Button("Remove")) {
+          thermostatSettings.regions.erase(thermostatSettings.regions.begin() + i);
+          thermostatChanged = true;
+        }
+        ImGui::PopID();
       }
-      ImGui::PlotLines("Velocity", velocities.data(), velocities.size());
+      if (thermostatChanged) {
+        ThermostatSettings updated = thermostatSettings;
+        simulation.post([updated](Simulation &sim) { sim.thermostat().settings = updated; });
+      }
+      for (size_t g = 0; g < snapshot.temperatures.size(); ++g) {
+        if (g == 0) {
+          ImGui::Text("Measured outside regions: %.2f", snapshot.temperatures[g]);
+        } else {
+          ImGui::Text("Measured in region %d: %.2f", static_cast<int>(g - 1),
+                      snapshot.temperatures[g]);
+        }
+      }
+    }
 
-      ImGui::End();
+    // Regions that spawn or absorb particles every step. The lists are
+    // edited here and each change is posted on its own, so the physics side
+    // keeps the state its emitters carry between steps.
+    if (ImGui::CollapsingHeader("Emitters and Sinks")) {
+      // The distributed workers never run them
+      const bool sourcesIdle = settings.engine == SimulationEngine::Distributed;
+      if (sourcesIdle) {
+        ImGui::TextWrapped("Emitters and sinks are paused with the %s engine.",
+                           simulationEngineName(SimulationEngine::Distributed));
+      }
+      ImGui::BeginDisabled(sourcesIdle);
+      ImGui::SliderFloat("Region X", &regionX, 0.0f, WINDOW_WIDTH);
+      ImGui::SliderFloat("Region Y", &regionY, 0.0f, WINDOW_HEIGHT);
+      ImGui::SliderFloat("Region Size", &regionSize, 4.0f, 200.0f);
+      BarrierBounds region = {regionX - regionSize / 2, regionX + regionSize / 2,
+                              regionY - regionSize / 2, regionY + regionSize / 2};
+      if (ImGui::Button("Add Emitter")) {
+        Emitter emitter;
+        emitter.region = region;
+        emitter.velocityX = velX;
+        emitter.velocityY = velY;
+        emitter.temperature = temperature;
+        emitterList.push_back(emitter);
+        simulation.post([emitter](Simulation &sim) { sim.emitters.push_back(emitter); });
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Add Sink")) {
+        Sink sink;
+        sink.region = region;
+        sinkList.push_back(sink);
+        simulation.post([sink](Simulation &sim) { sim.sinks.push_back(sink); });
+      }
+      // Removals wait until the lists have been drawn
+      int removedEmitter = -1, removedSink = -1;
+      for (size_t i = 0; i < emitterList.size(); ++i) {
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::Text("Emitter %d", static_cast<int>(i));
+        bool edited = ImGui::Checkbox("On", &emitterList[i].enabled);
+        ImGui::SameLine();
+        edited |= ImGui::SliderFloat("Rate", &emitterList[i].rate, 0.0f, 20000.0f);
+        ImGui::SameLine();
+        if (ImGui::Button("Remove")) {
+          removedEmitter = static_cast<int>(i);
+        }
+        if (edited) {
+          bool enabled = emitterList[i].enabled;
+          float rate = emitterList[i].rate;
+          simulation.post([i, enabled, rate](Simulation &sim) {
+            if (i < sim.emitters.size()) {
+              sim.emitters[i].enabled = enabled;
+              sim.emitters[i].rate = rate;
+            }
+          });
+        }
+        ImGui::PopID();
+      }
+      for (size_t i = 0; i < sinkList.size(); ++i) {
+        ImGui::PushID(static_cast<int>(1000 + i));
+        ImGui::Text("Sink %d", static_cast<int>(i));
+        ImGui::SameLine();
+        if (ImGui::Checkbox("On", &sinkList[i].enabled)) {
+          bool enabled = sinkList[i].enabled;
+          simulation.post([i, enabled](Simulation &sim) {
+            if (i < sim.sinks.size()) {
+              sim.sinks[i].enabled = enabled;
+            }
+          });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Remove")) {
+          removedSink = static_cast<int>(i);
+        }
+        ImGui::PopID();
+      }
+      if (removedEmitter >= 0) {
+        emitterList.erase(emitterList.begin() + removedEmitter);
+        simulation.post([removedEmitter](Simulation &sim) {
+          if (removedEmitter < static_cast<int>(sim.emitters.size())) {
+            sim.emitters.erase(sim.emitters.begin() + removedEmitter);
+          }
+        });
+      }
+      if (removedSink >= 0) {
+        sinkList.erase(sinkList.begin() + removedSink);
+        simulation.post([removedSink](Simulation &sim) {
+          if (removedSink < static_cast<int>(sim.sinks.size())) {
+            sim.sinks.erase(sim.sinks.begin() + removedSink);
+          }
+        });
+      }
+      ImGui::EndDisabled();
+      ImGui::Text("Emitted %llu, absorbed %llu",
+                  static_cast<unsigned long long>(snapshot.sources.emitted),
+                  static_cast<unsigned long long>(snapshot.sources.absorbed));
+    }
 
-      SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-      SDL_RenderClear(renderer);
+    // Spawn a batch of particles inside the barrier
+    ImGui::Text("Spawn Particles");
+    ImGui::InputInt("Count", &spawnCount, 1000, 100000);
+    spawnCount = std::max(spawnCount, 1);
+    int spawnIndex = static_cast<int>(spawnMode);
+    const char *spawnNames[] = {seedingModeName(SeedingMode::PoissonDisk),
+                                seedingModeName(SeedingMode::JitteredLattice)};
+    if (ImGui::Combo("Placement", &spawnIndex, spawnNames, 2)) {
+      spawnMode = static_cast<SeedingMode>(spawnIndex);
+    }
+    if (ImGui::Button("Spawn")) {
+      SeedingOptions options;
+      options.mode = spawnMode;
+      options.count = spawnCount;
+      options.region = barrierBounds(WINDOW_WIDTH, WINDOW_HEIGHT, BARRIER_RADIUS);
+      options.seed = spawnSeed++;
+      simulation.post([options, &lastSpawnRequested,
+                       &lastSpawnPlaced](Simulation &sim) {
+        SeedingResult result =
+            seedParticles(sim.particles(), options, &sim.workers());
+        sim.particlesEdited();
+        lastSpawnRequested.store(result.requested);
+        lastSpawnPlaced.store(result.placed);
+      });
+    }
+    if (lastSpawnRequested.load() > 0) {
+      ImGui::Text("Last spawn: placed %d of %d", lastSpawnPlaced.load(),
+                  lastSpawnRequested.load());
+    }
 
-      // Draw barrier rectangle
-      SDL_Color barrierColor = {0, 0, 0, 255};
-      SDL_SetRenderDrawColor(renderer, barrierColor.r, barrierColor.g,
-                             barrierColor.b, barrierColor.a);
+    // Full-state checkpoint / restart
+    ImGui::Text("Checkpoint");
+    ImGui::InputText("Checkpoint File", checkpointPath, sizeof(checkpointPath));
+    if (ImGui::Button("Save Checkpoint")) {
+      std::string path = checkpointPath;
+      simulation.post([path, &checkpointStatusMutex,
+                       &checkpointStatus](Simulation &sim) {
+        std::string error;
+        bool saved = saveCheckpoint(path, sim, error);
+        std::lock_guard<std::mutex> lock(checkpointStatusMutex);
+        checkpointStatus = saved ? "Saved step " + std::to_string(sim.stepCount())
+                                 : error;
+      });
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Load Checkpoint")) {
+      std::string path = checkpointPath;
+      simulation.post([path, &checkpointStatusMutex,
+                       &checkpointStatus](Simulation &sim) {
+        std::string error;
+        bool loaded = loadCheckpoint(path, sim, error);
+        std::lock_guard<std::mutex> lock(checkpointStatusMutex);
+        checkpointStatus =
+            loaded ? "Loaded step " + std::to_string(sim.stepCount()) : error;
+      });
+    }
+    {
+      std::lock_guard<std::mutex> lock(checkpointStatusMutex);
+      if (!checkpointStatus.empty()) {
+        ImGui::TextWrapped("%s", checkpointStatus.c_str());
+      }
+    }
 
-      SDL_Rect barrierRect;
-      barrierRect.x = WINDOW_WIDTH / 2 - BARRIER_RADIUS / 2;
-      barrierRect.y = WINDOW_HEIGHT / 2 - BARRIER_RADIUS / 2;
-      barrierRect.w = BARRIER_RADIUS; // Width of the rectangle
-      barrierRect.h = BARRIER_RADIUS; // Height of the rectangle
+    // Streaming trajectory recording
+    ImGui::Text("Recording");
+    ImGui::InputText("Trajectory File", recordingPath, sizeof(recordingPath));
+    int compressionIndex = static_cast<int>(recordingOptions.compression);
+    const char *compressionNames[] = {
+        trajectoryCompressionName(TrajectoryCompression::Raw),
+        trajectoryCompressionName(TrajectoryCompression::Quantized),
+        trajectoryCompressionName(TrajectoryCompression::DeltaQuantized)};
+    if (ImGui::Combo("Compression", &compressionIndex, compressionNames, 3)) {
+      recordingOptions.compression =
+          static_cast<TrajectoryCompression>(compressionIndex);
+    }
+    ImGui::SliderInt("Record Every N Steps", &recordEverySteps, 1, 60);
+    if (!simulation.recording()) {
+      if (ImGui::Button("Start Recording")) {
+        std::string error;
+        recordingStatus =
+            simulation.startRecording(recordingPath, liveSnapshot.bounds,
+                                      recordingOptions, recordEverySteps, error)
+                ? std::string()
+                : error;
+      }
+    } else if (ImGui::Button("Stop Recording")) {
+      simulation.stopRecording();
+    }
+    TrajectoryStats recordingStats = simulation.recordingStats();
+    ImGui::Text("%s: %llu frames, %llu dropped, %.1f MB",
+                simulation.recording() ? "Recording" : "Recorded",
+                static_cast<unsigned long long>(recordingStats.framesWritten),
+                static_cast<unsigned long long>(recordingStats.framesDropped),
+                recordingStats.bytesWritten / (1024.0 * 1024.0));
+    if (!recordingStatus.empty()) {
+      ImGui::TextWrapped("%s", recordingStatus.c_str());
+    }
 
-      SDL_RenderDrawRect(renderer, &barrierRect);
+    // Offscreen frame capture to image sequences or an encoder process
+    ImGui::Text("Frame Capture");
+    ImGui::InputText("Capture Path or Command", capturePath, sizeof(capturePath));
+    int captureFormatIndex = static_cast<int>(captureOptions.format);
+    const char *captureFormatNames[] = {captureFormatName(CaptureFormat::Raw),
+                                        captureFormatName(CaptureFormat::Ppm),
+                                        captureFormatName(CaptureFormat::Png),
+                                        captureFormatName(CaptureFormat::Pipe)};
+    if (ImGui::Combo("Capture Format", &captureFormatIndex, captureFormatNames, 4)) {
+      captureOptions.format = static_cast<CaptureFormat>(captureFormatIndex);
+    }
+    ImGui::SliderFloat("Capture FPS", &captureOptions.framesPerSecond, 1.0f, 120.0f);
+    ImGui::SliderInt("Capture Buffers", &captureOptions.queueDepth, 1, 16);
+    if (!capture->active()) {
+      if (ImGui::Button("Start Capture")) {
+        captureOptions.target = capturePath;
+        std::string error;
+        captureStatus = capture->start(captureOptions, error) ? std::string() : error;
+      }
+    } else if (ImGui::Button("Stop Capture")) {
+      capture->stop();
+    }
+    CaptureStats captureStats = capture->stats();
+    ImGui::Text("%s: %llu frames, %llu dropped, %llu skipped, %d queued, %.1f MB",
+                capture->active() ? "Capturing" : "Captured",
+                static_cast<unsigned long long>(captureStats.framesWritten),
+                static_cast<unsigned long long>(captureStats.framesDropped),
+                static_cast<unsigned long long>(capture->skipped()),
+                captureStats.framesQueued,
+                captureStats.bytesWritten / (1024.0 * 1024.0));
+    ImGui::Text("Render + readback %.2f ms, encode %.2f ms", capture->captureMs(),
+                captureStats.encodeMs);
+    if (captureStats.failed) {
+      ImGui::Text("Writing frames failed; later frames are dropped");
+    }
+    if (!captureStatus.empty()) {
+      ImGui::TextWrapped("%s", captureStatus.c_str());
+    }
 
-      // Update and draw moving particles
-      float maxVelocity =
-          100.0f; // Adjust this based on your particles' velocity range
-      for (size_t i = 0; i < particles.size(); ++i) {
-        UpdateParticle(particles[i], deltaTime, WINDOW_WIDTH, WINDOW_HEIGHT,
-                       BARRIER_RADIUS);
-        for (size_t j = i + 1; j < particles.size(); ++j) {
-          CheckCollision(particles[i], particles[j]);
+    ImGui::End();
+
+    // Scrub a recorded trajectory without re-simulating it
+    ImGui::Begin("Playback");
+    if (!playback.isOpen()) {
+      ImGui::InputText("File", playbackPath, sizeof(playbackPath));
+      if (ImGui::Button("Open")) {
+        std::string error;
+        if (playback.open(playbackPath, error) &&
+            playback.decode(0, playbackSnapshot)) {
+          playbackFrame = 0;
+          playbackTime = playback.frameTime(0);
+          playbackStatus.clear();
+          simulation.setPaused(true); // the live run waits while we watch
+        } else {
+          playback.close();
+          playbackStatus = error.empty() ? "Could not decode frame 0" : error;
         }
-        calculateParticleVelocity(particles[i]);
-        SDL_Color particleColor =
-            velocityToColor(particles[i].speed, maxVelocity);
-        DrawParticle(renderer, particles[i], particleColor);
       }
+      if (!playbackStatus.empty()) {
+        ImGui::TextWrapped("%s", playbackStatus.c_str());
+      }
+    } else {
+      ImGui::Text("%d frames, %s", static_cast<int>(playback.frameCount()),
+                  trajectoryCompressionName(playback.compression()));
+      if (ImGui::SliderInt("Frame", &playbackFrame, 0,
+                           static_cast<int>(playback.frameCount()) - 1)) {
+        playback.decode(playbackFrame, playbackSnapshot);
+        playbackTime = playback.frameTime(playbackFrame);
+      }
+      ImGui::Checkbox("Play", &playbackPlaying);
+      ImGui::SameLine();
+      if (ImGui::Button("Close")) {
+        playback.close();
+        playbackPlaying = false;
+        simulation.setPaused(paused);
+      }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Particle Information");
 
+    ImGui::Text("Average Particle Velocity: %.2f", snapshot.averageSpeed);
+    ImGui::Text("Particles: %d", static_cast<int>(snapshot.size()));
+    ImGui::Text("Particle Kernels: %s", particleKernelIsa());
+    ImGui::Text("Threads: %d%s", snapshot.threadCount,
+                settings.deterministic ? " (deterministic)" : "");
+    ImGui::Text("Step %llu, t = %.2f s, %.0f steps/s",
+                static_cast<unsigned long long>(snapshot.stepCount),
+                snapshot.simulationTime, snapshot.stepsPerSecond);
+    const PhaseTimings &timings = snapshot.timings;
+    ImGui::Text("Integrate: %.3f ms  Barrier: %.3f ms", timings.integrate,
+                timings.barrier);
+    if (settings.engine == SimulationEngine::EventDriven) {
+      const EventStats &events = snapshot.events;
+      ImGui::Text("Events: %.3f ms", timings.collide);
+      ImGui::Text("Collisions %llu, walls %llu, cell crossings %llu",
+                  static_cast<unsigned long long>(events.pairCollisions),
+                  static_cast<unsigned long long>(events.wallCollisions),
+                  static_cast<unsigned long long>(events.cellCrossings));
+      ImGui::Text("Stale events %llu, queue %llu",
+                  static_cast<unsigned long long>(events.staleEvents),
+                  static_cast<unsigned long long>(events.queueSize));
+    } else if (settings.engine == SimulationEngine::Distributed) {
+      const DistributedStats &distributed = snapshot.distributed;
+      ImGui::Text("Collide: %.3f ms  Exchange: %.3f ms (slowest worker)",
+                  timings.collide, distributed.exchangeMs);
+      ImGui::Text("Workers %d, ghosts %llu, migrated %llu", distributed.workers,
+                  static_cast<unsigned long long>(distributed.ghosts),
+                  static_cast<unsigned long long>(distributed.migrated));
+      for (size_t k = 0; k < distributed.owned.size(); ++k) {
+        ImGui::Text("  Worker %d: %u particles", static_cast<int>(k),
+                    static_cast<unsigned>(distributed.owned[k]));
+      }
+      if (!snapshot.distributedError.empty()) {
+        ImGui::Text("Stopped: %s", snapshot.distributedError.c_str());
+      }
+    } else if (settings.engine == SimulationEngine::Sph) {
+      ImGui::Text("SPH: %.3f ms", timings.integrate);
+      ImGui::Text("Neighbours per particle: %.1f",
+                  snapshot.size() ? static_cast<double>(snapshot.collisions.candidatePairs) /
+                                        snapshot.size()
+                                  : 0.0);
+    } else {
+      ImGui::Text("Collision Pass (%s): %.3f ms",
+                  collisionBackendName(settings.collisionBackend),
+                  timings.collide);
+      ImGui::Text("%s, %d substep%s", integratorKindName(settings.integrator),
+                  snapshot.substeps, snapshot.substeps == 1 ? "" : "s");
+      if (!snapshot.distributedError.empty()) {
+        ImGui::TextWrapped("Distributed engine stopped: %s",
+                           snapshot.distributedError.c_str());
+      }
+    }
+    ImGui::Text("Draw (%s): %.3f ms", renderBackendName(renderBackend),
+                particleRenderer->lastDrawMs());
+
+    velocities.push(snapshot.averageSpeed); // Store the average velocity
+    ImGui::PlotLines("Velocity", velocities.data(),
+                     static_cast<int>(velocities.size()),
+                     static_cast<int>(velocities.offset()));
+
+    // Speed distribution against the Maxwell-Boltzmann curve with the same
+    // mean squared speed
+    const SpeedHistogram &histogram = snapshot.speedHistogram;
+    if (!histogram.counts.empty()) {
+      int bins = static_cast<int>(histogram.counts.size());
+      expectedSpeeds.resize(bins);
+      float peak = 0.0f;
+      for (int b = 0; b < bins; ++b) {
+        expectedSpeeds[b] = histogram.expected(b);
+        peak = std::max(peak, std::max(expectedSpeeds[b], histogram.counts[b]));
+      }
+      ImGui::PlotHistogram("Speeds", histogram.counts.data(), bins, 0, nullptr,
+                           0.0f, peak, ImVec2(0, 60));
+      ImGui::PlotLines("Maxwell-Boltzmann", expectedSpeeds.data(), bins, 0,
+                       nullptr, 0.0f, peak, ImVec2(0, 60));
+      ImGui::Text("Kinetic temperature: %.2f",
+                  std::sqrt(histogram.meanSquaredSpeed) / SPEED_PER_DEGREE);
+    }
+
+    ImGui::End();
+
+    // Where the time goes, per thread and phase
+    ImGui::Begin("Profiler");
+#if FLUID_SIM_PROFILER
+    if (currentFrame - lastProfileRefresh >= 250) {
+      lastProfileRefresh = currentFrame;
+      uint64_t now = profileNow();
+      collectProfileEvents(profileEvents,
+                           now > PROFILE_WINDOW_NS ? now - PROFILE_WINDOW_NS : 0);
+      summarizeProfile(profileEvents, profileSummaries);
+    }
+    if (ImGui::BeginTable("Scopes", 4,
+                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("Scope (last second)");
+      ImGui::TableSetupColumn("Calls");
+      ImGui::TableSetupColumn("Avg ms");
+      ImGui::TableSetupColumn("Max ms");
+      ImGui::TableHeadersRow();
+      for (const ProfileSummary &summary : profileSummaries) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s", summary.name);
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", summary.calls);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", summary.totalMs / summary.calls);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", summary.maxMs);
+      }
+      ImGui::EndTable();
+    }
+
+    pairHistory.push(static_cast<float>(snapshot.collisions.candidatePairs));
+    contactHistory.push(static_cast<float>(snapshot.collisions.contacts));
+    ImGui::Text("Candidate pairs / step: %llu",
+                static_cast<unsigned long long>(snapshot.collisions.candidatePairs));
+    ImGui::PlotLines("Pairs", pairHistory.data(),
+                     static_cast<int>(pairHistory.size()),
+                     static_cast<int>(pairHistory.offset()));
+    ImGui::Text("Contacts / step: %llu",
+                static_cast<unsigned long long>(snapshot.collisions.contacts));
+    ImGui::PlotLines("Contacts", contactHistory.data(),
+                     static_cast<int>(contactHistory.size()),
+                     static_cast<int>(contactHistory.offset()));
+    ImGui::Text("Frame time: %.2f ms", frameTimes.back());
+    ImGui::PlotLines("Frame ms", frameTimes.data(),
+                     static_cast<int>(frameTimes.size()),
+                     static_cast<int>(frameTimes.offset()));
+
+    ImGui::InputText("Trace File", tracePath, sizeof(tracePath));
+    if (ImGui::Button("Export Chrome Trace")) {
+      std::string error;
+      traceStatus = exportChromeTrace(tracePath, error)
+                        ? std::string("Wrote ") + tracePath
+                        : error;
+    }
+    if (!traceStatus.empty()) {
+      ImGui::TextWrapped("%s", traceStatus.c_str());
+    }
+#else
+    ImGui::TextDisabled("Built with FLUID_SIM_PROFILER=OFF");
+    ImGui::Text("Frame time: %.2f ms", frameTimes.back());
+    ImGui::PlotLines("Frame ms", frameTimes.data(),
+                     static_cast<int>(frameTimes.size()),
+                     static_cast<int>(frameTimes.offset()));
+#endif
+    ImGui::End();
+    PROFILE_ONLY(recordProfileScope("ImGui build", buildStart, profileNow());)
+
+    // Offscreen capture first, so the frame on screen is drawn last
+    if (capture->due(snapshot.simulationTime)) {
+      capture->capture([&] { drawScene(snapshot); });
+    }
+
+    drawScene(snapshot);
+    {
+      PROFILE_SCOPE("ImGui render");
       ImGui::Render();
       ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData());
+    }
+    {
+      PROFILE_SCOPE("Present");
       SDL_RenderPresent(renderer);
-
-      frameTime = 0; // Reset frame time
     }
   }
 
+  simulation.stop();
+  if (offscreen) {
+    capture->stop();
+    CaptureStats captureStats = capture->stats();
+    std::cout << "Captured " << captureStats.framesWritten << " frames ("
+              << captureStats.framesDropped << " dropped, " << capture->skipped()
+              << " skipped)" << std::endl;
+  }
+  capture.reset();
+  particleRenderer.reset();
+
   // Cleanup
   ImGui_ImplSDLRenderer2_Shutdown();
   ImGui_ImplSDL2_Shutdown();
@@ -0,0 +1,78 @@
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string &path, std::string &error) {
+  close();
+
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = "Could not open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    error = "Could not stat " + path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  length = static_cast<size_t>(info.st_size);
+  if (length == 0) {
+    ::close(fd);
+    error = path + " is empty";
+    return false;
+  }
+  void *memory = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) {
+    error = "Could not map " + path + ": " + std::strerror(errno);
+    length = 0;
+    return false;
+  }
+  bytes = static_cast<const uint8_t *>(memory);
+  mapped = true;
+  return true;
+#else
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    error = "Could not open " + path;
+    return false;
+  }
+  std::fseek(file, 0, SEEK_END);
+  long fileSize = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  fallback.resize(fileSize > 0 ? static_cast<size_t>(fileSize) : 0);
+  size_t read = fallback.empty() ? 0 : std::fread(fallback.data(), 1, fallback.size(), file);
+  std::fclose(file);
+  if (fallback.empty() || read != fallback.size()) {
+    error = "Could not read " + path;
+    fallback.clear();
+    return false;
+  }
+  bytes = fallback.data();
+  length = fallback.size();
+  return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+  if (mapped && bytes) {
+    munmap(const_cast<uint8_t *>(bytes), length);
+  }
+#endif
+  bytes = nullptr;
+  length = 0;
+  mapped = false;
+  fallback.clear();
+}
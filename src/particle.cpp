@@ -1,43 +1,26 @@
-#include <SDL2_gfxPrimitives.h>
 #include <algorithm>
 #include <iostream>
+#include <math.h>
 
 #include "constants.h"
 #include "particle.h"
+#include "particle_system.h"
+#include "seeding.h"
+#include "thermostat.h"
 
 void calculateParticleVelocity(Particle &particle) {
-  float speed = particle.speed;
-  float vx = particle.vx;
-  float vy = particle.vy;
-
-  // Calculate the velocity vector's angle
-  float angle = atan2(vy, vx);
-
-  // Calculate the velocity vector's magnitude
-  float magnitude = sqrt(vx * vx + vy * vy);
-
-  // Calculate the velocity vector's magnitude based on the particle's
-  // temperature
-  float maxVelocity = 200.0f;
-  float minVelocity = 0.0f;
-  float maxTemperature = 100.0f;
-  float minTemperature = 0.0f;
-  float temperature = particle.temperature;
-  float velocity = (temperature - minTemperature) / (maxTemperature - minTemperature) *
-                   (maxVelocity - minVelocity) +
-                   minVelocity;
-
-  // Update the velocity vector
-  vx = cos(angle) * velocity;
-  vy = sin(angle) * velocity;
-
-  particle.vx = vx;
-  particle.vy = vy;
-}
-
-void DrawParticle(SDL_Renderer *renderer, Particle& particle, SDL_Color color) {
-  aacircleRGBA(renderer, particle.x, particle.y, particle.radius, color.r, color.g, color.b,
-               color.a);
+  // Scale the velocity to the speed implied by the particle's temperature,
+  // keeping its direction. A particle at rest starts moving along +x.
+  float velocity = particle.temperature * SPEED_PER_DEGREE;
+  float magnitude = sqrt(particle.vx * particle.vx + particle.vy * particle.vy);
+  if (magnitude > 0.0f) {
+    float scale = velocity / magnitude;
+    particle.vx *= scale;
+    particle.vy *= scale;
+  } else {
+    particle.vx = velocity;
+    particle.vy = 0.0f;
+  }
 }
 
 void UpdateParticle(Particle &particle, float deltaTime, int window_width,
@@ -106,48 +89,37 @@ std::vector<Particle> generate_random_particles(int count, int window_width,
                                             int window_height,
                                             int barrier_radius,
                                             int particle_radius) {
-  std::vector<Particle> particles;
   std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<> dis(0.0, 1.0);
+  return generate_random_particles(count, window_width, window_height,
+                                   barrier_radius, particle_radius, rd());
+}
 
+std::vector<Particle> generate_random_particles(int count, int window_width,
+                                            int window_height,
+                                            int barrier_radius,
+                                            int particle_radius,
+                                            unsigned int seed) {
   int innerWidth = barrier_radius * 0.9f;
   int innerHeight = barrier_radius * 0.9f;
-  int leftEdge = (window_width - innerWidth) / 2 + particle_radius;
-  int topEdge = (window_height - innerHeight) / 2 + particle_radius;
-
-  const int maxAttempts =
-      100; // Maximum attempts to find a non-overlapping position
-
-  for (int i = 0; i < count; ++i) {
-    bool validPosition = false;
-    float x, y;
-    int attempts = 0;
-
-    while (!validPosition && attempts < maxAttempts) {
-      x = leftEdge + dis(gen) * (innerWidth - 2 * particle_radius);
-      y = topEdge + dis(gen) * (innerHeight - 2 * particle_radius);
-      validPosition = true;
-
-      // Check for overlap with existing particles
-      for (const auto &existingParticle : particles) {
-        float dx = x - existingParticle.x;
-        float dy = y - existingParticle.y;
-        float distance = sqrt(dx * dx + dy * dy);
-        if (distance < 2 * particle_radius * 1.1) { // 10% more than the diameter
-          validPosition = false;
-          break;
-        }
-      }
-      ++attempts;
-    }
-
-    if (validPosition) {
-      float vx = dis(gen) * 200.0f - 100.0f;
-      float vy = dis(gen) * 200.0f - 100.0f;
-      particles.emplace_back(x, y, vx, vy, dis(gen) * 100.0f);
-    }
+  int leftEdge = (window_width - innerWidth) / 2;
+  int topEdge = (window_height - innerHeight) / 2;
+
+  // Poisson-disk placement keeps centres 10% more than a diameter apart
+  SeedingOptions options;
+  options.count = count;
+  options.region.left = leftEdge;
+  options.region.right = leftEdge + innerWidth;
+  options.region.top = topEdge;
+  options.region.bottom = topEdge + innerHeight;
+  options.particleRadius = particle_radius;
+  options.spacing = 1.1f;
+  options.seed = seed;
+
+  ParticleSystem system;
+  SeedingResult result = seedParticles(system, options);
+  if (result.placed < count) {
+    std::cerr << "Only " << result.placed << " of " << count
+              << " particles fit inside the barrier" << std::endl;
   }
-
-  return particles;
+  return system.toParticles();
 }
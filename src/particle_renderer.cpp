@@ -0,0 +1,143 @@
+#include <SDL2_gfxPrimitives.h>
+#include <algorithm>
+#include <math.h>
+
+#include "particle_renderer.h"
+
+namespace {
+
+// Resolution of the baked disc. Large enough to stay smooth when the linear
+// filter scales it up to the biggest radius the UI allows.
+const int CIRCLE_TEXTURE_SIZE = 64;
+
+} // namespace
+
+void DrawParticle(SDL_Renderer *renderer, Particle& particle, SDL_Color color) {
+  aacircleRGBA(renderer, particle.x, particle.y, particle.radius, color.r, color.g, color.b,
+               color.a);
+}
+
+const char *renderBackendName(RenderBackend backend) {
+  switch (backend) {
+  case RenderBackend::Gfx:
+    return "SDL2_gfx";
+  case RenderBackend::Batched:
+    return "Batched Geometry";
+  }
+  return "Unknown";
+}
+
+ParticleRenderer::ParticleRenderer(SDL_Renderer *renderer, float maxVelocity)
+    : renderer(renderer), ramp(maxVelocity) {
+  bakeCircleTexture();
+}
+
+ParticleRenderer::~ParticleRenderer() {
+  if (circleTexture) {
+    SDL_DestroyTexture(circleTexture);
+  }
+}
+
+// White disc whose alpha is the pixel's coverage, so the vertex colour tints
+// it and the edge is anti-aliased by blending.
+void ParticleRenderer::bakeCircleTexture() {
+  const int size = CIRCLE_TEXTURE_SIZE;
+  std::vector<Uint8> pixels(size * size * 4);
+  const float center = size / 2.0f;
+  const float radius = center - 1.0f;
+
+  for (int py = 0; py < size; ++py) {
+    for (int px = 0; px < size; ++px) {
+      float dx = px + 0.5f - center;
+      float dy = py + 0.5f - center;
+      float distance = sqrtf(dx * dx + dy * dy);
+      float coverage = std::max(0.0f, std::min(1.0f, radius - distance + 0.5f));
+      Uint8 *pixel = &pixels[(py * size + px) * 4];
+      pixel[0] = pixel[1] = pixel[2] = 255;
+      pixel[3] = static_cast<Uint8>(coverage * 255.0f);
+    }
+  }
+
+  circleTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                                    SDL_TEXTUREACCESS_STATIC, size, size);
+  if (!circleTexture) {
+    return;
+  }
+  SDL_UpdateTexture(circleTexture, nullptr, pixels.data(), size * 4);
+  SDL_SetTextureBlendMode(circleTexture, SDL_BLENDMODE_BLEND);
+  SDL_SetTextureScaleMode(circleTexture, SDL_ScaleModeLinear);
+}
+
+void ParticleRenderer::draw(const ParticleSnapshot &snapshot,
+                            RenderBackend backend) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (backend == RenderBackend::Batched && circleTexture) {
+    drawBatched(snapshot);
+  } else {
+    drawGfx(snapshot);
+  }
+  drawMs = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+           SDL_GetPerformanceFrequency();
+}
+
+void ParticleRenderer::drawGfx(const ParticleSnapshot &snapshot) {
+  for (size_t i = 0; i < snapshot.size(); ++i) {
+    Particle particle(snapshot.x[i], snapshot.y[i], 0.0f, 0.0f, 0.0f,
+                      snapshot.radius[i]);
+    DrawParticle(renderer, particle, ramp.lookup(snapshot.speed[i]));
+  }
+}
+
+void ParticleRenderer::drawBatched(const ParticleSnapshot &snapshot) {
+  const size_t count = snapshot.size();
+  if (count == 0) {
+    return;
+  }
+
+  // The index pattern never changes, so it only grows with the particle count
+  size_t builtQuads = indices.size() / 6;
+  if (builtQuads < count) {
+    indices.resize(count * 6);
+    for (size_t q = builtQuads; q < count; ++q) {
+      int base = static_cast<int>(q * 4);
+      int *quad = &indices[q * 6];
+      quad[0] = base;
+      quad[1] = base + 1;
+      quad[2] = base + 2;
+      quad[3] = base;
+      quad[4] = base + 2;
+      quad[5] = base + 3;
+    }
+  }
+
+  vertices.resize(count * 4);
+  for (size_t i = 0; i < count; ++i) {
+    const float x = snapshot.x[i];
+    const float y = snapshot.y[i];
+    const float r = snapshot.radius[i];
+    const SDL_Color color = ramp.lookup(snapshot.speed[i]);
+
+    SDL_Vertex *quad = &vertices[i * 4];
+    quad[0].position.x = x - r;
+    quad[0].position.y = y - r;
+    quad[0].tex_coord.x = 0.0f;
+    quad[0].tex_coord.y = 0.0f;
+    quad[1].position.x = x + r;
+    quad[1].position.y = y - r;
+    quad[1].tex_coord.x = 1.0f;
+    quad[1].tex_coord.y = 0.0f;
+    quad[2].position.x = x + r;
+    quad[2].position.y = y + r;
+    quad[2].tex_coord.x = 1.0f;
+    quad[2].tex_coord.y = 1.0f;
+    quad[3].position.x = x - r;
+    quad[3].position.y = y + r;
+    quad[3].tex_coord.x = 0.0f;
+    quad[3].tex_coord.y = 1.0f;
+    quad[0].color = quad[1].color = quad[2].color = quad[3].color = color;
+  }
+
+  SDL_RenderGeometry(renderer, circleTexture, vertices.data(),
+                     static_cast<int>(vertices.size()), indices.data(),
+                     static_cast<int>(count * 6));
+}
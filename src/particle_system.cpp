@@ -0,0 +1,333 @@
+#include "particle_system.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+BarrierBounds barrierBounds(int window_width, int window_height,
+                            int barrier_radius) {
+  BarrierBounds bounds;
+  bounds.left = static_cast<float>((window_width - barrier_radius) / 2);
+  bounds.right = static_cast<float>((window_width + barrier_radius) / 2);
+  bounds.top = static_cast<float>((window_height - barrier_radius) / 2);
+  bounds.bottom = static_cast<float>((window_height + barrier_radius) / 2);
+  return bounds;
+}
+
+const uint32_t ParticleHandle::NONE;
+const size_t ParticleSystem::npos;
+
+ParticleRef::operator Particle() const {
+  Particle particle(x, y, vx, vy, temperature, radius);
+  particle.speed = speed;
+  return particle;
+}
+
+ParticleRef &ParticleRef::operator=(const Particle &particle) {
+  x = particle.x;
+  y = particle.y;
+  vx = particle.vx;
+  vy = particle.vy;
+  speed = particle.speed;
+  radius = particle.radius;
+  temperature = particle.temperature;
+  return *this;
+}
+
+ParticleSystem::ParticleSystem(const std::vector<Particle> &particles) {
+  reserve(particles.size());
+  for (const Particle &particle : particles) {
+    add(particle);
+  }
+}
+
+void ParticleSystem::reserve(size_t capacity) {
+  x.reserve(capacity);
+  y.reserve(capacity);
+  vx.reserve(capacity);
+  vy.reserve(capacity);
+  speed.reserve(capacity);
+  radius.reserve(capacity);
+  temperature.reserve(capacity);
+  denseSlot.reserve(capacity);
+  slotIndex.reserve(capacity);
+  slotGeneration.reserve(capacity);
+  freeSlots.reserve(capacity);
+}
+
+void ParticleSystem::resize(size_t count) {
+  for (size_t i = count; i < denseSlot.size(); ++i) {
+    releaseSlot(denseSlot[i]);
+  }
+  denseSlot.resize(std::min(count, denseSlot.size()));
+  while (denseSlot.size() < count) {
+    denseSlot.push_back(acquireSlot(static_cast<uint32_t>(denseSlot.size())));
+  }
+  x.resize(count);
+  y.resize(count);
+  vx.resize(count);
+  vy.resize(count);
+  speed.resize(count);
+  radius.resize(count);
+  temperature.resize(count);
+}
+
+void ParticleSystem::clear() { resize(0); }
+
+ParticleHandle ParticleSystem::add(const Particle &particle) {
+  denseSlot.push_back(acquireSlot(static_cast<uint32_t>(x.size())));
+  x.push_back(particle.x);
+  y.push_back(particle.y);
+  vx.push_back(particle.vx);
+  vy.push_back(particle.vy);
+  speed.push_back(std::sqrt(particle.vx * particle.vx + particle.vy * particle.vy));
+  radius.push_back(particle.radius);
+  temperature.push_back(particle.temperature);
+  return handle(x.size() - 1);
+}
+
+void ParticleSystem::remove(size_t i) {
+  const size_t last = x.size() - 1;
+  const uint32_t slot = denseSlot[i];
+  if (i != last) {
+    x[i] = x[last];
+    y[i] = y[last];
+    vx[i] = vx[last];
+    vy[i] = vy[last];
+    speed[i] = speed[last];
+    radius[i] = radius[last];
+    temperature[i] = temperature[last];
+    denseSlot[i] = denseSlot[last];
+    slotIndex[denseSlot[i]] = static_cast<uint32_t>(i);
+  }
+  releaseSlot(slot);
+  x.pop_back();
+  y.pop_back();
+  vx.pop_back();
+  vy.pop_back();
+  speed.pop_back();
+  radius.pop_back();
+  temperature.pop_back();
+  denseSlot.pop_back();
+}
+
+bool ParticleSystem::remove(ParticleHandle handle) {
+  size_t i = indexOf(handle);
+  if (i == npos) {
+    return false;
+  }
+  remove(i);
+  return true;
+}
+
+ParticleHandle ParticleSystem::handle(size_t i) const {
+  ParticleHandle result;
+  result.slot = denseSlot[i];
+  result.generation = slotGeneration[result.slot];
+  return result;
+}
+
+size_t ParticleSystem::indexOf(ParticleHandle handle) const {
+  if (handle.slot >= slotIndex.size() ||
+      slotGeneration[handle.slot] != handle.generation ||
+      slotIndex[handle.slot] == ParticleHandle::NONE) {
+    return npos;
+  }
+  return slotIndex[handle.slot];
+}
+
+uint32_t ParticleSystem::acquireSlot(uint32_t index) {
+  uint32_t slot;
+  if (!freeSlots.empty()) {
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    slot = static_cast<uint32_t>(slotIndex.size());
+    slotIndex.push_back(ParticleHandle::NONE);
+    slotGeneration.push_back(0);
+  }
+  slotIndex[slot] = index;
+  return slot;
+}
+
+void ParticleSystem::releaseSlot(uint32_t slot) {
+  slotIndex[slot] = ParticleHandle::NONE;
+  ++slotGeneration[slot];
+  freeSlots.push_back(slot);
+}
+
+Particle ParticleSystem::get(size_t i) const {
+  Particle particle(x[i], y[i], vx[i], vy[i], temperature[i], radius[i]);
+  particle.speed = speed[i];
+  return particle;
+}
+
+void ParticleSystem::set(size_t i, const Particle &particle) { (*this)[i] = particle; }
+
+ParticleRef ParticleSystem::operator[](size_t i) {
+  ParticleRef ref = {x[i],      y[i],      vx[i],         vy[i],
+                     speed[i],  radius[i], temperature[i]};
+  return ref;
+}
+
+std::vector<Particle> ParticleSystem::toParticles() const {
+  std::vector<Particle> particles;
+  particles.reserve(size());
+  for (size_t i = 0; i < size(); ++i) {
+    particles.push_back(get(i));
+  }
+  return particles;
+}
+
+// Kernels. Each one has a vector body followed by a scalar loop that handles
+// the tail and is the whole implementation on targets without SSE.
+
+namespace {
+
+void integrateKernel(float *x, float *y, const float *vx, const float *vy,
+                     size_t begin, size_t end, float deltaTime) {
+  size_t i = begin;
+#if defined(__AVX__)
+  const __m256 dt = _mm256_set1_ps(deltaTime);
+  for (; i + 8 <= end; i += 8) {
+    __m256 px = _mm256_loadu_ps(x + i);
+    __m256 py = _mm256_loadu_ps(y + i);
+    px = _mm256_add_ps(px, _mm256_mul_ps(_mm256_loadu_ps(vx + i), dt));
+    py = _mm256_add_ps(py, _mm256_mul_ps(_mm256_loadu_ps(vy + i), dt));
+    _mm256_storeu_ps(x + i, px);
+    _mm256_storeu_ps(y + i, py);
+  }
+#elif defined(__SSE2__)
+  const __m128 dt = _mm_set1_ps(deltaTime);
+  for (; i + 4 <= end; i += 4) {
+    __m128 px = _mm_loadu_ps(x + i);
+    __m128 py = _mm_loadu_ps(y + i);
+    px = _mm_add_ps(px, _mm_mul_ps(_mm_loadu_ps(vx + i), dt));
+    py = _mm_add_ps(py, _mm_mul_ps(_mm_loadu_ps(vy + i), dt));
+    _mm_storeu_ps(x + i, px);
+    _mm_storeu_ps(y + i, py);
+  }
+#endif
+  for (; i < end; ++i) {
+    x[i] += vx[i] * deltaTime;
+    y[i] += vy[i] * deltaTime;
+  }
+}
+
+// Reflects one axis. Mirrors checkBarrierCollision: the velocity flips and
+// the position is clamped only for particles that touch a wall.
+void reflectAxisKernel(float *p, float *v, const float *radius, size_t begin,
+                       size_t end, float low, float high) {
+  size_t i = begin;
+#if defined(__AVX__)
+  const __m256 lo = _mm256_set1_ps(low);
+  const __m256 hi = _mm256_set1_ps(high);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= end; i += 8) {
+    __m256 pos = _mm256_loadu_ps(p + i);
+    __m256 r = _mm256_loadu_ps(radius + i);
+    __m256 hit = _mm256_or_ps(
+        _mm256_cmp_ps(_mm256_sub_ps(pos, r), lo, _CMP_LT_OQ),
+        _mm256_cmp_ps(_mm256_add_ps(pos, r), hi, _CMP_GT_OQ));
+    __m256 clamped = _mm256_max_ps(_mm256_add_ps(lo, r),
+                                   _mm256_min_ps(pos, _mm256_sub_ps(hi, r)));
+    _mm256_storeu_ps(p + i, _mm256_blendv_ps(pos, clamped, hit));
+    __m256 vel = _mm256_loadu_ps(v + i);
+    _mm256_storeu_ps(v + i, _mm256_xor_ps(vel, _mm256_and_ps(hit, sign)));
+  }
+#elif defined(__SSE2__)
+  const __m128 lo = _mm_set1_ps(low);
+  const __m128 hi = _mm_set1_ps(high);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= end; i += 4) {
+    __m128 pos = _mm_loadu_ps(p + i);
+    __m128 r = _mm_loadu_ps(radius + i);
+    __m128 hit = _mm_or_ps(_mm_cmplt_ps(_mm_sub_ps(pos, r), lo),
+                           _mm_cmpgt_ps(_mm_add_ps(pos, r), hi));
+    __m128 clamped =
+        _mm_max_ps(_mm_add_ps(lo, r), _mm_min_ps(pos, _mm_sub_ps(hi, r)));
+    _mm_storeu_ps(p + i, _mm_or_ps(_mm_and_ps(hit, clamped),
+                                   _mm_andnot_ps(hit, pos)));
+    __m128 vel = _mm_loadu_ps(v + i);
+    _mm_storeu_ps(v + i, _mm_xor_ps(vel, _mm_and_ps(hit, sign)));
+  }
+#endif
+  for (; i < end; ++i) {
+    if (p[i] - radius[i] < low || p[i] + radius[i] > high) {
+      v[i] *= -1;
+      p[i] = std::max(low + radius[i], std::min(p[i], high - radius[i]));
+    }
+  }
+}
+
+void speedKernel(float *speed, const float *vx, const float *vy, size_t begin,
+                 size_t end) {
+  size_t i = begin;
+#if defined(__AVX__)
+  for (; i + 8 <= end; i += 8) {
+    __m256 u = _mm256_loadu_ps(vx + i);
+    __m256 w = _mm256_loadu_ps(vy + i);
+    __m256 squared = _mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(w, w));
+    _mm256_storeu_ps(speed + i, _mm256_sqrt_ps(squared));
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= end; i += 4) {
+    __m128 u = _mm_loadu_ps(vx + i);
+    __m128 w = _mm_loadu_ps(vy + i);
+    __m128 squared = _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(w, w));
+    _mm_storeu_ps(speed + i, _mm_sqrt_ps(squared));
+  }
+#endif
+  for (; i < end; ++i) {
+    speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+  }
+}
+
+} // namespace
+
+void ParticleSystem::integrate(float deltaTime) { integrate(deltaTime, 0, size()); }
+
+void ParticleSystem::integrate(float deltaTime, size_t begin, size_t end) {
+  integrateKernel(x.data(), y.data(), vx.data(), vy.data(), begin, end,
+                  deltaTime);
+}
+
+void ParticleSystem::kick(const float *accelerationX, const float *accelerationY,
+                          float deltaTime, size_t begin, size_t end) {
+  // Same update as a drift, one derivative down
+  integrateKernel(vx.data(), vy.data(), accelerationX, accelerationY, begin,
+                  end, deltaTime);
+}
+
+void ParticleSystem::reflectWalls(const BarrierBounds &bounds) {
+  reflectWalls(bounds, 0, size());
+}
+
+void ParticleSystem::reflectWalls(const BarrierBounds &bounds, size_t begin,
+                                  size_t end) {
+  reflectAxisKernel(x.data(), vx.data(), radius.data(), begin, end,
+                    bounds.left, bounds.right);
+  reflectAxisKernel(y.data(), vy.data(), radius.data(), begin, end,
+                    bounds.top, bounds.bottom);
+}
+
+void ParticleSystem::computeSpeeds() { computeSpeeds(0, size()); }
+
+void ParticleSystem::computeSpeeds(size_t begin, size_t end) {
+  speedKernel(speed.data(), vx.data(), vy.data(), begin, end);
+}
+
+const char *particleKernelIsa() {
+#if defined(__AVX__)
+  return "AVX";
+#elif defined(__SSE2__)
+  return "SSE2";
+#else
+  return "Scalar";
+#endif
+}
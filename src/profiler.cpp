@@ -0,0 +1,281 @@
+#include "profiler.h"
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace {
+
+// Events kept per thread. At a few thousand events per second per thread
+// this holds several seconds of history.
+const size_t PROFILE_RING_CAPACITY = 1 << 14;
+
+// One ring entry. Fields are atomics so that a collector reading a slot the
+// owner is overwriting sees stale or new values, never a data race; the
+// sequence check in collectProfileEvents() discards such slots.
+struct ProfileSlot {
+  std::atomic<const char *> name;
+  std::atomic<uint64_t> start;
+  std::atomic<uint64_t> end;
+  std::atomic<int64_t> value;
+  std::atomic<int> kind;
+
+  ProfileSlot() : name(nullptr), start(0), end(0), value(0), kind(0) {}
+  ProfileSlot(const ProfileSlot &other) : ProfileSlot() { *this = other; }
+  ProfileSlot &operator=(const ProfileSlot &other) {
+    name.store(other.name.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    start.store(other.start.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    end.store(other.end.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    kind.store(other.kind.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+  }
+};
+
+struct ProfileThread {
+  int id = 0;
+  std::string name; // guarded by the registry mutex
+  bool inUse = true;
+  RingBuffer<ProfileSlot, PROFILE_RING_CAPACITY> ring;
+  // Events ever pushed; published after each slot is filled
+  std::atomic<uint64_t> recorded{0};
+};
+
+struct ProfileRegistry {
+  ProfileRegistry();
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ProfileThread>> threads;
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+ProfileRegistry &registry() {
+  static ProfileRegistry instance;
+  return instance;
+}
+
+ProfileRegistry::ProfileRegistry() {
+#ifndef _WIN32
+  // The distributed engine forks worker processes. Holding the mutex across
+  // fork() means a child never starts with it locked by a thread it lacks.
+  pthread_atfork([] { registry().mutex.lock(); },
+                 [] { registry().mutex.unlock(); },
+                 [] { registry().mutex.unlock(); });
+#endif
+}
+
+// Hands the ring back for reuse when its thread exits, so resizing the
+// worker pool doesn't grow the registry without bound.
+struct ThreadRingHandle {
+  ProfileThread *thread = nullptr;
+  ~ThreadRingHandle() {
+    if (thread) {
+      std::lock_guard<std::mutex> lock(registry().mutex);
+      thread->inUse = false;
+    }
+  }
+};
+
+thread_local ThreadRingHandle threadRing;
+
+ProfileThread &currentThread() {
+  if (!threadRing.thread) {
+    ProfileRegistry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (std::unique_ptr<ProfileThread> &thread : reg.threads) {
+      if (!thread->inUse) {
+        thread->inUse = true;
+        thread->name = "Thread " + std::to_string(thread->id);
+        threadRing.thread = thread.get();
+        break;
+      }
+    }
+    if (!threadRing.thread) {
+      reg.threads.emplace_back(new ProfileThread());
+      ProfileThread *thread = reg.threads.back().get();
+      thread->id = static_cast<int>(reg.threads.size());
+      thread->name = "Thread " + std::to_string(thread->id);
+      threadRing.thread = thread;
+    }
+  }
+  return *threadRing.thread;
+}
+
+void record(const char *name, ProfileEventKind kind, uint64_t start,
+            uint64_t end, int64_t value) {
+  ProfileThread &thread = currentThread();
+  ProfileSlot slot;
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start.store(start, std::memory_order_relaxed);
+  slot.end.store(end, std::memory_order_relaxed);
+  slot.value.store(value, std::memory_order_relaxed);
+  slot.kind.store(static_cast<int>(kind), std::memory_order_relaxed);
+  thread.ring.push(slot);
+  thread.recorded.store(thread.recorded.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+}
+
+void writeJsonString(FILE *file, const char *text) {
+  std::fputc('"', file);
+  for (const char *c = text; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      std::fputc('\\', file);
+    }
+    std::fputc(*c, file);
+  }
+  std::fputc('"', file);
+}
+
+} // namespace
+
+uint64_t profileNow() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - registry().epoch)
+          .count());
+}
+
+void setProfileThreadName(const std::string &name) {
+  ProfileThread &thread = currentThread();
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  thread.name = name;
+}
+
+void recordProfileScope(const char *name, uint64_t start, uint64_t end) {
+  record(name, ProfileEventKind::Scope, start, end, 0);
+}
+
+void recordProfileCounter(const char *name, int64_t value) {
+  uint64_t now = profileNow();
+  record(name, ProfileEventKind::Counter, now, now, value);
+}
+
+void collectProfileEvents(std::vector<ProfileEvent> &events, uint64_t since) {
+  events.clear();
+  ProfileRegistry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (std::unique_ptr<ProfileThread> &thread : reg.threads) {
+    const ProfileSlot *slots = thread->ring.data();
+    const uint64_t recorded = thread->recorded.load(std::memory_order_acquire);
+    const uint64_t oldest =
+        recorded > PROFILE_RING_CAPACITY ? recorded - PROFILE_RING_CAPACITY : 0;
+
+    // Walk back from the newest event until the window is covered. Events
+    // are pushed as they finish, so end times are in order.
+    const size_t firstOfThread = events.size();
+    for (uint64_t i = recorded; i > oldest; --i) {
+      const ProfileSlot &slot = slots[(i - 1) % PROFILE_RING_CAPACITY];
+      ProfileEvent event;
+      event.end = slot.end.load(std::memory_order_relaxed);
+      if (event.end < since) {
+        break;
+      }
+      event.name = slot.name.load(std::memory_order_relaxed);
+      event.kind = static_cast<ProfileEventKind>(slot.kind.load(std::memory_order_relaxed));
+      event.thread = thread->id;
+      event.start = slot.start.load(std::memory_order_relaxed);
+      event.value = slot.value.load(std::memory_order_relaxed);
+      event.value = event.kind == ProfileEventKind::Counter ? event.value : 0;
+      events.push_back(event);
+    }
+
+    // Drop whatever the owner overwrote (or was overwriting) while we read
+    const uint64_t after = thread->recorded.load(std::memory_order_acquire);
+    const uint64_t valid =
+        after >= PROFILE_RING_CAPACITY ? after - PROFILE_RING_CAPACITY + 1 : 0;
+    size_t kept = firstOfThread;
+    for (size_t e = firstOfThread; e < events.size(); ++e) {
+      uint64_t index = recorded - 1 - (e - firstOfThread);
+      if (index >= valid) {
+        events[kept++] = events[e];
+      }
+    }
+    events.resize(kept);
+    std::reverse(events.begin() + firstOfThread, events.end());
+  }
+}
+
+void summarizeProfile(const std::vector<ProfileEvent> &events,
+                      std::vector<ProfileSummary> &summaries) {
+  summaries.clear();
+  for (const ProfileEvent &event : events) {
+    if (event.kind != ProfileEventKind::Scope) {
+      continue;
+    }
+    double ms = (event.end - event.start) / 1e6;
+    // Names are string literals, but the same literal may have several
+    // addresses across translation units, so compare by content.
+    auto match = std::find_if(summaries.begin(), summaries.end(),
+                              [&](const ProfileSummary &summary) {
+                                return std::strcmp(summary.name, event.name) == 0;
+                              });
+    if (match == summaries.end()) {
+      ProfileSummary summary = {event.name, 0, 0.0, 0.0};
+      summaries.push_back(summary);
+      match = summaries.end() - 1;
+    }
+    ++match->calls;
+    match->totalMs += ms;
+    match->maxMs = std::max(match->maxMs, ms);
+  }
+}
+
+bool exportChromeTrace(const std::string &path, std::string &error) {
+  std::vector<ProfileEvent> events;
+  collectProfileEvents(events);
+
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    error = "Could not create " + path;
+    return false;
+  }
+
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  {
+    ProfileRegistry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (std::unique_ptr<ProfileThread> &thread : reg.threads) {
+      std::fprintf(file,
+                   "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%d,\"args\":{\"name\":",
+                   first ? "" : ",\n", thread->id);
+      writeJsonString(file, thread->name.c_str());
+      std::fprintf(file, "}}");
+      first = false;
+    }
+  }
+  // Timestamps are in microseconds
+  for (const ProfileEvent &event : events) {
+    std::fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+    writeJsonString(file, event.name);
+    if (event.kind == ProfileEventKind::Scope) {
+      std::fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                   event.thread, event.start / 1e3,
+                   (event.end - event.start) / 1e3);
+    } else {
+      std::fprintf(file,
+                   ",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                   "\"args\":{\"value\":%lld}}",
+                   event.thread, event.start / 1e3,
+                   static_cast<long long>(event.value));
+    }
+    first = false;
+  }
+  std::fprintf(file, "\n]}\n");
+
+  if (std::fclose(file) != 0) {
+    error = "Could not write " + path;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,340 @@
+#include "seeding.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "pcg32.h"
+#include "spatial_grid.h"
+
+namespace {
+
+// Side of a Poisson tile in background-grid cells. Fixed, rather than derived
+// from the thread count, so the output does not depend on how many threads
+// ran it. Must be at least 3 so that tiles of the same phase never read each
+// other's cells.
+const int TILE_CELLS = 32;
+
+// Candidates tried around an active sample before it is retired (Bridson's k)
+const int POISSON_CANDIDATES = 30;
+
+// A saturated Poisson-disk set with minimum distance R holds about
+// SATURATION_DENSITY * area / R^2 points.
+const float SATURATION_DENSITY = 0.69f;
+
+// Background grid cells hold no sample until this is overwritten. It is far
+// enough away that distance tests against an empty cell always pass.
+const float EMPTY_CELL = -FLT_MAX;
+
+void runTasks(ThreadPool *pool, int taskCount,
+              const std::function<void(int, int)> &task) {
+  if (pool) {
+    pool->run(taskCount, task);
+  } else {
+    for (int i = 0; i < taskCount; ++i) {
+      task(i, 0);
+    }
+  }
+}
+
+// Broad phase over the particles that were in the system before seeding.
+class ExistingParticles {
+public:
+  ExistingParticles(const ParticleSystem &system, float radius, float spacing)
+      : system(system), radius(radius), spacing(spacing) {
+    if (!system.empty()) {
+      grid.build(system);
+      range = spacing * (radius + grid.cellSize() / 2.0f);
+    }
+  }
+
+  bool overlaps(float x, float y) const {
+    if (system.empty()) {
+      return false;
+    }
+    bool hit = false;
+    grid.forEachNear(x, y, range, [&](int j) {
+      float dx = x - system.x[j];
+      float dy = y - system.y[j];
+      float limit = spacing * (radius + system.radius[j]);
+      hit = hit || dx * dx + dy * dy < limit * limit;
+    });
+    return hit;
+  }
+
+private:
+  const ParticleSystem &system;
+  SpatialGrid grid;
+  float radius;
+  float spacing;
+  float range = 0.0f;
+};
+
+// Rectangle available to particle centres
+struct CentreRegion {
+  float x0, y0, width, height;
+};
+
+// One pass of tiled Bridson sampling with minimum distance `distance`. Tiles
+// are processed in four phases by (tile x mod 2, tile y mod 2); tiles of a
+// phase are a whole tile apart, so they can run concurrently on the shared
+// background grid. Appends the accepted points to xs/ys in tile order.
+void poissonPass(const CentreRegion &region, float distance, uint64_t seed,
+                 const ExistingParticles &existing, ThreadPool *pool,
+                 std::vector<float> &xs, std::vector<float> &ys) {
+  const float cell = distance / std::sqrt(2.0f);
+  const int cols = static_cast<int>(region.width / cell) + 1;
+  const int rows = static_cast<int>(region.height / cell) + 1;
+  const int tilesX = (cols + TILE_CELLS - 1) / TILE_CELLS;
+  const int tilesY = (rows + TILE_CELLS - 1) / TILE_CELLS;
+  const float distanceSquared = distance * distance;
+
+  std::vector<float> cellX(static_cast<size_t>(cols) * rows, EMPTY_CELL);
+  std::vector<float> cellY(static_cast<size_t>(cols) * rows, EMPTY_CELL);
+  std::vector<std::vector<float> > tileSamples(tilesX * tilesY);
+
+  auto fillTile = [&](int tx, int ty) {
+    const int tileIndex = ty * tilesX + tx;
+    std::vector<float> &samples = tileSamples[tileIndex];
+    std::vector<int> active;
+    Pcg32 rng(seed, static_cast<uint64_t>(tileIndex) + 1);
+
+    const float tileLeft = region.x0 + tx * TILE_CELLS * cell;
+    const float tileTop = region.y0 + ty * TILE_CELLS * cell;
+    const float tileWidth =
+        std::min(TILE_CELLS * cell, region.x0 + region.width - tileLeft);
+    const float tileHeight =
+        std::min(TILE_CELLS * cell, region.y0 + region.height - tileTop);
+
+    auto tryAdd = [&](float x, float y) {
+      if (x < region.x0 || x > region.x0 + region.width || y < region.y0 ||
+          y > region.y0 + region.height) {
+        return false;
+      }
+      int gx = std::min(cols - 1, static_cast<int>((x - region.x0) / cell));
+      int gy = std::min(rows - 1, static_cast<int>((y - region.y0) / cell));
+      if (gx / TILE_CELLS != tx || gy / TILE_CELLS != ty) {
+        return false;
+      }
+      for (int ny = std::max(0, gy - 2); ny <= std::min(rows - 1, gy + 2); ++ny) {
+        for (int nx = std::max(0, gx - 2); nx <= std::min(cols - 1, gx + 2); ++nx) {
+          float dx = x - cellX[ny * cols + nx];
+          float dy = y - cellY[ny * cols + nx];
+          if (dx * dx + dy * dy < distanceSquared) {
+            return false;
+          }
+        }
+      }
+      if (existing.overlaps(x, y)) {
+        return false;
+      }
+      cellX[gy * cols + gx] = x;
+      cellY[gy * cols + gx] = y;
+      active.push_back(static_cast<int>(samples.size() / 2));
+      samples.push_back(x);
+      samples.push_back(y);
+      return true;
+    };
+
+    for (int attempt = 0; attempt < POISSON_CANDIDATES; ++attempt) {
+      if (tryAdd(tileLeft + rng.nextFloat() * tileWidth,
+                 tileTop + rng.nextFloat() * tileHeight)) {
+        break;
+      }
+    }
+
+    while (!active.empty()) {
+      size_t pick = rng.nextBelow(static_cast<uint32_t>(active.size()));
+      const float sx = samples[active[pick] * 2];
+      const float sy = samples[active[pick] * 2 + 1];
+      bool found = false;
+      for (int attempt = 0; attempt < POISSON_CANDIDATES && !found; ++attempt) {
+        // Uniform by area in the annulus [distance, 2 * distance)
+        float angle = rng.nextFloat() * 6.28318531f;
+        float r = std::sqrt(distanceSquared * (1.0f + 3.0f * rng.nextFloat()));
+        found = tryAdd(sx + r * std::cos(angle), sy + r * std::sin(angle));
+      }
+      if (!found) {
+        active[pick] = active.back();
+        active.pop_back();
+      }
+    }
+  };
+
+  for (int phase = 0; phase < 4; ++phase) {
+    const int offsetX = phase % 2;
+    const int offsetY = phase / 2;
+    const int phaseColumns = (tilesX - offsetX + 1) / 2;
+    const int phaseRows = (tilesY - offsetY + 1) / 2;
+    runTasks(pool, phaseColumns * phaseRows, [&](int task, int) {
+      fillTile(offsetX + 2 * (task % phaseColumns),
+               offsetY + 2 * (task / phaseColumns));
+    });
+  }
+
+  for (const std::vector<float> &samples : tileSamples) {
+    for (size_t i = 0; i < samples.size(); i += 2) {
+      xs.push_back(samples[i]);
+      ys.push_back(samples[i + 1]);
+    }
+  }
+}
+
+SeedingResult seedPoissonDisk(ParticleSystem &system,
+                              const SeedingOptions &options,
+                              const CentreRegion &region, ThreadPool *pool) {
+  SeedingResult result;
+  result.requested = options.count;
+
+  const float minDistance = options.spacing * 2.0f * options.particleRadius;
+  const float area = std::max(region.width * region.height, 1.0f);
+  // Aim for a saturated set about 20% larger than needed, then thin it
+  float distance = std::max(
+      minDistance, std::sqrt(SATURATION_DENSITY * area / (1.2f * options.count)));
+
+  std::vector<float> xs, ys;
+  {
+    ExistingParticles existing(system, options.particleRadius, options.spacing);
+    for (;;) {
+      xs.clear();
+      ys.clear();
+      poissonPass(region, distance, options.seed, existing, pool, xs, ys);
+      if (static_cast<int>(xs.size()) >= options.count || distance <= minDistance) {
+        break;
+      }
+      distance = std::max(minDistance, distance * 0.9f);
+    }
+  }
+
+  // Keep a uniformly random subset of exactly the requested size
+  Pcg32 rng(options.seed, 0);
+  const int total = static_cast<int>(xs.size());
+  const int placed = std::min(total, options.count);
+  for (int i = 0; i < placed; ++i) {
+    int j = i + static_cast<int>(rng.nextBelow(static_cast<uint32_t>(total - i)));
+    std::swap(xs[i], xs[j]);
+    std::swap(ys[i], ys[j]);
+  }
+
+  system.reserve(system.size() + placed);
+  for (int i = 0; i < placed; ++i) {
+    float vx = rng.uniform(-options.maxSpeed, options.maxSpeed);
+    float vy = rng.uniform(-options.maxSpeed, options.maxSpeed);
+    float temperature = rng.nextFloat() * options.maxTemperature;
+    system.add(Particle(xs[i], ys[i], vx, vy, temperature, options.particleRadius));
+  }
+
+  result.placed = placed;
+  return result;
+}
+
+SeedingResult seedJitteredLattice(ParticleSystem &system,
+                                  const SeedingOptions &options,
+                                  const CentreRegion &region,
+                                  ThreadPool *pool) {
+  SeedingResult result;
+  result.requested = options.count;
+
+  const float minDistance = options.spacing * 2.0f * options.particleRadius;
+  const float width = std::max(region.width, 0.0f);
+  const float height = std::max(region.height, 0.0f);
+
+  // Lattice points at minDistance spacing bound what the region can hold
+  const double capacity =
+      (std::floor(width / minDistance) + 1.0) * (std::floor(height / minDistance) + 1.0);
+  const int count = static_cast<int>(std::min<double>(options.count, capacity));
+  if (count <= 0) {
+    return result;
+  }
+
+  // Pick the lattice shape closest to the region's aspect ratio that still
+  // keeps neighbours minDistance apart
+  int cols = std::max(1, static_cast<int>(std::ceil(
+                             std::sqrt(count * std::max(width, 1.0f) /
+                                       std::max(height, 1.0f)))));
+  cols = std::min(cols, static_cast<int>(width / minDistance) + 1);
+  int rows = (count + cols - 1) / cols;
+  if (height > 0.0f && rows > static_cast<int>(height / minDistance) + 1) {
+    rows = static_cast<int>(height / minDistance) + 1;
+    cols = (count + rows - 1) / rows;
+  }
+  const float stepX = cols > 1 ? width / (cols - 1) : 0.0f;
+  const float stepY = rows > 1 ? height / (rows - 1) : 0.0f;
+  const float stepMin = std::min(cols > 1 ? stepX : FLT_MAX, rows > 1 ? stepY : FLT_MAX);
+  const float jitter =
+      stepMin == FLT_MAX ? 0.0f : std::max(0.0f, (stepMin - minDistance) / 2.0f);
+
+  const size_t first = system.size();
+  system.resize(first + count);
+  const uint64_t cells = static_cast<uint64_t>(cols) * rows;
+
+  auto body = [&](size_t begin, size_t end, int) {
+    for (size_t k = begin; k < end; ++k) {
+      // Spread the points evenly over the lattice when it has spare cells
+      uint64_t cellIndex = static_cast<uint64_t>(k) * cells / count;
+      int cx = static_cast<int>(cellIndex % cols);
+      int cy = static_cast<int>(cellIndex / cols);
+      Pcg32 rng(options.seed, static_cast<uint64_t>(k) + 1);
+
+      size_t i = first + k;
+      system.x[i] = region.x0 + cx * stepX + rng.uniform(-jitter, jitter);
+      system.y[i] = region.y0 + cy * stepY + rng.uniform(-jitter, jitter);
+      system.x[i] = std::max(region.x0, std::min(system.x[i], region.x0 + width));
+      system.y[i] = std::max(region.y0, std::min(system.y[i], region.y0 + height));
+      system.vx[i] = rng.uniform(-options.maxSpeed, options.maxSpeed);
+      system.vy[i] = rng.uniform(-options.maxSpeed, options.maxSpeed);
+      system.radius[i] = options.particleRadius;
+      system.temperature[i] = rng.nextFloat() * options.maxTemperature;
+    }
+    system.computeSpeeds(first + begin, first + end);
+  };
+
+  if (pool) {
+    pool->parallelFor(count, 256, body);
+  } else {
+    body(0, count, 0);
+  }
+
+  result.placed = count;
+  return result;
+}
+
+} // namespace
+
+const char *seedingModeName(SeedingMode mode) {
+  switch (mode) {
+  case SeedingMode::PoissonDisk:
+    return "Poisson Disk";
+  case SeedingMode::JitteredLattice:
+    return "Jittered Lattice";
+  }
+  return "Unknown";
+}
+
+SeedingResult seedParticles(ParticleSystem &system,
+                            const SeedingOptions &options, ThreadPool *pool) {
+  CentreRegion region;
+  region.x0 = options.region.left + options.particleRadius;
+  region.y0 = options.region.top + options.particleRadius;
+  region.width = options.region.right - options.region.left -
+                 2.0f * options.particleRadius;
+  region.height = options.region.bottom - options.region.top -
+                  2.0f * options.particleRadius;
+
+  if (options.count <= 0 || options.particleRadius <= 0.0f ||
+      options.spacing <= 0.0f || region.width < 0.0f || region.height < 0.0f) {
+    SeedingResult result;
+    result.requested = options.count;
+    return result;
+  }
+
+  switch (options.mode) {
+  case SeedingMode::PoissonDisk:
+    return seedPoissonDisk(system, options, region, pool);
+  case SeedingMode::JitteredLattice:
+    return seedJitteredLattice(system, options, region, pool);
+  }
+  return SeedingResult();
+}
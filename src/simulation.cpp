@@ -0,0 +1,550 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+// Chunk granularity for the per-particle kernels: a whole number of AVX
+// registers, and far enough apart that chunks don't share cache lines.
+const size_t KERNEL_GRAIN = 64;
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+Simulation::Simulation(const BarrierBounds &bounds, int threadCount)
+    : barrier(bounds), pool(threadCount), pairTally(0), contactTally(0) {}
+
+const char *simulationEngineName(SimulationEngine engine) {
+  switch (engine) {
+  case SimulationEngine::TimeStepped:
+    return "Time Stepped";
+  case SimulationEngine::EventDriven:
+    return "Event Driven";
+  case SimulationEngine::Sph:
+    return "SPH Fluid";
+  case SimulationEngine::Distributed:
+    return "Distributed";
+  }
+  return "Unknown";
+}
+
+const char *integratorKindName(IntegratorKind kind) {
+  switch (kind) {
+  case IntegratorKind::Euler:
+    return "Euler";
+  case IntegratorKind::VelocityVerlet:
+    return "Velocity Verlet";
+  case IntegratorKind::Leapfrog:
+    return "Leapfrog";
+  }
+  return "Unknown";
+}
+
+void Simulation::setThreadCount(int threadCount) { pool.resize(threadCount); }
+
+void Simulation::step(float deltaTime) {
+  PROFILE_SCOPE("Step");
+  // A distributed step that falls back has switched the engine to time
+  // stepped, which then takes the step instead
+  if (settings.engine == SimulationEngine::Distributed && advanceDistributed(deltaTime)) {
+    ++steps;
+    elapsed += deltaTime;
+    return;
+  }
+  if (domains.running()) {
+    stopDistributed();
+  }
+  if (!emitters.empty() || !sinks.empty()) {
+    updateSources(deltaTime);
+  }
+  if (settings.engine == SimulationEngine::EventDriven) {
+    advanceEvents(deltaTime);
+    forcesValid = false;
+  } else if (settings.engine == SimulationEngine::Sph) {
+    advanceSph(deltaTime);
+    forcesValid = false;
+  } else if (settings.integrator == IntegratorKind::VelocityVerlet) {
+    advanceStepped<VelocityVerletIntegrator>(deltaTime);
+  } else if (settings.integrator == IntegratorKind::Leapfrog) {
+    advanceStepped<LeapfrogIntegrator>(deltaTime);
+  } else {
+    advanceStepped<EulerIntegrator>(deltaTime);
+  }
+  ++steps;
+  elapsed += deltaTime;
+}
+
+void Simulation::integrate(float deltaTime) {
+  PROFILE_SCOPE("Integrate");
+  auto start = std::chrono::steady_clock::now();
+  pool.parallelFor(system.size(), KERNEL_GRAIN,
+                   [&](size_t begin, size_t end, int) {
+                     system.integrate(deltaTime, begin, end);
+                     system.computeSpeeds(begin, end);
+                   });
+  phaseTimings.integrate = millisecondsSince(start);
+}
+
+void Simulation::reflectWalls() {
+  PROFILE_SCOPE("Barrier");
+  auto start = std::chrono::steady_clock::now();
+  pool.parallelFor(system.size(), KERNEL_GRAIN,
+                   [&](size_t begin, size_t end, int) {
+                     system.reflectWalls(barrier, begin, end);
+                   });
+  phaseTimings.barrier = millisecondsSince(start);
+}
+
+template <typename Integrator> void Simulation::advanceStepped(float deltaTime) {
+  substeps = settings.adaptiveSubsteps ? chooseSubsteps(deltaTime) : 1;
+  PROFILE_COUNTER("Substeps", substeps);
+  if (Integrator::USES_PREVIOUS_FORCES &&
+      (!forcesValid || accelerationX.size() != system.size())) {
+    computeForces();
+  }
+  PhaseTimings total;
+  const float substepTime = deltaTime / substeps;
+  for (int s = 0; s < substeps; ++s) {
+    substep<Integrator>(substepTime);
+    total.integrate += phaseTimings.integrate;
+    total.barrier += phaseTimings.barrier;
+    total.collide += phaseTimings.collide;
+  }
+  phaseTimings = total;
+}
+
+template <typename Integrator> void Simulation::substep(float deltaTime) {
+  PROFILE_SCOPE("Substep");
+  auto start = std::chrono::steady_clock::now();
+  {
+    PROFILE_SCOPE("Integrate");
+    pool.parallelFor(system.size(), KERNEL_GRAIN,
+                     [&](size_t begin, size_t end, int) {
+                       Integrator::beforeForces(system, accelerationX.data(),
+                                                accelerationY.data(), deltaTime,
+                                                begin, end);
+                     });
+  }
+  double integrateMs = millisecondsSince(start);
+
+  reflectWalls();
+  double barrierMs = phaseTimings.barrier;
+  computeForces();
+  double collideMs = phaseTimings.collide;
+
+  start = std::chrono::steady_clock::now();
+  {
+    PROFILE_SCOPE("Integrate");
+    pool.parallelFor(system.size(), KERNEL_GRAIN,
+                     [&](size_t begin, size_t end, int) {
+                       Integrator::afterForces(system, accelerationX.data(),
+                                               accelerationY.data(), deltaTime,
+                                               begin, end);
+                       system.computeSpeeds(begin, end);
+                     });
+  }
+  integrateMs += millisecondsSince(start);
+  if (Integrator::DRIFTS_AFTER_FORCES) {
+    reflectWalls();
+    barrierMs += phaseTimings.barrier;
+  }
+
+  phaseTimings.integrate = integrateMs;
+  phaseTimings.barrier = barrierMs;
+  phaseTimings.collide = collideMs;
+}
+
+// The fewest substeps for which the fastest particle moves at most
+// maxDisplacement of the smallest radius, and the penalty spring between
+// two such particles gets several substeps per oscillation
+int Simulation::chooseSubsteps(float deltaTime) {
+  const size_t count = system.size();
+  if (count == 0) {
+    return 1;
+  }
+  const int threads = pool.threadCount();
+  threadSpeed.assign(threads, 0.0f);
+  threadRadius.assign(threads, FLT_MAX);
+  pool.parallelFor(count, KERNEL_GRAIN, [&](size_t begin, size_t end, int thread) {
+    float fastest = threadSpeed[thread];
+    float smallest = threadRadius[thread];
+    for (size_t i = begin; i < end; ++i) {
+      fastest = std::max(fastest, system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i]);
+      smallest = std::min(smallest, system.radius[i]);
+    }
+    threadSpeed[thread] = fastest;
+    threadRadius[thread] = smallest;
+  });
+  float fastest = 0.0f, smallest = FLT_MAX;
+  for (int t = 0; t < threads; ++t) {
+    fastest = std::max(fastest, threadSpeed[t]);
+    smallest = std::min(smallest, threadRadius[t]);
+  }
+
+  // Displacement: speed * h <= maxDisplacement * radius
+  const float reach = std::max(settings.maxDisplacement, 1e-3f) * std::max(smallest, 1e-3f);
+  float needed = std::sqrt(fastest) * deltaTime / reach;
+  // Stiffness: h * omega <= 0.5, well inside the symplectic limit of 2
+  needed = std::max(needed, deltaTime * std::sqrt(PENALTY_STIFFNESS) / 0.5f);
+  return std::max(1, std::min(settings.maxSubsteps, static_cast<int>(std::ceil(needed))));
+}
+
+void Simulation::collide(float deltaTime) {
+  computeForces();
+  pool.parallelFor(system.size(), KERNEL_GRAIN,
+                   [&](size_t begin, size_t end, int) {
+                     system.kick(accelerationX.data(), accelerationY.data(),
+                                 deltaTime, begin, end);
+                   });
+}
+
+void Simulation::computeForces() {
+  PROFILE_SCOPE("Collide");
+  auto start = std::chrono::steady_clock::now();
+  const bool parallel = pool.threadCount() > 1;
+  PROFILE_ONLY(pairTally.store(0); contactTally.store(0);)
+  accelerationX.assign(system.size(), 0.0f);
+  accelerationY.assign(system.size(), 0.0f);
+  forcesValid = true;
+
+  switch (settings.collisionBackend) {
+  case CollisionBackend::BruteForce:
+    if (settings.deterministic || parallel) {
+      collideBruteForceGather();
+    } else {
+      collideSerial();
+    }
+    break;
+  case CollisionBackend::UniformGrid:
+    {
+      PROFILE_SCOPE("Grid build");
+      grid.build(system);
+    }
+    if (settings.deterministic) {
+      collideGridColored();
+    } else if (parallel) {
+      collideGridImpulseBuffers();
+    } else {
+      collideSerial();
+    }
+    break;
+  }
+
+  phaseTimings.collide = millisecondsSince(start);
+  PROFILE_ONLY(
+    collisions.candidatePairs = pairTally.load();
+    collisions.contacts = contactTally.load();
+    PROFILE_COUNTER("Candidate pairs", static_cast<int64_t>(collisions.candidatePairs));
+    PROFILE_COUNTER("Contacts", static_cast<int64_t>(collisions.contacts));
+  )
+}
+
+double Simulation::totalEnergy() {
+  double energy = 0.0;
+  const size_t count = system.size();
+  for (size_t i = 0; i < count; ++i) {
+    energy += 0.5 * (double(system.vx[i]) * system.vx[i] +
+                     double(system.vy[i]) * system.vy[i]);
+  }
+  auto pair = [&](size_t i, size_t j) {
+    float ax, ay;
+    if (penaltyAcceleration(system, i, j, ax, ay)) {
+      // |a| = k * overlap, so k * overlap^2 / 2 = |a|^2 / (2k)
+      energy += 0.5 * (double(ax) * ax + double(ay) * ay) / PENALTY_STIFFNESS;
+    }
+  };
+  if (settings.collisionBackend == CollisionBackend::UniformGrid) {
+    grid.build(system);
+    grid.forEachCandidatePair(pair);
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      for (size_t j = i + 1; j < count; ++j) {
+        pair(i, j);
+      }
+    }
+  }
+  return energy;
+}
+
+void Simulation::updateSources(float deltaTime) {
+  PROFILE_SCOPE("Emitters");
+  const size_t before = system.size();
+  const uint64_t absorbed = sources.absorbed;
+  for (const Sink &sink : sinks) {
+    sources.absorbed += absorbParticles(system, sink);
+  }
+  if (!emitters.empty() && system.capacity() < settings.particleLimit) {
+    system.reserve(settings.particleLimit);
+  }
+  for (Emitter &emitter : emitters) {
+    size_t room = system.size() < settings.particleLimit
+                      ? settings.particleLimit - system.size()
+                      : 0;
+    sources.emitted += emitParticles(system, emitter, deltaTime, room, rng);
+  }
+  // Removals reorder the particles, so kept forces no longer line up
+  if (system.size() != before || sources.absorbed != absorbed) {
+    forcesValid = false;
+  }
+}
+
+void Simulation::advanceEvents(float deltaTime) {
+  PROFILE_SCOPE("Events");
+  auto start = std::chrono::steady_clock::now();
+  events.advance(system, barrier, deltaTime);
+  pool.parallelFor(system.size(), KERNEL_GRAIN,
+                   [&](size_t begin, size_t end, int) {
+                     system.computeSpeeds(begin, end);
+                   });
+
+  phaseTimings.integrate = 0.0;
+  phaseTimings.barrier = 0.0;
+  phaseTimings.collide = millisecondsSince(start);
+  const EventStats &stats = events.stats();
+  collisions.candidatePairs = stats.predictions;
+  collisions.contacts = stats.pairCollisions;
+  PROFILE_COUNTER("Events processed", static_cast<int64_t>(stats.pairCollisions +
+                                                 stats.wallCollisions +
+                                                 stats.cellCrossings));
+  PROFILE_COUNTER("Event queue", static_cast<int64_t>(stats.queueSize));
+}
+
+void Simulation::advanceSph(float deltaTime) {
+  auto start = std::chrono::steady_clock::now();
+  sph.step(system, barrier, deltaTime, pool);
+  pool.parallelFor(system.size(), KERNEL_GRAIN,
+                   [&](size_t begin, size_t end, int) {
+                     system.computeSpeeds(begin, end);
+                   });
+
+  phaseTimings.integrate = millisecondsSince(start);
+  phaseTimings.barrier = 0.0;
+  phaseTimings.collide = 0.0;
+  collisions.candidatePairs = sph.neighbourCount();
+  collisions.contacts = 0;
+  PROFILE_COUNTER("SPH neighbours", static_cast<int64_t>(sph.neighbourCount()));
+}
+
+bool Simulation::advanceDistributed(float deltaTime) {
+  // The workers keep what they were forked with, so any change restarts them
+  if (domains.running() && (domainsDirty || workersOutdated())) {
+    stopDistributed();
+  }
+  if (!domains.running()) {
+    domainsDirty = false;
+    if (!domains.start(*this, settings.distributed, domainError)) {
+      std::cerr << "Distributed engine: " << domainError << std::endl;
+      settings.engine = SimulationEngine::TimeStepped;
+      ++fallbacks;
+      return false;
+    }
+    domainError.clear();
+    domainSettings = settings;
+    domainThermostat = thermo.settings;
+    domainThreads = pool.threadCount();
+  }
+
+  if (!domains.step(deltaTime, thermo, rng, domainError)) {
+    // The particles are lost with the workers; carry on from the last copy
+    std::cerr << "Distributed engine: " << domainError << std::endl;
+    particlesStale = false;
+    domains.stop();
+    settings.engine = SimulationEngine::TimeStepped;
+    ++fallbacks;
+    return false;
+  }
+  particlesStale = true;
+
+  const DistributedStats &stats = domains.stats();
+  phaseTimings.integrate = stats.integrateMs;
+  phaseTimings.barrier = 0.0;
+  phaseTimings.collide = stats.collideMs;
+  collisions.candidatePairs = stats.candidatePairs;
+  collisions.contacts = stats.contacts;
+  return true;
+}
+
+bool Simulation::workersOutdated() const {
+  return settings != domainSettings || thermo.settings != domainThermostat ||
+         pool.threadCount() != domainThreads;
+}
+
+void Simulation::syncParticles() {
+  if (!particlesStale || !domains.running()) {
+    return;
+  }
+  particlesStale = false;
+  if (!domains.gather(system, domainError)) {
+    std::cerr << "Distributed engine: " << domainError << std::endl;
+    domains.stop();
+    settings.engine = SimulationEngine::TimeStepped;
+    ++fallbacks;
+  }
+}
+
+void Simulation::stopDistributed() {
+  syncParticles();
+  domains.stop();
+}
+
+void Simulation::addCollisionCounts(uint64_t candidatePairs, uint64_t contacts) {
+  pairTally.fetch_add(candidatePairs, std::memory_order_relaxed);
+  contactTally.fetch_add(contacts, std::memory_order_relaxed);
+}
+
+// Adds the penalty acceleration of one pair to both particles
+static inline bool accumulatePenalty(const ParticleSystem &system, size_t i,
+                                     size_t j, float *accelerationX,
+                                     float *accelerationY) {
+  float ax, ay;
+  if (!penaltyAcceleration(system, i, j, ax, ay)) {
+    return false;
+  }
+  accelerationX[i] -= ax;
+  accelerationY[i] -= ay;
+  accelerationX[j] += ax;
+  accelerationY[j] += ay;
+  return true;
+}
+
+// Single-threaded narrow phase over the selected broad phase. The grid, when
+// used, has already been built by computeForces().
+void Simulation::collideSerial() {
+  float *ax = accelerationX.data();
+  float *ay = accelerationY.data();
+  PROFILE_ONLY(uint64_t pairs = 0; uint64_t contacts = 0;)
+  auto pair = [&](int i, int j) {
+    PROFILE_ONLY(++pairs;)
+    if (accumulatePenalty(system, i, j, ax, ay)) {
+      PROFILE_ONLY(++contacts;)
+    }
+  };
+  if (settings.collisionBackend == CollisionBackend::UniformGrid) {
+    grid.forEachCandidatePair(pair);
+  } else {
+    const int count = static_cast<int>(system.size());
+    for (int i = 0; i < count; ++i) {
+      for (int j = i + 1; j < count; ++j) {
+        pair(i, j);
+      }
+    }
+  }
+  PROFILE_ONLY(addCollisionCounts(pairs, contacts);)
+}
+
+void Simulation::applyThermostat(float deltaTime) {
+  thermo.apply(system, deltaTime, pool, rng);
+}
+
+// Cells are coloured by (column mod 3, row mod 2). A cell's pairs only touch
+// particles in columns cx - 1 .. cx + 1 and rows cy .. cy + 1, so cells of
+// one colour never share a particle and can run concurrently without locks.
+// Every cell is processed by exactly one thread in a fixed order, which makes
+// the result independent of the thread count.
+void Simulation::collideGridColored() {
+  float *ax = accelerationX.data();
+  float *ay = accelerationY.data();
+  for (int rowPhase = 0; rowPhase < 2; ++rowPhase) {
+    int rowTasks = (grid.rows() - rowPhase + 1) / 2;
+    for (int columnPhase = 0; columnPhase < 3; ++columnPhase) {
+      pool.run(rowTasks, [&](int task, int) {
+        PROFILE_ONLY(uint64_t pairs = 0; uint64_t contacts = 0;)
+        auto pair = [&](int i, int j) {
+          PROFILE_ONLY(++pairs;)
+          if (accumulatePenalty(system, i, j, ax, ay)) {
+            PROFILE_ONLY(++contacts;)
+          }
+        };
+        int cy = rowPhase + 2 * task;
+        for (int cx = columnPhase; cx < grid.columns(); cx += 3) {
+          grid.forEachCandidatePairInCell(cx, cy, pair);
+        }
+        PROFILE_ONLY(addCollisionCounts(pairs, contacts);)
+      });
+    }
+  }
+}
+
+// Each thread accumulates accelerations into its own buffer, then a
+// reduction pass folds them together. Faster than colouring, but the
+// summation order depends on how rows were scheduled.
+void Simulation::collideGridImpulseBuffers() {
+  const size_t count = system.size();
+  const int threads = pool.threadCount();
+  partialX.resize(threads);
+  partialY.resize(threads);
+  for (int t = 0; t < threads; ++t) {
+    if (partialX[t].size() != count) {
+      partialX[t].assign(count, 0.0f);
+      partialY[t].assign(count, 0.0f);
+    }
+  }
+
+  pool.run(grid.rows(), [&](int cy, int thread) {
+    float *ax = partialX[thread].data();
+    float *ay = partialY[thread].data();
+    PROFILE_ONLY(uint64_t pairs = 0; uint64_t contacts = 0;)
+    auto pair = [&](int i, int j) {
+      PROFILE_ONLY(++pairs;)
+      if (accumulatePenalty(system, i, j, ax, ay)) {
+        PROFILE_ONLY(++contacts;)
+      }
+    };
+    for (int cx = 0; cx < grid.columns(); ++cx) {
+      grid.forEachCandidatePairInCell(cx, cy, pair);
+    }
+    PROFILE_ONLY(addCollisionCounts(pairs, contacts);)
+  });
+
+  // Fold the buffers in and leave them zeroed for the next evaluation
+  pool.parallelFor(count, KERNEL_GRAIN, [&](size_t begin, size_t end, int) {
+    for (int t = 0; t < threads; ++t) {
+      float *ax = partialX[t].data();
+      float *ay = partialY[t].data();
+      for (size_t i = begin; i < end; ++i) {
+        accelerationX[i] += ax[i];
+        accelerationY[i] += ay[i];
+        ax[i] = 0.0f;
+        ay[i] = 0.0f;
+      }
+    }
+  });
+}
+
+// Every particle sums the accelerations from all others and only writes its
+// own. Does twice the pair work of the serial loop, but needs no
+// synchronisation and the order of each sum is fixed.
+void Simulation::collideBruteForceGather() {
+  const size_t count = system.size();
+  pool.parallelFor(count, 1, [&](size_t begin, size_t end, int) {
+    PROFILE_ONLY(uint64_t contacts = 0;)
+    for (size_t i = begin; i < end; ++i) {
+      float sumX = 0.0f, sumY = 0.0f;
+      for (size_t j = 0; j < count; ++j) {
+        float ax, ay;
+        if (j != i && penaltyAcceleration(system, i, j, ax, ay)) {
+          PROFILE_ONLY(++contacts;)
+          sumX -= ax;
+          sumY -= ay;
+        }
+      }
+      accelerationX[i] = sumX;
+      accelerationY[i] = sumY;
+    }
+    PROFILE_ONLY(addCollisionCounts(0, contacts);)
+  });
+  // Every pair was visited from both ends; count it once
+  PROFILE_ONLY(
+    pairTally.store(count * (count - 1) / 2);
+    contactTally.store(contactTally.load() / 2);
+  )
+}
@@ -0,0 +1,219 @@
+#include "simulation_thread.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// Upper bound on the wall-clock time credited per tick. If physics cannot
+// keep up, the backlog is dropped instead of growing without bound.
+const double MAX_ACCUMULATED_SECONDS = 0.25;
+
+} // namespace
+
+SimulationThread::SimulationThread(const BarrierBounds &bounds, int threadCount)
+    : simulation(bounds, threadCount), running(false), rate(120.0f),
+      pausedFlag(false), recordingActive(false) {}
+
+SimulationThread::~SimulationThread() {
+  stop();
+  stopRecording();
+}
+
+void SimulationThread::start() {
+  if (running.exchange(true)) {
+    return;
+  }
+  thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+  if (!running.exchange(false)) {
+    return;
+  }
+  thread.join();
+}
+
+void SimulationThread::post(Command command) {
+  std::lock_guard<std::mutex> lock(commandMutex);
+  pendingCommands.push_back(std::move(command));
+}
+
+void SimulationThread::setStepRate(float stepsPerSecond) {
+  rate.store(std::max(1.0f, stepsPerSecond));
+}
+
+bool SimulationThread::startRecording(const std::string &path,
+                                      const BarrierBounds &bounds,
+                                      const TrajectoryOptions &options,
+                                      int everySteps, std::string &error) {
+  stopRecording();
+  std::unique_ptr<TrajectoryWriter> writer(new TrajectoryWriter());
+  if (!writer->open(path, bounds, options, error)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(recorderMutex);
+  recorder = std::move(writer);
+  recordEverySteps = std::max(1, everySteps);
+  stepsSinceFrame = 0;
+  recordingActive.store(true);
+  return true;
+}
+
+void SimulationThread::stopRecording() {
+  std::unique_ptr<TrajectoryWriter> writer;
+  {
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    recordingActive.store(false);
+    writer.swap(recorder);
+  }
+  // Flushing the queue can take a while; don't hold up the physics thread
+  if (writer) {
+    writer->close();
+    std::lock_guard<std::mutex> lock(recorderMutex);
+    lastRecordingStats = writer->stats();
+  }
+}
+
+TrajectoryStats SimulationThread::recordingStats() const {
+  std::lock_guard<std::mutex> lock(recorderMutex);
+  return recorder ? recorder->stats() : lastRecordingStats;
+}
+
+void SimulationThread::recordFrame() {
+  if (!recordingActive.load()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(recorderMutex);
+  if (!recorder || ++stepsSinceFrame < recordEverySteps) {
+    return;
+  }
+  stepsSinceFrame = 0;
+  PROFILE_SCOPE("Record frame");
+  simulation.syncParticles();
+  ParticleSystem &particles = simulation.particles();
+  particles.computeSpeeds();
+  recorder->submit(particles, simulation.stepCount(), simulation.time());
+}
+
+const ParticleSnapshot &SimulationThread::latestSnapshot() {
+  snapshots.update();
+  return snapshots.readBuffer();
+}
+
+bool SimulationThread::applyCommands() {
+  PROFILE_SCOPE("Commands");
+  {
+    std::lock_guard<std::mutex> lock(commandMutex);
+    runningCommands.swap(pendingCommands);
+  }
+  bool applied = !runningCommands.empty();
+  if (applied) {
+    // Commands may read or edit the particles, which the distributed
+    // workers own between steps
+    simulation.syncParticles();
+    for (Command &command : runningCommands) {
+      command(simulation);
+    }
+  }
+  runningCommands.clear();
+  return applied;
+}
+
+void SimulationThread::publishSnapshot(float stepsPerSecond) {
+  PROFILE_SCOPE("Publish snapshot");
+  simulation.syncParticles();
+  ParticleSystem &particles = simulation.particles();
+  particles.computeSpeeds();
+
+  ParticleSnapshot &snapshot = snapshots.writeBuffer();
+  snapshot.x.assign(particles.x.begin(), particles.x.end());
+  snapshot.y.assign(particles.y.begin(), particles.y.end());
+  snapshot.radius.assign(particles.radius.begin(), particles.radius.end());
+  snapshot.speed.assign(particles.speed.begin(), particles.speed.end());
+
+  float totalSpeed = 0.0f;
+  for (float speed : snapshot.speed) {
+    totalSpeed += speed;
+  }
+  snapshot.averageSpeed =
+      snapshot.speed.empty() ? 0.0f : totalSpeed / snapshot.speed.size();
+  snapshot.stepCount = simulation.stepCount();
+  snapshot.simulationTime = simulation.time();
+  snapshot.stepsPerSecond = stepsPerSecond;
+  snapshot.threadCount = simulation.threadCount();
+  snapshot.timings = simulation.timings();
+  snapshot.substeps = simulation.substepCount();
+  snapshot.collisions = simulation.collisionCounts();
+  snapshot.events = simulation.eventStats();
+  snapshot.sources = simulation.sourceCounts();
+  snapshot.speedHistogram = simulation.thermostat().histogram();
+  snapshot.temperatures = simulation.thermostat().temperatures();
+  snapshot.distributed = simulation.distributedStats();
+  snapshot.distributedError = simulation.distributedError();
+  snapshot.distributedFallbacks = simulation.distributedFallbacks();
+  snapshot.bounds = simulation.bounds();
+
+  snapshots.publish();
+}
+
+void SimulationThread::run() {
+  PROFILE_ONLY(setProfileThreadName("Physics");)
+  typedef std::chrono::steady_clock Clock;
+
+  Clock::time_point previous = Clock::now();
+  Clock::time_point rateWindowStart = previous;
+  uint64_t rateWindowSteps = 0;
+  float measuredRate = 0.0f;
+  double accumulator = 0.0;
+
+  applyCommands();
+  publishSnapshot(measuredRate);
+
+  while (running.load()) {
+    bool changed = applyCommands();
+
+    Clock::time_point now = Clock::now();
+    accumulator += std::chrono::duration<double>(now - previous).count();
+    accumulator = std::min(accumulator, MAX_ACCUMULATED_SECONDS);
+    previous = now;
+    if (pausedFlag.load()) {
+      accumulator = 0.0;
+    }
+
+    const double deltaTime = 1.0 / rate.load();
+    bool stepped = false;
+    while (accumulator >= deltaTime) {
+      simulation.step(static_cast<float>(deltaTime));
+      // Only the penalty engine is thermostatted here; the distributed
+      // engine does it within each step. Hard spheres conserve energy on
+      // their own, and rescaling every velocity would invalidate all
+      // predicted events.
+      // SPH particles are fluid parcels whose speeds are set by the pressure
+      // and viscosity forces, not a thermal velocity to regulate.
+      if (simulation.settings.engine == SimulationEngine::TimeStepped) {
+        simulation.applyThermostat(static_cast<float>(deltaTime));
+      }
+      recordFrame();
+      accumulator -= deltaTime;
+      ++rateWindowSteps;
+      stepped = true;
+    }
+
+    double windowSeconds =
+        std::chrono::duration<double>(now - rateWindowStart).count();
+    if (windowSeconds >= 0.5) {
+      measuredRate = static_cast<float>(rateWindowSteps / windowSeconds);
+      rateWindowSteps = 0;
+      rateWindowStart = now;
+    }
+
+    if (stepped || changed) {
+      publishSnapshot(measuredRate);
+    }
+
+    // Sleep until the next step is due (or the next command poll, if paused)
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(deltaTime - accumulator));
+  }
+}
@@ -0,0 +1,132 @@
+#include "spatial_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+const char *collisionBackendName(CollisionBackend backend) {
+  switch (backend) {
+  case CollisionBackend::BruteForce:
+    return "Brute Force";
+  case CollisionBackend::UniformGrid:
+    return "Uniform Grid";
+  }
+  return "Unknown";
+}
+
+int SpatialGrid::cellIndex(float px, float py) const {
+  int cx = static_cast<int>((px - originX) / size);
+  int cy = static_cast<int>((py - originY) / size);
+  cx = std::max(0, std::min(cx, cols - 1));
+  cy = std::max(0, std::min(cy, rowCount - 1));
+  return cy * cols + cx;
+}
+
+void SpatialGrid::build(const std::vector<Particle> &particles) {
+  if (particles.empty()) {
+    build(nullptr, nullptr, nullptr, 0);
+    return;
+  }
+  const Particle &first = particles.front();
+  build(&first.x, &first.y, &first.radius, static_cast<int>(particles.size()),
+        sizeof(Particle) / sizeof(float));
+}
+
+void SpatialGrid::build(const ParticleSystem &system) {
+  build(system.x.data(), system.y.data(), system.radius.data(),
+        static_cast<int>(system.size()));
+}
+
+void SpatialGrid::build(const float *x, const float *y, const float *radius,
+                        int count, int stride) {
+  if (count == 0) {
+    cols = rowCount = 0;
+    cellStart.assign(1, 0);
+    cellParticles.clear();
+    particleCell.clear();
+    return;
+  }
+
+  float minX = x[0], maxX = x[0];
+  float minY = y[0], maxY = y[0];
+  float maxRadius = radius[0];
+  for (int i = 0; i < count; ++i) {
+    minX = std::min(minX, x[i * stride]);
+    maxX = std::max(maxX, x[i * stride]);
+    minY = std::min(minY, y[i * stride]);
+    maxY = std::max(maxY, y[i * stride]);
+    maxRadius = std::max(maxRadius, radius[i * stride]);
+  }
+
+  // One diameter per cell keeps every overlapping pair within the 3x3
+  // neighbourhood. Sparse clouds get larger cells so the grid stays O(n).
+  size = std::max(2.0f * maxRadius, 1.0f);
+  float width = maxX - minX;
+  float height = maxY - minY;
+  const float maxCells = 4.0f * count + 64.0f;
+  if ((width / size + 1.0f) * (height / size + 1.0f) > maxCells) {
+    size = std::max(size, std::sqrt(width * height / maxCells));
+    while ((width / size + 1.0f) * (height / size + 1.0f) > maxCells) {
+      size *= 1.5f;
+    }
+  }
+
+  originX = minX;
+  originY = minY;
+  cols = static_cast<int>(width / size) + 1;
+  rowCount = static_cast<int>(height / size) + 1;
+  const int cellCount = cols * rowCount;
+
+  // Counting sort: histogram, exclusive prefix sum, scatter
+  cellStart.assign(cellCount + 1, 0);
+  particleCell.resize(count);
+  for (int i = 0; i < count; ++i) {
+    int cell = cellIndex(x[i * stride], y[i * stride]);
+    particleCell[i] = cell;
+    ++cellStart[cell + 1];
+  }
+  for (int c = 0; c < cellCount; ++c) {
+    cellStart[c + 1] += cellStart[c];
+  }
+
+  cellParticles.resize(count);
+  scatterOffsets.assign(cellStart.begin(), cellStart.end() - 1);
+  for (int i = 0; i < count; ++i) {
+    cellParticles[scatterOffsets[particleCell[i]]++] = i;
+  }
+}
+
+void resolveCollisions(std::vector<Particle> &particles,
+                       CollisionBackend backend, SpatialGrid &grid) {
+  switch (backend) {
+  case CollisionBackend::BruteForce:
+    for (size_t i = 0; i < particles.size(); ++i) {
+      for (size_t j = i + 1; j < particles.size(); ++j) {
+        CheckCollision(particles[i], particles[j]);
+      }
+    }
+    break;
+  case CollisionBackend::UniformGrid:
+    grid.build(particles);
+    grid.forEachCandidatePair(
+        [&particles](int i, int j) { CheckCollision(particles[i], particles[j]); });
+    break;
+  }
+}
+
+void resolveCollisions(ParticleSystem &system, CollisionBackend backend,
+                       SpatialGrid &grid) {
+  switch (backend) {
+  case CollisionBackend::BruteForce:
+    for (size_t i = 0; i < system.size(); ++i) {
+      for (size_t j = i + 1; j < system.size(); ++j) {
+        CheckCollision(system, i, j);
+      }
+    }
+    break;
+  case CollisionBackend::UniformGrid:
+    grid.build(system);
+    grid.forEachCandidatePair(
+        [&system](int i, int j) { CheckCollision(system, i, j); });
+    break;
+  }
+}
@@ -0,0 +1,367 @@
+#include "sph.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+// Work per particle is one neighbour list, so smaller chunks than the plain
+// array kernels keep the threads evenly loaded.
+const size_t SPH_GRAIN = 32;
+
+// Kernels in 2D with support radius h. Each is written without branches
+// (max() against zero instead of range checks) so the per-neighbour loops
+// vectorize, and returns zero beyond h so padded neighbour lists are safe.
+struct Poly6SpikyKernel {
+  float h, h2, wNorm, gradNorm;
+  explicit Poly6SpikyKernel(float h)
+      : h(h), h2(h * h), wNorm(4.0f / (PI * std::pow(h, 8.0f))),
+        gradNorm(30.0f / (PI * std::pow(h, 5.0f))) {}
+  float value(float r) const {
+    float d = std::max(0.0f, h2 - r * r);
+    return wNorm * d * d * d;
+  }
+  // dW/dr, never positive
+  float slope(float r) const {
+    float d = std::max(0.0f, h - r);
+    return -gradNorm * d * d;
+  }
+};
+
+struct CubicSplineKernel {
+  float invH, norm;
+  explicit CubicSplineKernel(float h)
+      : invH(1.0f / h), norm(40.0f / (7.0f * PI * h * h)) {}
+  float value(float r) const {
+    float q = r * invH;
+    float a = std::max(0.0f, 1.0f - q);
+    float b = std::max(0.0f, 0.5f - q);
+    return norm * (2.0f * a * a * a - 8.0f * b * b * b);
+  }
+  float slope(float r) const {
+    float q = r * invH;
+    float a = std::max(0.0f, 1.0f - q);
+    float b = std::max(0.0f, 0.5f - q);
+    return norm * invH * (24.0f * b * b - 6.0f * a * a);
+  }
+};
+
+struct WendlandC2Kernel {
+  float invH, norm;
+  explicit WendlandC2Kernel(float h)
+      : invH(1.0f / h), norm(7.0f / (PI * h * h)) {}
+  float value(float r) const {
+    float q = r * invH;
+    float a = std::max(0.0f, 1.0f - q);
+    return norm * a * a * a * a * (1.0f + 4.0f * q);
+  }
+  float slope(float r) const {
+    float q = r * invH;
+    float a = std::max(0.0f, 1.0f - q);
+    return norm * invH * -20.0f * q * a * a * a;
+  }
+};
+
+// Density of a square lattice at the rest spacing, seen from one site
+template <typename Kernel>
+float latticeDensity(const Kernel &kernel, float h, float spacing, float mass) {
+  int reach = static_cast<int>(std::ceil(h / spacing));
+  float sum = 0.0f;
+  for (int y = -reach; y <= reach; ++y) {
+    for (int x = -reach; x <= reach; ++x) {
+      sum += kernel.value(spacing * std::sqrt(static_cast<float>(x * x + y * y)));
+    }
+  }
+  return mass * sum;
+}
+
+} // namespace
+
+const char *sphKernelName(SphKernel kernel) {
+  switch (kernel) {
+  case SphKernel::Poly6Spiky:
+    return "Poly6 / Spiky";
+  case SphKernel::CubicSpline:
+    return "Cubic Spline";
+  case SphKernel::WendlandC2:
+    return "Wendland C2";
+  }
+  return "Unknown";
+}
+
+void SphSolver::updateRestDensity() {
+  const float h = settings.smoothingLength;
+  const float spacing = std::max(0.1f, settings.restSpacing);
+  if (rest > 0.0f && restKernel == settings.kernel && restSmoothing == h &&
+      restSpacing == spacing && restMass == settings.particleMass) {
+    return;
+  }
+  switch (settings.kernel) {
+  case SphKernel::Poly6Spiky:
+    rest = latticeDensity(Poly6SpikyKernel(h), h, spacing, settings.particleMass);
+    break;
+  case SphKernel::CubicSpline:
+    rest = latticeDensity(CubicSplineKernel(h), h, spacing, settings.particleMass);
+    break;
+  case SphKernel::WendlandC2:
+    rest = latticeDensity(WendlandC2Kernel(h), h, spacing, settings.particleMass);
+    break;
+  }
+  restKernel = settings.kernel;
+  restSmoothing = h;
+  restSpacing = spacing;
+  restMass = settings.particleMass;
+}
+
+void SphSolver::step(ParticleSystem &system, const BarrierBounds &bounds,
+                     float deltaTime, ThreadPool &pool) {
+  PROFILE_SCOPE("SPH step");
+  settings.smoothingLength = std::max(1.0f, settings.smoothingLength);
+  updateRestDensity();
+
+  const size_t count = system.size();
+  const int substeps = std::max(1, settings.substeps);
+  const float substepTime = deltaTime / substeps;
+  if (count == 0) {
+    return;
+  }
+
+  // Pad the search radius by how far two particles can close in on each
+  // other during the step, so one neighbour list serves every substep. If
+  // that pad would be large, rebuild per substep instead.
+  float maxSpeed = 0.0f;
+  for (size_t i = 0; i < count; ++i) {
+    maxSpeed = std::max(maxSpeed, system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i]);
+  }
+  maxSpeed = std::sqrt(maxSpeed);
+  const float gravity = std::sqrt(settings.gravityX * settings.gravityX +
+                                  settings.gravityY * settings.gravityY);
+  const float h = settings.smoothingLength;
+  auto padFor = [&](float time) {
+    return 2.0f * (maxSpeed * time + 0.5f * gravity * time * time);
+  };
+  const bool shareList = padFor(deltaTime) <= 0.5f * h;
+
+  for (int s = 0; s < substeps; ++s) {
+    if (s == 0 || !shareList) {
+      buildNeighbours(system, bounds,
+                      h + padFor(shareList ? deltaTime : substepTime), pool);
+    }
+    switch (settings.kernel) {
+    case SphKernel::Poly6Spiky:
+      substep<Poly6SpikyKernel>(system, bounds, substepTime, pool);
+      break;
+    case SphKernel::CubicSpline:
+      substep<CubicSplineKernel>(system, bounds, substepTime, pool);
+      break;
+    case SphKernel::WendlandC2:
+      substep<WendlandC2Kernel>(system, bounds, substepTime, pool);
+      break;
+    }
+  }
+}
+
+void SphSolver::buildNeighbours(const ParticleSystem &system,
+                                const BarrierBounds &bounds, float searchRadius,
+                                ThreadPool &pool) {
+  PROFILE_SCOPE("SPH neighbours");
+  const int count = static_cast<int>(system.size());
+  const float width = std::max(searchRadius, bounds.right - bounds.left);
+  const float height = std::max(searchRadius, bounds.bottom - bounds.top);
+  const int columns = std::max(1, static_cast<int>(width / searchRadius));
+  const int rows = std::max(1, static_cast<int>(height / searchRadius));
+  const float cellWidth = width / columns;
+  const float cellHeight = height / rows;
+  const int cells = columns * rows;
+
+  // Counting sort into cells, with the positions copied into cell order so
+  // the candidate scans below read contiguous memory
+  cellStart.assign(cells + 1, 0);
+  particleCell.resize(count);
+  for (int i = 0; i < count; ++i) {
+    int cx = static_cast<int>((system.x[i] - bounds.left) / cellWidth);
+    int cy = static_cast<int>((system.y[i] - bounds.top) / cellHeight);
+    cx = std::max(0, std::min(cx, columns - 1));
+    cy = std::max(0, std::min(cy, rows - 1));
+    particleCell[i] = cy * columns + cx;
+    ++cellStart[particleCell[i] + 1];
+  }
+  for (int c = 0; c < cells; ++c) {
+    cellStart[c + 1] += cellStart[c];
+  }
+  cellCursor.assign(cellStart.begin(), cellStart.end() - 1);
+  cellParticles.resize(count);
+  cellX.resize(count);
+  cellY.resize(count);
+  for (int i = 0; i < count; ++i) {
+    int slot = cellCursor[particleCell[i]]++;
+    cellParticles[slot] = i;
+    cellX[slot] = system.x[i];
+    cellY[slot] = system.y[i];
+  }
+
+  // The three cells of a neighbouring row are adjacent in cell order, so
+  // each particle scans three contiguous runs. Its own slot is skipped by
+  // excluding zero distance to itself via the index check.
+  const float radius2 = searchRadius * searchRadius;
+  auto rowRun = [&](int i, int ny, int &first, int &last) {
+    const int cx = particleCell[i] % columns;
+    const int row = ny * columns;
+    first = cellStart[row + std::max(0, cx - 1)];
+    last = cellStart[row + std::min(columns - 1, cx + 1) + 1];
+  };
+
+  // Two passes, count then fill, so the lists are written in parallel
+  // straight into their final place
+  neighbourStart.resize(count + 1);
+  neighbourStart[0] = 0;
+  pool.parallelFor(count, SPH_GRAIN, [&](size_t begin, size_t end, int) {
+    for (size_t i = begin; i < end; ++i) {
+      const int cy = particleCell[i] / columns;
+      const float xi = system.x[i], yi = system.y[i];
+      int found = 0;
+      for (int ny = std::max(0, cy - 1); ny <= std::min(rows - 1, cy + 1); ++ny) {
+        int first, last;
+        rowRun(static_cast<int>(i), ny, first, last);
+        for (int k = first; k < last; ++k) {
+          float dx = cellX[k] - xi;
+          float dy = cellY[k] - yi;
+          // Same test as the fill pass: a NaN position never matches itself
+          found += dx * dx + dy * dy < radius2 && cellParticles[k] != static_cast<int>(i);
+        }
+      }
+      neighbourStart[i + 1] = found;
+    }
+  });
+  for (int i = 0; i < count; ++i) {
+    neighbourStart[i + 1] += neighbourStart[i];
+  }
+  const size_t total = static_cast<size_t>(neighbourStart[count]);
+  neighbourIndex.resize(total);
+  neighbourDx.resize(total);
+  neighbourDy.resize(total);
+  neighbourR.resize(total);
+  pool.parallelFor(count, SPH_GRAIN, [&](size_t begin, size_t end, int) {
+    for (size_t i = begin; i < end; ++i) {
+      const int cy = particleCell[i] / columns;
+      const float xi = system.x[i], yi = system.y[i];
+      int *out = neighbourIndex.data() + neighbourStart[i];
+      for (int ny = std::max(0, cy - 1); ny <= std::min(rows - 1, cy + 1); ++ny) {
+        int first, last;
+        rowRun(static_cast<int>(i), ny, first, last);
+        for (int k = first; k < last; ++k) {
+          float dx = cellX[k] - xi;
+          float dy = cellY[k] - yi;
+          int j = cellParticles[k];
+          if (dx * dx + dy * dy < radius2 && j != static_cast<int>(i)) {
+            *out++ = j;
+          }
+        }
+      }
+    }
+  });
+}
+
+template <typename Kernel>
+void SphSolver::substep(ParticleSystem &system, const BarrierBounds &bounds,
+                        float deltaTime, ThreadPool &pool) {
+  const size_t count = system.size();
+  const Kernel kernel(settings.smoothingLength);
+  const float mass = settings.particleMass;
+  const float stiffness = settings.stiffness;
+  const float selfDensity = mass * kernel.value(0.0f);
+  density.resize(count);
+  pressureTerm.resize(count);
+
+  const float *x = system.x.data();
+  const float *y = system.y.data();
+  const int *index = neighbourIndex.data();
+  float *ndx = neighbourDx.data();
+  float *ndy = neighbourDy.data();
+  float *nr = neighbourR.data();
+
+  // Density and pressure. Also caches each neighbour's offset and distance
+  // for the force pass.
+  {
+    PROFILE_SCOPE("SPH density");
+    pool.parallelFor(count, SPH_GRAIN, [&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+        const int first = neighbourStart[i], last = neighbourStart[i + 1];
+        const float xi = x[i], yi = y[i];
+        for (int k = first; k < last; ++k) {
+          ndx[k] = x[index[k]] - xi;
+          ndy[k] = y[index[k]] - yi;
+        }
+        float sum = 0.0f;
+        for (int k = first; k < last; ++k) {
+          float r = std::sqrt(ndx[k] * ndx[k] + ndy[k] * ndy[k]);
+          nr[k] = r;
+          sum += kernel.value(r);
+        }
+        float rho = selfDensity + mass * sum;
+        density[i] = rho;
+        float pressure = std::max(0.0f, stiffness * (rho - rest));
+        pressureTerm[i] = pressure / (rho * rho);
+      }
+    });
+  }
+
+  // Symmetric pressure force plus Brookshaw's Laplacian for viscosity
+  const float *vx = system.vx.data();
+  const float *vy = system.vy.data();
+  const float viscosity = 2.0f * settings.viscosity * mass;
+  const float softening = 0.01f * settings.smoothingLength * settings.smoothingLength;
+  accelerationX.resize(count);
+  accelerationY.resize(count);
+  {
+    PROFILE_SCOPE("SPH forces");
+    pool.parallelFor(count, SPH_GRAIN, [&](size_t begin, size_t end, int) {
+      for (size_t i = begin; i < end; ++i) {
+        const int first = neighbourStart[i], last = neighbourStart[i + 1];
+        const float pi = pressureTerm[i];
+        const float vxi = vx[i], vyi = vy[i];
+        float ax = settings.gravityX, ay = settings.gravityY;
+        for (int k = first; k < last; ++k) {
+          const int j = index[k];
+          const float r = nr[k];
+          const float slope = kernel.slope(r);
+          // dW/dr <= 0, so this pushes i away from j
+          const float push = mass * (pi + pressureTerm[j]) * slope / std::max(r, 1e-6f);
+          const float drag = viscosity / density[j] * slope * r / (r * r + softening);
+          ax += push * ndx[k] + drag * (vxi - vx[j]);
+          ay += push * ndy[k] + drag * (vyi - vy[j]);
+        }
+        accelerationX[i] = ax;
+        accelerationY[i] = ay;
+      }
+    });
+  }
+
+  // Semi-implicit Euler, then clamp into the barrier and bounce off it
+  PROFILE_SCOPE("SPH integrate");
+  const float restitution = settings.wallRestitution;
+  pool.parallelFor(count, 256, [&](size_t begin, size_t end, int) {
+    float *px = system.x.data(), *py = system.y.data();
+    float *pvx = system.vx.data(), *pvy = system.vy.data();
+    const float *radius = system.radius.data();
+    for (size_t i = begin; i < end; ++i) {
+      float velocityX = pvx[i] + accelerationX[i] * deltaTime;
+      float velocityY = pvy[i] + accelerationY[i] * deltaTime;
+      float nextX = px[i] + velocityX * deltaTime;
+      float nextY = py[i] + velocityY * deltaTime;
+      const float left = bounds.left + radius[i], right = bounds.right - radius[i];
+      const float top = bounds.top + radius[i], bottom = bounds.bottom - radius[i];
+      velocityX = nextX < left ? std::fabs(velocityX) * restitution
+                : nextX > right ? -std::fabs(velocityX) * restitution : velocityX;
+      velocityY = nextY < top ? std::fabs(velocityY) * restitution
+                : nextY > bottom ? -std::fabs(velocityY) * restitution : velocityY;
+      px[i] = std::min(std::max(nextX, left), right);
+      py[i] = std::min(std::max(nextY, top), bottom);
+      pvx[i] = velocityX;
+      pvy[i] = velocityY;
+    }
+  });
+}
@@ -0,0 +1,476 @@
+#include "thermostat.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t THERMOSTAT_GRAIN = 1024;
+
+// Sum of vx^2 + vy^2 over [begin, end)
+double energyKernel(const float *vx, const float *vy, size_t begin, size_t end) {
+  size_t i = begin;
+  double total = 0.0;
+#if defined(__AVX__)
+  __m256 sum = _mm256_setzero_ps();
+  for (; i + 8 <= end; i += 8) {
+    __m256 u = _mm256_loadu_ps(vx + i);
+    __m256 w = _mm256_loadu_ps(vy + i);
+    sum = _mm256_add_ps(sum, _mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(w, w)));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, sum);
+  for (float lane : lanes) {
+    total += lane;
+  }
+#elif defined(__SSE2__)
+  __m128 sum = _mm_setzero_ps();
+  for (; i + 4 <= end; i += 4) {
+    __m128 u = _mm_loadu_ps(vx + i);
+    __m128 w = _mm_loadu_ps(vy + i);
+    sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(w, w)));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  for (float lane : lanes) {
+    total += lane;
+  }
+#endif
+  for (; i < end; ++i) {
+    total += vx[i] * vx[i] + vy[i] * vy[i];
+  }
+  return total;
+}
+
+// Multiplies the velocities by factor and writes the new speeds
+void scaleKernel(float *vx, float *vy, float *speed, size_t begin, size_t end,
+                 float factor) {
+  size_t i = begin;
+#if defined(__AVX__)
+  const __m256 f = _mm256_set1_ps(factor);
+  for (; i + 8 <= end; i += 8) {
+    __m256 u = _mm256_mul_ps(_mm256_loadu_ps(vx + i), f);
+    __m256 w = _mm256_mul_ps(_mm256_loadu_ps(vy + i), f);
+    _mm256_storeu_ps(vx + i, u);
+    _mm256_storeu_ps(vy + i, w);
+    _mm256_storeu_ps(speed + i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(u, u),
+                                                             _mm256_mul_ps(w, w))));
+  }
+#elif defined(__SSE2__)
+  const __m128 f = _mm_set1_ps(factor);
+  for (; i + 4 <= end; i += 4) {
+    __m128 u = _mm_mul_ps(_mm_loadu_ps(vx + i), f);
+    __m128 w = _mm_mul_ps(_mm_loadu_ps(vy + i), f);
+    _mm_storeu_ps(vx + i, u);
+    _mm_storeu_ps(vy + i, w);
+    _mm_storeu_ps(speed + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(w, w))));
+  }
+#endif
+  for (; i < end; ++i) {
+    vx[i] *= factor;
+    vy[i] *= factor;
+    speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+  }
+}
+
+// Sets each speed to SPEED_PER_DEGREE * temperature, keeping the direction.
+// A particle at rest is sent along +x, as atan2(0, 0) did.
+void retargetKernel(float *vx, float *vy, float *speed, const float *temperature,
+                    size_t begin, size_t end) {
+  size_t i = begin;
+#if defined(__AVX__)
+  const __m256 perDegree = _mm256_set1_ps(SPEED_PER_DEGREE);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= end; i += 8) {
+    __m256 u = _mm256_loadu_ps(vx + i);
+    __m256 w = _mm256_loadu_ps(vy + i);
+    __m256 target = _mm256_mul_ps(_mm256_loadu_ps(temperature + i), perDegree);
+    __m256 squared = _mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(w, w));
+    __m256 moving = _mm256_cmp_ps(squared, zero, _CMP_GT_OQ);
+    __m256 f = _mm256_div_ps(target, _mm256_sqrt_ps(squared));
+    _mm256_storeu_ps(vx + i, _mm256_blendv_ps(target, _mm256_mul_ps(u, f), moving));
+    _mm256_storeu_ps(vy + i, _mm256_and_ps(_mm256_mul_ps(w, f), moving));
+    _mm256_storeu_ps(speed + i, _mm256_andnot_ps(sign, target));
+  }
+#elif defined(__SSE2__)
+  const __m128 perDegree = _mm_set1_ps(SPEED_PER_DEGREE);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= end; i += 4) {
+    __m128 u = _mm_loadu_ps(vx + i);
+    __m128 w = _mm_loadu_ps(vy + i);
+    __m128 target = _mm_mul_ps(_mm_loadu_ps(temperature + i), perDegree);
+    __m128 squared = _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(w, w));
+    __m128 moving = _mm_cmpgt_ps(squared, zero);
+    __m128 f = _mm_div_ps(target, _mm_sqrt_ps(squared));
+    _mm_storeu_ps(vx + i, _mm_or_ps(_mm_and_ps(moving, _mm_mul_ps(u, f)),
+                                    _mm_andnot_ps(moving, target)));
+    _mm_storeu_ps(vy + i, _mm_and_ps(_mm_mul_ps(w, f), moving));
+    _mm_storeu_ps(speed + i, _mm_andnot_ps(sign, target));
+  }
+#endif
+  for (; i < end; ++i) {
+    float target = temperature[i] * SPEED_PER_DEGREE;
+    float squared = vx[i] * vx[i] + vy[i] * vy[i];
+    if (squared > 0.0f) {
+      float f = target / std::sqrt(squared);
+      vx[i] *= f;
+      vy[i] *= f;
+    } else {
+      vx[i] = target;
+      vy[i] = 0.0f;
+    }
+    speed[i] = std::fabs(target);
+  }
+}
+
+// Adds the speeds in [begin, end) to bins and returns their sum of squares
+double binKernel(const float *speed, size_t begin, size_t end, uint32_t *bins,
+                 float inverseWidth, int binCount) {
+  double squares = 0.0;
+  const float lastBin = static_cast<float>(binCount - 1);
+  for (size_t i = begin; i < end; ++i) {
+    squares += speed[i] * speed[i];
+    // Written so that NaN speeds land in the last bin too
+    const float bin = speed[i] * inverseWidth;
+    ++bins[static_cast<int>(!(bin < lastBin) ? lastBin : bin)];
+  }
+  return squares;
+}
+
+float gaussian(Pcg32 &rng) {
+  float u = std::max(rng.nextFloat(), 1e-7f);
+  float v = rng.nextFloat();
+  return std::sqrt(-2.0f * std::log(u)) * std::cos(6.28318531f * v);
+}
+
+// Sum of n squared standard normals, drawn as 2 * Gamma(n / 2) with
+// Marsaglia and Tsang's method rather than n separate draws
+double chiSquared(int n, Pcg32 &rng) {
+  if (n <= 0) {
+    return 0.0;
+  }
+  if (n == 1) {
+    double g = gaussian(rng);
+    return g * g;
+  }
+  const double d = n / 2.0 - 1.0 / 3.0;
+  const double c = 1.0 / std::sqrt(9.0 * d);
+  for (;;) {
+    double x = gaussian(rng);
+    double v = 1.0 + c * x;
+    if (v <= 0.0) {
+      continue;
+    }
+    v = v * v * v;
+    double u = std::max(static_cast<double>(rng.nextFloat()), 1e-12);
+    if (u < 1.0 - 0.0331 * x * x * x * x ||
+        std::log(u) < 0.5 * x * x + d * (1.0 - v + std::log(v))) {
+      return 2.0 * d * v;
+    }
+  }
+}
+
+} // namespace
+
+const char *thermostatModeName(ThermostatMode mode) {
+  switch (mode) {
+  case ThermostatMode::PerParticle:
+    return "Per Particle";
+  case ThermostatMode::Berendsen:
+    return "Berendsen";
+  case ThermostatMode::VelocityRescale:
+    return "Velocity Rescale";
+  case ThermostatMode::Andersen:
+    return "Andersen";
+  case ThermostatMode::Off:
+    return "Off";
+  }
+  return "Unknown";
+}
+
+float SpeedHistogram::expected(int bin) const {
+  if (counts.empty() || !(meanSquaredSpeed > 0.0f)) {
+    return 0.0f;
+  }
+  // 2D Maxwell-Boltzmann: P(speed < v) = 1 - exp(-v^2 / <v^2>)
+  double low = bin * binWidth;
+  double high = (bin + 1) * binWidth;
+  double below = 1.0 - std::exp(-low * low / meanSquaredSpeed);
+  double upTo = bin + 1 == static_cast<int>(counts.size())
+                    ? 1.0
+                    : 1.0 - std::exp(-high * high / meanSquaredSpeed);
+  return static_cast<float>(particles * (upTo - below));
+}
+
+int Thermostat::groupOf(float x, float y) const {
+  for (size_t r = 0; r < settings.regions.size(); ++r) {
+    const BarrierBounds &region = settings.regions[r].region;
+    if (x >= region.left && x <= region.right && y >= region.top &&
+        y <= region.bottom) {
+      return static_cast<int>(r) + 1;
+    }
+  }
+  return 0;
+}
+
+float Thermostat::groupTarget(int group) const {
+  return group == 0 ? settings.temperature : settings.regions[group - 1].temperature;
+}
+
+void Thermostat::apply(ParticleSystem &system, float deltaTime, ThreadPool &pool,
+                       Pcg32 &rng) {
+  PROFILE_SCOPE("Thermostat");
+  measureGroups(system, pool);
+  chooseFactors(groupEnergy, groupCount, deltaTime, rng);
+  applyFactors(system, factor, deltaTime, pool, rng);
+}
+
+void Thermostat::measureGroups(const ParticleSystem &system, ThreadPool &pool) {
+  groups = groupTotal();
+  switch (settings.mode) {
+  case ThermostatMode::Berendsen:
+  case ThermostatMode::VelocityRescale:
+  case ThermostatMode::Andersen:
+    measure(system, pool);
+    break;
+  case ThermostatMode::PerParticle:
+  case ThermostatMode::Off:
+    groupEnergy.assign(groups, 0.0);
+    groupCount.assign(groups, 0);
+    break;
+  }
+}
+
+void Thermostat::chooseFactors(const std::vector<double> &energy,
+                               const std::vector<size_t> &count, float deltaTime,
+                               Pcg32 &rng) {
+  groups = groupTotal();
+  factor.assign(groups, 1.0f);
+  if (settings.mode == ThermostatMode::PerParticle || settings.mode == ThermostatMode::Off) {
+    measured.clear();
+    return;
+  }
+  measured.assign(groups, 0.0f);
+  for (int g = 0; g < groups; ++g) {
+    if (count[g] > 0) {
+      measured[g] = static_cast<float>(std::sqrt(energy[g] / count[g]) / SPEED_PER_DEGREE);
+    }
+  }
+
+  if (settings.mode == ThermostatMode::Berendsen) {
+    for (int g = 0; g < groups; ++g) {
+      float target = SPEED_PER_DEGREE * groupTarget(g);
+      double wanted = static_cast<double>(target) * target * count[g];
+      double ratio = energy[g] > 0.0 ? wanted / energy[g] : 1.0;
+      double squared = 1.0 + deltaTime / settings.timeConstant * (ratio - 1.0);
+      factor[g] = static_cast<float>(std::sqrt(std::max(0.0, squared)));
+    }
+  } else if (settings.mode == ThermostatMode::VelocityRescale) {
+    for (int g = 0; g < groups; ++g) {
+      if (!(energy[g] > 0.0)) {
+        continue;
+      }
+      // Bussi, Donadio and Parrinello (2007), eq. A7, with two degrees of
+      // freedom per particle
+      const int freedom = 2 * static_cast<int>(count[g]);
+      float target = SPEED_PER_DEGREE * groupTarget(g);
+      double wanted = static_cast<double>(target) * target * count[g];
+      double c = std::exp(-deltaTime / settings.timeConstant);
+      double share = wanted / (freedom * energy[g]);
+      double r1 = gaussian(rng);
+      double squared = c + (1.0 - c) * share * (r1 * r1 + chiSquared(freedom - 1, rng)) +
+                       2.0 * r1 * std::sqrt(c * (1.0 - c) * share);
+      factor[g] = static_cast<float>(std::sqrt(std::max(0.0, squared)));
+    }
+  }
+}
+
+void Thermostat::applyFactors(ParticleSystem &system, const std::vector<float> &factors,
+                              float deltaTime, ThreadPool &pool, Pcg32 &rng) {
+  if (&factors != &factor) {
+    factor = factors;
+  }
+  beginHistogram(pool.threadCount());
+  if (system.empty()) {
+    finishHistogram(system);
+    return;
+  }
+
+  switch (settings.mode) {
+  case ThermostatMode::PerParticle:
+    rescaleToOwnTemperature(system, pool);
+    break;
+
+  case ThermostatMode::Berendsen:
+  case ThermostatMode::VelocityRescale:
+    scaleGroups(system, pool);
+    break;
+
+  case ThermostatMode::Andersen:
+    andersen(system, deltaTime, rng);
+    groups = 1;
+    factor.assign(1, 1.0f);
+    scaleGroups(system, pool);
+    break;
+
+  case ThermostatMode::Off:
+    // Still writes the speeds and histogram
+    groups = 1;
+    factor.assign(1, 1.0f);
+    scaleGroups(system, pool);
+    break;
+  }
+  finishHistogram(system);
+}
+
+void Thermostat::mergeHistograms(const std::vector<SpeedHistogram> &parts) {
+  speeds = SpeedHistogram();
+  double squares = 0.0;
+  for (const SpeedHistogram &part : parts) {
+    if (speeds.counts.size() < part.counts.size()) {
+      speeds.counts.resize(part.counts.size(), 0.0f);
+    }
+    for (size_t b = 0; b < part.counts.size(); ++b) {
+      speeds.counts[b] += part.counts[b];
+    }
+    speeds.binWidth = part.binWidth;
+    speeds.particles += part.particles;
+    squares += static_cast<double>(part.meanSquaredSpeed) * part.particles;
+  }
+  speeds.meanSquaredSpeed =
+      speeds.particles ? static_cast<float>(squares / speeds.particles) : 0.0f;
+}
+
+void Thermostat::measure(const ParticleSystem &system, ThreadPool &pool) {
+  const size_t count = system.size();
+  const int chunks = static_cast<int>((count + THERMOSTAT_GRAIN - 1) / THERMOSTAT_GRAIN);
+  chunkEnergy.assign(static_cast<size_t>(chunks) * groups, 0.0);
+  chunkCount.assign(static_cast<size_t>(chunks) * groups, 0);
+  if (groups > 1) {
+    group.resize(count);
+  }
+  pool.run(chunks, [&](int chunk, int) {
+    const size_t begin = static_cast<size_t>(chunk) * THERMOSTAT_GRAIN;
+    const size_t end = std::min(count, begin + THERMOSTAT_GRAIN);
+    double *energy = &chunkEnergy[static_cast<size_t>(chunk) * groups];
+    size_t *members = &chunkCount[static_cast<size_t>(chunk) * groups];
+    if (groups == 1) {
+      energy[0] = energyKernel(system.vx.data(), system.vy.data(), begin, end);
+      members[0] = end - begin;
+      return;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      int g = groupOf(system.x[i], system.y[i]);
+      group[i] = g;
+      energy[g] += system.vx[i] * system.vx[i] + system.vy[i] * system.vy[i];
+      ++members[g];
+    }
+  });
+
+  groupEnergy.assign(groups, 0.0);
+  groupCount.assign(groups, 0);
+  for (int c = 0; c < chunks; ++c) {
+    for (int g = 0; g < groups; ++g) {
+      groupEnergy[g] += chunkEnergy[static_cast<size_t>(c) * groups + g];
+      groupCount[g] += chunkCount[static_cast<size_t>(c) * groups + g];
+    }
+  }
+}
+
+void Thermostat::scaleGroups(ParticleSystem &system, ThreadPool &pool) {
+  const int bins = settings.histogramBins;
+  const float inverseWidth = 1.0f / speeds.binWidth;
+  pool.parallelFor(system.size(), THERMOSTAT_GRAIN,
+                   [&](size_t begin, size_t end, int thread) {
+                     float *vx = system.vx.data();
+                     float *vy = system.vy.data();
+                     float *speed = system.speed.data();
+                     if (groups == 1) {
+                       scaleKernel(vx, vy, speed, begin, end, factor[0]);
+                     } else {
+                       for (size_t i = begin; i < end; ++i) {
+                         float f = factor[group[i]];
+                         vx[i] *= f;
+                         vy[i] *= f;
+                         speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+                       }
+                     }
+                     threadSquares[thread] += binKernel(
+                         speed, begin, end, &threadBins[thread * bins],
+                         inverseWidth, bins);
+                   });
+}
+
+void Thermostat::rescaleToOwnTemperature(ParticleSystem &system, ThreadPool &pool) {
+  const int bins = settings.histogramBins;
+  const float inverseWidth = 1.0f / speeds.binWidth;
+  pool.parallelFor(system.size(), THERMOSTAT_GRAIN,
+                   [&](size_t begin, size_t end, int thread) {
+                     retargetKernel(system.vx.data(), system.vy.data(),
+                                    system.speed.data(), system.temperature.data(),
+                                    begin, end);
+                     threadSquares[thread] += binKernel(
+                         system.speed.data(), begin, end,
+                         &threadBins[thread * bins], inverseWidth, bins);
+                   });
+}
+
+// Each particle collides with the bath with probability p per step. Rather
+// than drawing a number per particle, jump straight to the next one hit: the
+// gaps between hits are geometrically distributed.
+void Thermostat::andersen(ParticleSystem &system, float deltaTime, Pcg32 &rng) {
+  const double p = 1.0 - std::exp(-static_cast<double>(settings.collisionRate) * deltaTime);
+  if (!(p > 0.0)) {
+    return;
+  }
+  const double logMiss = p < 1.0 ? std::log(1.0 - p) : 0.0;
+  auto gap = [&]() -> size_t {
+    if (p >= 1.0) {
+      return 0;
+    }
+    double u = std::max(static_cast<double>(rng.nextFloat()), 1e-12);
+    return static_cast<size_t>(std::log(u) / logMiss);
+  };
+
+  const size_t count = system.size();
+  for (size_t i = gap(); i < count; i += 1 + gap()) {
+    // Each velocity component has variance <v^2> / 2 in 2D
+    int g = groups > 1 ? group[i] : 0;
+    float sigma = SPEED_PER_DEGREE * groupTarget(g) * 0.70710678f;
+    system.vx[i] = sigma * gaussian(rng);
+    system.vy[i] = sigma * gaussian(rng);
+  }
+}
+
+void Thermostat::beginHistogram(int threads) {
+  settings.histogramBins = std::max(1, settings.histogramBins);
+  settings.histogramMaxSpeed = std::max(1.0f, settings.histogramMaxSpeed);
+  speeds.binWidth = settings.histogramMaxSpeed / settings.histogramBins;
+  threadBins.assign(static_cast<size_t>(threads) * settings.histogramBins, 0);
+  threadSquares.assign(threads, 0.0);
+}
+
+void Thermostat::finishHistogram(const ParticleSystem &system) {
+  const int bins = settings.histogramBins;
+  const int threads = static_cast<int>(threadSquares.size());
+  speeds.counts.assign(bins, 0.0f);
+  double squares = 0.0;
+  for (int t = 0; t < threads; ++t) {
+    for (int b = 0; b < bins; ++b) {
+      speeds.counts[b] += static_cast<float>(threadBins[t * bins + b]);
+    }
+    squares += threadSquares[t];
+  }
+  speeds.particles = system.size();
+  speeds.meanSquaredSpeed =
+      system.empty() ? 0.0f : static_cast<float>(squares / system.size());
+}
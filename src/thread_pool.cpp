@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+#include "profiler.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) : nextTask(0) { resize(threadCount); }
+
+ThreadPool::~ThreadPool() { stopWorkers(); }
+
+int ThreadPool::hardwareThreads() {
+  unsigned count = std::thread::hardware_concurrency();
+  return count == 0 ? 1 : static_cast<int>(count);
+}
+
+void ThreadPool::resize(int threadCount) {
+  threadCount = std::max(1, threadCount);
+  if (threadCount == this->threadCount()) {
+    return;
+  }
+
+  stopWorkers();
+  unsigned current;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = false;
+    current = generation;
+  }
+  for (int i = 1; i < threadCount; ++i) {
+    workers.emplace_back(&ThreadPool::workerLoop, this, i, current);
+  }
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::drain(const std::function<void(int, int)> &task,
+                       int taskCount, int threadIndex) {
+  PROFILE_SCOPE("Pool tasks");
+  for (int index = nextTask.fetch_add(1); index < taskCount;
+       index = nextTask.fetch_add(1)) {
+    task(index, threadIndex);
+  }
+}
+
+void ThreadPool::workerLoop(int threadIndex, unsigned startGeneration) {
+  PROFILE_ONLY(setProfileThreadName("Worker " + std::to_string(threadIndex));)
+  unsigned seenGeneration = startGeneration;
+  for (;;) {
+    const std::function<void(int, int)> *task;
+    int taskCount;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+      if (stopping) {
+        return;
+      }
+      seenGeneration = generation;
+      // The job stays valid until this worker has counted itself done
+      task = job;
+      taskCount = jobTasks;
+    }
+
+    drain(*task, taskCount, threadIndex);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pendingWorkers == 0) {
+      finished.notify_one();
+    }
+  }
+}
+
+void ThreadPool::run(int taskCount, const std::function<void(int, int)> &task) {
+  if (taskCount <= 0) {
+    return;
+  }
+  if (workers.empty() || taskCount == 1) {
+    for (int i = 0; i < taskCount; ++i) {
+      task(i, 0);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &task;
+    jobTasks = taskCount;
+    nextTask.store(0);
+    pendingWorkers = static_cast<int>(workers.size());
+    ++generation;
+  }
+  wake.notify_all();
+
+  drain(task, taskCount, 0);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return pendingWorkers == 0; });
+  job = nullptr;
+}
+
+void ThreadPool::parallelFor(
+    size_t count, size_t grain,
+    const std::function<void(size_t, size_t, int)> &body) {
+  if (count == 0) {
+    return;
+  }
+  grain = std::max<size_t>(grain, 1);
+
+  // A few chunks per thread smooths out uneven progress between threads
+  size_t chunks = static_cast<size_t>(threadCount()) * 4;
+  size_t chunkSize = (count + chunks - 1) / chunks;
+  chunkSize = std::max(grain, (chunkSize + grain - 1) / grain * grain);
+  int taskCount = static_cast<int>((count + chunkSize - 1) / chunkSize);
+
+  run(taskCount, [&](int task, int threadIndex) {
+    size_t begin = static_cast<size_t>(task) * chunkSize;
+    size_t end = std::min(count, begin + chunkSize);
+    body(begin, end, threadIndex);
+  });
+}
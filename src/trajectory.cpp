@@ -0,0 +1,483 @@
+#include "trajectory.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const char TRAJECTORY_MAGIC[8] = {'F', 'L', 'U', 'I', 'D', 'T', 'R', 'J'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const float QUANTIZED_MAX = 65535.0f;
+
+// Range of the per-frame channels (radius, speed) stored ahead of the arrays
+struct ChannelRanges {
+  float radiusLow, radiusHigh;
+  float speedLow, speedHigh;
+};
+
+uint16_t quantize(float value, float low, float high) {
+  if (!(high > low)) {
+    return 0;
+  }
+  float scaled = (value - low) / (high - low) * QUANTIZED_MAX + 0.5f;
+  return static_cast<uint16_t>(std::max(0.0f, std::min(scaled, QUANTIZED_MAX)));
+}
+
+float dequantize(uint16_t value, float low, float high) {
+  return low + (high - low) * (value / QUANTIZED_MAX);
+}
+
+void appendBytes(std::vector<uint8_t> &buffer, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+void appendQuantized(std::vector<uint8_t> &buffer, const std::vector<float> &values,
+                     float low, float high) {
+  size_t start = buffer.size();
+  buffer.resize(start + values.size() * sizeof(uint16_t));
+  uint8_t *out = buffer.data() + start;
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint16_t q = quantize(values[i], low, high);
+    std::memcpy(out + i * sizeof(uint16_t), &q, sizeof(q));
+  }
+}
+
+// Signed deltas are zigzag-mapped so small moves either way fit in one byte
+void appendVarint(std::vector<uint8_t> &buffer, int32_t delta) {
+  uint32_t value = (static_cast<uint32_t>(delta) << 1) ^
+                   static_cast<uint32_t>(delta >> 31);
+  while (value >= 0x80) {
+    buffer.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<uint8_t>(value));
+}
+
+bool readVarint(const uint8_t *&cursor, const uint8_t *end, int32_t &delta) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (cursor == end) {
+      return false;
+    }
+    uint8_t byte = *cursor++;
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      delta = static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void readQuantized(const uint8_t *data, size_t count, std::vector<uint16_t> &out) {
+  out.resize(count);
+  if (count > 0) {
+    std::memcpy(out.data(), data, count * sizeof(uint16_t));
+  }
+}
+
+void minMax(const std::vector<float> &values, float &low, float &high) {
+  low = 0.0f;
+  high = 0.0f;
+  if (values.empty()) {
+    return;
+  }
+  auto range = std::minmax_element(values.begin(), values.end());
+  low = *range.first;
+  high = *range.second;
+}
+
+} // namespace
+
+const char *trajectoryCompressionName(TrajectoryCompression compression) {
+  switch (compression) {
+  case TrajectoryCompression::Raw:
+    return "Raw";
+  case TrajectoryCompression::Quantized:
+    return "Quantized";
+  case TrajectoryCompression::DeltaQuantized:
+    return "Delta + Quantized";
+  }
+  return "Unknown";
+}
+
+bool TrajectoryWriter::open(const std::string &path, const BarrierBounds &bounds,
+                            const TrajectoryOptions &options, std::string &error) {
+  close();
+
+  file = std::fopen(path.c_str(), "wb");
+  if (!file) {
+    error = "Could not create " + path;
+    return false;
+  }
+
+  this->options = options;
+  this->options.keyframeInterval = std::max(1, options.keyframeInterval);
+  this->options.queueDepth = std::max(1, options.queueDepth);
+  this->bounds = bounds;
+
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version = TRAJECTORY_VERSION;
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.compression = static_cast<uint32_t>(options.compression);
+  header.keyframeInterval = static_cast<uint32_t>(this->options.keyframeInterval);
+  header.bounds[0] = bounds.left;
+  header.bounds[1] = bounds.right;
+  header.bounds[2] = bounds.top;
+  header.bounds[3] = bounds.bottom;
+  if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+    std::fclose(file);
+    file = nullptr;
+    error = "Could not write " + path;
+    return false;
+  }
+
+  framesWritten.store(0);
+  framesDropped.store(0);
+  bytesWritten.store(sizeof(header));
+  writeFailed = false;
+  framesSinceKeyframe = 0;
+  previousX.clear();
+  previousY.clear();
+
+  frames.assign(this->options.queueDepth, Frame());
+  freeFrames.clear();
+  for (int i = 0; i < this->options.queueDepth; ++i) {
+    freeFrames.push_back(i);
+  }
+  queuedFrames.clear();
+  closing = false;
+  thread = std::thread(&TrajectoryWriter::run, this);
+  return true;
+}
+
+void TrajectoryWriter::close() {
+  if (!file) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  ready.notify_one();
+  thread.join();
+  std::fclose(file);
+  file = nullptr;
+}
+
+bool TrajectoryWriter::submit(const ParticleSystem &system, uint64_t stepCount,
+                              double simulationTime) {
+  int slot;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeFrames.empty()) {
+      framesDropped.fetch_add(1);
+      return false;
+    }
+    slot = freeFrames.back();
+    freeFrames.pop_back();
+  }
+
+  // The slot is ours until it is queued, so copy without holding the lock
+  Frame &frame = frames[slot];
+  frame.stepCount = stepCount;
+  frame.simulationTime = simulationTime;
+  frame.x.assign(system.x.begin(), system.x.end());
+  frame.y.assign(system.y.begin(), system.y.end());
+  frame.radius.assign(system.radius.begin(), system.radius.end());
+  frame.speed.assign(system.speed.begin(), system.speed.end());
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queuedFrames.push_back(slot);
+  }
+  ready.notify_one();
+  return true;
+}
+
+TrajectoryStats TrajectoryWriter::stats() const {
+  TrajectoryStats stats;
+  stats.framesWritten = framesWritten.load();
+  stats.framesDropped = framesDropped.load();
+  stats.bytesWritten = bytesWritten.load();
+  return stats;
+}
+
+void TrajectoryWriter::run() {
+  PROFILE_ONLY(setProfileThreadName("Trajectory writer");)
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    ready.wait(lock, [this] { return closing || !queuedFrames.empty(); });
+    if (queuedFrames.empty()) {
+      break; // closing with nothing left to write
+    }
+    int slot = queuedFrames.front();
+    queuedFrames.pop_front();
+
+    lock.unlock();
+    encode(frames[slot]);
+    lock.lock();
+    freeFrames.push_back(slot);
+  }
+}
+
+void TrajectoryWriter::encode(const Frame &frame) {
+  PROFILE_SCOPE("Encode frame");
+  if (writeFailed) {
+    framesDropped.fetch_add(1);
+    return;
+  }
+
+  const size_t count = frame.x.size();
+  const TrajectoryCompression compression = options.compression;
+  bool keyframe = compression != TrajectoryCompression::DeltaQuantized ||
+                  previousX.size() != count ||
+                  framesSinceKeyframe >= static_cast<uint64_t>(options.keyframeInterval);
+
+  buffer.clear();
+  if (compression == TrajectoryCompression::Raw) {
+    appendBytes(buffer, frame.x.data(), count * sizeof(float));
+    appendBytes(buffer, frame.y.data(), count * sizeof(float));
+    appendBytes(buffer, frame.radius.data(), count * sizeof(float));
+    appendBytes(buffer, frame.speed.data(), count * sizeof(float));
+  } else {
+    ChannelRanges ranges;
+    minMax(frame.radius, ranges.radiusLow, ranges.radiusHigh);
+    minMax(frame.speed, ranges.speedLow, ranges.speedHigh);
+    appendBytes(buffer, &ranges, sizeof(ranges));
+    appendQuantized(buffer, frame.radius, ranges.radiusLow, ranges.radiusHigh);
+    appendQuantized(buffer, frame.speed, ranges.speedLow, ranges.speedHigh);
+
+    if (keyframe) {
+      appendQuantized(buffer, frame.x, bounds.left, bounds.right);
+      appendQuantized(buffer, frame.y, bounds.top, bounds.bottom);
+    }
+    if (compression == TrajectoryCompression::DeltaQuantized) {
+      previousX.resize(count);
+      previousY.resize(count);
+      for (size_t i = 0; i < count; ++i) {
+        uint16_t qx = quantize(frame.x[i], bounds.left, bounds.right);
+        uint16_t qy = quantize(frame.y[i], bounds.top, bounds.bottom);
+        if (!keyframe) {
+          appendVarint(buffer, static_cast<int32_t>(qx) - previousX[i]);
+          appendVarint(buffer, static_cast<int32_t>(qy) - previousY[i]);
+        }
+        previousX[i] = qx;
+        previousY[i] = qy;
+      }
+    }
+  }
+  framesSinceKeyframe = keyframe ? 1 : framesSinceKeyframe + 1;
+
+  TrajectoryFrameHeader frameHeader;
+  std::memset(&frameHeader, 0, sizeof(frameHeader));
+  frameHeader.size = static_cast<uint32_t>(buffer.size());
+  frameHeader.flags = keyframe ? TRAJECTORY_KEYFRAME : 0;
+  frameHeader.stepCount = frame.stepCount;
+  frameHeader.simulationTime = frame.simulationTime;
+  frameHeader.particleCount = static_cast<uint32_t>(count);
+
+  bool ok = std::fwrite(&frameHeader, sizeof(frameHeader), 1, file) == 1 &&
+            (buffer.empty() ||
+             std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size());
+  if (!ok) {
+    // A partial frame ends the file as far as readers are concerned
+    writeFailed = true;
+    framesDropped.fetch_add(1);
+    return;
+  }
+  framesWritten.fetch_add(1);
+  bytesWritten.fetch_add(sizeof(frameHeader) + buffer.size());
+}
+
+bool TrajectoryReader::open(const std::string &path, std::string &error) {
+  close();
+  if (!file.open(path, error)) {
+    return false;
+  }
+  if (file.size() < sizeof(header)) {
+    error = path + " is not a trajectory";
+    file.close();
+    return false;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0) {
+    error = path + " is not a trajectory";
+    file.close();
+    return false;
+  }
+  if (header.byteOrder != BYTE_ORDER_MARK) {
+    error = path + " was written on a machine with a different byte order";
+    file.close();
+    return false;
+  }
+  if (header.version != TRAJECTORY_VERSION ||
+      header.compression > static_cast<uint32_t>(TrajectoryCompression::DeltaQuantized)) {
+    error = path + " has unsupported trajectory version " +
+            std::to_string(header.version);
+    file.close();
+    return false;
+  }
+
+  // Index every complete frame; a torn frame at the end is ignored
+  size_t offset = sizeof(header);
+  while (file.size() - offset >= sizeof(TrajectoryFrameHeader)) {
+    TrajectoryFrameHeader frameHeader;
+    std::memcpy(&frameHeader, file.data() + offset, sizeof(frameHeader));
+    size_t payload = offset + sizeof(frameHeader);
+    if (frameHeader.size > file.size() - payload) {
+      break;
+    }
+    FrameEntry entry = {payload,
+                        frameHeader.size,
+                        frameHeader.flags,
+                        frameHeader.stepCount,
+                        frameHeader.simulationTime,
+                        frameHeader.particleCount};
+    index.push_back(entry);
+    offset = payload + frameHeader.size;
+  }
+  if (index.empty()) {
+    error = path + " contains no frames";
+    file.close();
+    return false;
+  }
+  return true;
+}
+
+void TrajectoryReader::close() {
+  file.close();
+  index.clear();
+  currentX.clear();
+  currentY.clear();
+  currentFrame = static_cast<size_t>(-1);
+}
+
+TrajectoryCompression TrajectoryReader::compression() const {
+  return static_cast<TrajectoryCompression>(header.compression);
+}
+
+BarrierBounds TrajectoryReader::bounds() const {
+  BarrierBounds bounds;
+  bounds.left = header.bounds[0];
+  bounds.right = header.bounds[1];
+  bounds.top = header.bounds[2];
+  bounds.bottom = header.bounds[3];
+  return bounds;
+}
+
+// Quantized payload: ChannelRanges, radius[n], speed[n], then positions as
+// x[n], y[n] (keyframes) or interleaved x/y varint deltas (delta frames).
+bool TrajectoryReader::decodePositions(size_t frame) {
+  if (frame == currentFrame) {
+    return true;
+  }
+
+  size_t start = frame;
+  while (!(index[start].flags & TRAJECTORY_KEYFRAME)) {
+    if (start == 0) {
+      return false; // delta frame with no keyframe before it
+    }
+    --start;
+  }
+  // Roll forward from the last decoded frame when it lies on the way
+  if (currentFrame != static_cast<size_t>(-1) && currentFrame > start &&
+      currentFrame < frame) {
+    start = currentFrame + 1;
+  } else {
+    const FrameEntry &key = index[start];
+    const size_t count = key.particleCount;
+    const size_t positions = sizeof(ChannelRanges) + 2 * count * sizeof(uint16_t);
+    if (key.size < positions + 2 * count * sizeof(uint16_t)) {
+      return false;
+    }
+    const uint8_t *data = file.data() + key.offset + positions;
+    readQuantized(data, count, currentX);
+    readQuantized(data + count * sizeof(uint16_t), count, currentY);
+    currentFrame = start;
+    ++start;
+  }
+
+  for (size_t i = start; i <= frame; ++i) {
+    const FrameEntry &entry = index[i];
+    const size_t count = entry.particleCount;
+    if (count != currentX.size()) {
+      currentFrame = static_cast<size_t>(-1);
+      return false;
+    }
+    const uint8_t *cursor =
+        file.data() + entry.offset + sizeof(ChannelRanges) + 2 * count * sizeof(uint16_t);
+    const uint8_t *end = file.data() + entry.offset + entry.size;
+    for (size_t p = 0; p < count; ++p) {
+      int32_t dx, dy;
+      if (!readVarint(cursor, end, dx) || !readVarint(cursor, end, dy)) {
+        currentFrame = static_cast<size_t>(-1);
+        return false;
+      }
+      currentX[p] = static_cast<uint16_t>(currentX[p] + dx);
+      currentY[p] = static_cast<uint16_t>(currentY[p] + dy);
+    }
+    currentFrame = i;
+  }
+  return true;
+}
+
+bool TrajectoryReader::decode(size_t frame, ParticleSnapshot &snapshot) {
+  if (frame >= index.size()) {
+    return false;
+  }
+  const FrameEntry &entry = index[frame];
+  const size_t count = entry.particleCount;
+  const uint8_t *data = file.data() + entry.offset;
+
+  snapshot.stepCount = entry.stepCount;
+  snapshot.simulationTime = entry.simulationTime;
+  snapshot.x.resize(count);
+  snapshot.y.resize(count);
+  snapshot.radius.resize(count);
+  snapshot.speed.resize(count);
+
+  if (compression() == TrajectoryCompression::Raw) {
+    if (entry.size < 4 * count * sizeof(float)) {
+      return false;
+    }
+    std::vector<float> *channels[] = {&snapshot.x, &snapshot.y, &snapshot.radius,
+                                      &snapshot.speed};
+    for (int c = 0; c < 4; ++c) {
+      if (count > 0) {
+        std::memcpy(channels[c]->data(), data + c * count * sizeof(float),
+                    count * sizeof(float));
+      }
+    }
+  } else {
+    if (entry.size < sizeof(ChannelRanges) + 2 * count * sizeof(uint16_t) ||
+        !decodePositions(frame)) {
+      return false;
+    }
+    ChannelRanges ranges;
+    std::memcpy(&ranges, data, sizeof(ranges));
+    const uint8_t *radius = data + sizeof(ranges);
+    const uint8_t *speed = radius + count * sizeof(uint16_t);
+    const BarrierBounds box = bounds();
+    for (size_t i = 0; i < count; ++i) {
+      uint16_t qr, qs;
+      std::memcpy(&qr, radius + i * sizeof(uint16_t), sizeof(qr));
+      std::memcpy(&qs, speed + i * sizeof(uint16_t), sizeof(qs));
+      snapshot.radius[i] = dequantize(qr, ranges.radiusLow, ranges.radiusHigh);
+      snapshot.speed[i] = dequantize(qs, ranges.speedLow, ranges.speedHigh);
+      snapshot.x[i] = dequantize(currentX[i], box.left, box.right);
+      snapshot.y[i] = dequantize(currentY[i], box.top, box.bottom);
+    }
+  }
+
+  float totalSpeed = 0.0f;
+  for (float speed : snapshot.speed) {
+    totalSpeed += speed;
+  }
+  snapshot.averageSpeed = count == 0 ? 0.0f : totalSpeed / count;
+  return true;
+}
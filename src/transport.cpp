@@ -0,0 +1,563 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// How long a transport blocks before re-checking liveness
+const int WAIT_MILLISECONDS = 20;
+
+// On the wire a message is its length as 8 bytes, then its bytes
+struct SendState {
+  int peer;
+  uint64_t header;
+  const char *data;
+  size_t done;
+
+  size_t total() const { return sizeof(header) + static_cast<size_t>(header); }
+  bool finished() const { return done == total(); }
+
+  // Where the next contiguous run of the stream starts, and how long it is
+  const char *next(size_t &length) const {
+    if (done < sizeof(header)) {
+      length = sizeof(header) - done;
+      return reinterpret_cast<const char *>(&header) + done;
+    }
+    length = total() - done;
+    return data + (done - sizeof(header));
+  }
+};
+
+struct ReceiveState {
+  int peer;
+  uint64_t header;
+  std::vector<char> *out;
+  size_t done;
+
+  bool finished() const {
+    return done >= sizeof(header) && done == sizeof(header) + header;
+  }
+
+  char *next(size_t &length) {
+    if (done < sizeof(header)) {
+      length = sizeof(header) - done;
+      return reinterpret_cast<char *>(&header) + done;
+    }
+    length = sizeof(header) + static_cast<size_t>(header) - done;
+    return out->data() + (done - sizeof(header));
+  }
+
+  void advance(size_t bytes) {
+    done += bytes;
+    if (done == sizeof(header)) {
+      out->resize(static_cast<size_t>(header));
+    }
+  }
+};
+
+void startTransfers(const std::vector<OutgoingMessage> &outgoing,
+                    std::vector<IncomingMessage> &incoming,
+                    std::vector<SendState> &sends,
+                    std::vector<ReceiveState> &receives) {
+  sends.clear();
+  receives.clear();
+  for (const OutgoingMessage &message : outgoing) {
+    SendState send = {message.peer, message.size, message.data, 0};
+    sends.push_back(send);
+  }
+  for (IncomingMessage &message : incoming) {
+    ReceiveState receive = {message.peer, 0, message.data, 0};
+    receives.push_back(receive);
+  }
+}
+
+} // namespace
+
+const char *transportKindName(TransportKind kind) {
+  switch (kind) {
+  case TransportKind::SharedMemory:
+    return "Shared Memory";
+  case TransportKind::UnixSocket:
+    return "Unix Socket";
+  }
+  return "Unknown";
+}
+
+#ifndef _WIN32
+
+namespace {
+
+// Unix sockets
+
+class SocketTransport : public Transport {
+public:
+  explicit SocketTransport(std::vector<int> peerSockets)
+      : sockets(std::move(peerSockets)) {
+    for (int fd : sockets) {
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      }
+    }
+  }
+
+  ~SocketTransport() {
+    for (int fd : sockets) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  bool exchange(const std::vector<OutgoingMessage> &outgoing,
+                std::vector<IncomingMessage> &incoming) override {
+    startTransfers(outgoing, incoming, sends, receives);
+    for (;;) {
+      bool pending = false;
+      polls.clear();
+      for (SendState &send : sends) {
+        if (!send.finished()) {
+          int fd;
+          if (!socketOf(send.peer, fd) || !writeSome(send)) {
+            return false;
+          }
+          if (!send.finished()) {
+            pending = true;
+            pollfd entry = {fd, POLLOUT, 0};
+            polls.push_back(entry);
+          }
+        }
+      }
+      for (ReceiveState &receive : receives) {
+        if (!receive.finished()) {
+          int fd;
+          if (!socketOf(receive.peer, fd) || !readSome(receive)) {
+            return false;
+          }
+          if (!receive.finished()) {
+            pending = true;
+            pollfd entry = {fd, POLLIN, 0};
+            polls.push_back(entry);
+          }
+        }
+      }
+      if (!pending) {
+        return true;
+      }
+      int ready = poll(polls.data(), polls.size(), WAIT_MILLISECONDS);
+      if (ready < 0 && errno != EINTR) {
+        return false;
+      }
+      if (ready == 0 && alive && !alive()) {
+        return false;
+      }
+    }
+  }
+
+  void abort() override {
+    for (int &fd : sockets) {
+      if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+      }
+    }
+  }
+
+private:
+  bool socketOf(int peer, int &fd) const {
+    fd = peer >= 0 && peer < static_cast<int>(sockets.size()) ? sockets[peer] : -1;
+    return fd >= 0;
+  }
+
+  bool writeSome(SendState &send) {
+    while (!send.finished()) {
+      size_t length;
+      const char *bytes = send.next(length);
+      ssize_t written = ::send(sockets[send.peer], bytes, length, MSG_NOSIGNAL);
+      if (written < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+      send.done += static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  bool readSome(ReceiveState &receive) {
+    while (!receive.finished()) {
+      size_t length;
+      char *bytes = receive.next(length);
+      ssize_t got = ::read(sockets[receive.peer], bytes, length);
+      if (got == 0) {
+        return false; // peer closed
+      }
+      if (got < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+      }
+      receive.advance(static_cast<size_t>(got));
+    }
+    return true;
+  }
+
+  std::vector<int> sockets; // indexed by peer rank, -1 where there is no link
+  std::vector<SendState> sends;
+  std::vector<ReceiveState> receives;
+  std::vector<pollfd> polls;
+};
+
+class SocketFabric : public TransportFabric {
+public:
+  SocketFabric(int ranks, const std::vector<std::pair<int, int>> &links)
+      : ranks(ranks), links(links), ends(links.size() * 2, -1) {}
+
+  ~SocketFabric() {
+    for (int fd : ends) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  bool create(std::string &error) {
+    for (size_t l = 0; l < links.size(); ++l) {
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        error = std::string("socketpair failed: ") + std::strerror(errno);
+        return false;
+      }
+      ends[l * 2] = pair[0];
+      ends[l * 2 + 1] = pair[1];
+    }
+    return true;
+  }
+
+  std::unique_ptr<Transport> endpoint(int rank) override {
+    std::vector<int> sockets(ranks, -1);
+    for (size_t l = 0; l < links.size(); ++l) {
+      for (int side = 0; side < 2; ++side) {
+        int &fd = ends[l * 2 + side];
+        int owner = side == 0 ? links[l].first : links[l].second;
+        int peer = side == 0 ? links[l].second : links[l].first;
+        if (owner == rank) {
+          sockets[peer] = fd;
+        } else if (fd >= 0) {
+          ::close(fd);
+        }
+        fd = -1;
+      }
+    }
+    return std::unique_ptr<Transport>(new SocketTransport(sockets));
+  }
+
+private:
+  int ranks;
+  std::vector<std::pair<int, int>> links;
+  std::vector<int> ends; // two per link, the first for links[l].first
+};
+
+// Shared memory
+
+void waitOn(std::atomic<uint32_t> *word, uint32_t expected) {
+#if defined(__linux__)
+  timespec timeout = {0, WAIT_MILLISECONDS * 1000000L};
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected,
+          &timeout, nullptr, 0);
+#else
+  (void)word;
+  (void)expected;
+  timespec pause = {0, 100000L};
+  nanosleep(&pause, nullptr);
+#endif
+}
+
+void wakeAll(std::atomic<uint32_t> *word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// Counters on separate cache lines so producer and consumer do not share one
+struct alignas(64) RingHeader {
+  std::atomic<uint64_t> head; // bytes written, only the producer stores
+  char padding[56];
+  std::atomic<uint64_t> tail; // bytes read, only the consumer stores
+};
+
+struct alignas(64) Doorbell {
+  // Bumped whenever someone moves data to or from this rank's rings; the
+  // rank sleeps on it
+  std::atomic<uint32_t> rings;
+};
+
+struct ControlBlock {
+  std::atomic<uint32_t> aborted;
+};
+
+class SharedMemoryTransport : public Transport {
+public:
+  struct Channel {
+    RingHeader *out = nullptr, *in = nullptr;
+    char *outBytes = nullptr, *inBytes = nullptr;
+  };
+
+  SharedMemoryTransport(int rank, ControlBlock *control, Doorbell *doorbells,
+                        std::vector<Channel> channels, size_t capacity)
+      : rank(rank), control(control), doorbells(doorbells),
+        channels(std::move(channels)), capacity(capacity) {}
+
+  bool exchange(const std::vector<OutgoingMessage> &outgoing,
+                std::vector<IncomingMessage> &incoming) override {
+    for (const OutgoingMessage &message : outgoing) {
+      if (!hasChannel(message.peer)) {
+        return false;
+      }
+    }
+    for (const IncomingMessage &message : incoming) {
+      if (!hasChannel(message.peer)) {
+        return false;
+      }
+    }
+    startTransfers(outgoing, incoming, sends, receives);
+    int idleWaits = 0;
+    for (;;) {
+      uint32_t bell = doorbells[rank].rings.load(std::memory_order_acquire);
+      bool pending = false, progress = false;
+      for (SendState &send : sends) {
+        if (!send.finished()) {
+          progress |= produce(send);
+          pending |= !send.finished();
+        }
+      }
+      for (ReceiveState &receive : receives) {
+        if (!receive.finished()) {
+          progress |= consume(receive);
+          pending |= !receive.finished();
+        }
+      }
+      if (!pending) {
+        return true;
+      }
+      if (control->aborted.load(std::memory_order_acquire)) {
+        return false;
+      }
+      if (progress) {
+        idleWaits = 0;
+        continue;
+      }
+      waitOn(&doorbells[rank].rings, bell);
+      if (++idleWaits % 5 == 0 && alive && !alive()) {
+        return false;
+      }
+    }
+  }
+
+  void abort() override {
+    control->aborted.store(1, std::memory_order_release);
+    for (size_t peer = 0; peer < channels.size(); ++peer) {
+      if (channels[peer].out) {
+        ring(static_cast<int>(peer));
+      }
+    }
+  }
+
+private:
+  bool hasChannel(int peer) const {
+    return peer >= 0 && peer < static_cast<int>(channels.size()) && channels[peer].out;
+  }
+
+  void ring(int peer) {
+    doorbells[peer].rings.fetch_add(1, std::memory_order_release);
+    wakeAll(&doorbells[peer].rings);
+  }
+
+  bool produce(SendState &send) {
+    Channel &channel = channels[send.peer];
+    const uint64_t head = channel.out->head.load(std::memory_order_relaxed);
+    const uint64_t tail = channel.out->tail.load(std::memory_order_acquire);
+    uint64_t space = capacity - (head - tail);
+    uint64_t written = 0;
+    while (space > 0 && !send.finished()) {
+      size_t length;
+      const char *bytes = send.next(length);
+      size_t offset = static_cast<size_t>((head + written) % capacity);
+      size_t run = static_cast<size_t>(std::min<uint64_t>(
+          std::min<uint64_t>(length, space), capacity - offset));
+      std::memcpy(channel.outBytes + offset, bytes, run);
+      send.done += run;
+      written += run;
+      space -= run;
+    }
+    if (written == 0) {
+      return false;
+    }
+    channel.out->head.store(head + written, std::memory_order_release);
+    ring(send.peer);
+    return true;
+  }
+
+  bool consume(ReceiveState &receive) {
+    Channel &channel = channels[receive.peer];
+    const uint64_t tail = channel.in->tail.load(std::memory_order_relaxed);
+    const uint64_t head = channel.in->head.load(std::memory_order_acquire);
+    uint64_t available = head - tail;
+    uint64_t read = 0;
+    while (available > 0 && !receive.finished()) {
+      size_t length;
+      char *bytes = receive.next(length);
+      size_t offset = static_cast<size_t>((tail + read) % capacity);
+      size_t run = static_cast<size_t>(std::min<uint64_t>(
+          std::min<uint64_t>(length, available), capacity - offset));
+      std::memcpy(bytes, channel.inBytes + offset, run);
+      receive.advance(run);
+      read += run;
+      available -= run;
+    }
+    if (read == 0) {
+      return false;
+    }
+    channel.in->tail.store(tail + read, std::memory_order_release);
+    ring(receive.peer);
+    return true;
+  }
+
+  int rank;
+  ControlBlock *control;
+  Doorbell *doorbells;
+  std::vector<Channel> channels; // indexed by peer rank
+  size_t capacity;
+  std::vector<SendState> sends;
+  std::vector<ReceiveState> receives;
+};
+
+// One anonymous shared mapping: control block, a doorbell per rank, then a
+// ring per direction of every link
+class SharedMemoryFabric : public TransportFabric {
+public:
+  SharedMemoryFabric(int ranks, const std::vector<std::pair<int, int>> &links,
+                     size_t ringBytes)
+      : ranks(ranks), links(links),
+        capacity(std::max<size_t>(64, (ringBytes + 63) / 64 * 64)) {}
+
+  ~SharedMemoryFabric() {
+    if (region) {
+      munmap(region, regionSize);
+    }
+  }
+
+  bool create(std::string &error) {
+    doorbellOffset = (sizeof(ControlBlock) + 63) / 64 * 64;
+    ringOffset = doorbellOffset + sizeof(Doorbell) * ranks;
+    ringStride = sizeof(RingHeader) + capacity;
+    regionSize = ringOffset + ringStride * links.size() * 2;
+    void *memory = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      error = std::string("Could not map shared memory: ") + std::strerror(errno);
+      return false;
+    }
+    region = static_cast<char *>(memory);
+    ControlBlock *control = new (region) ControlBlock;
+    control->aborted.store(0);
+    for (int r = 0; r < ranks; ++r) {
+      Doorbell *doorbell = new (region + doorbellOffset + sizeof(Doorbell) * r) Doorbell;
+      doorbell->rings.store(0);
+    }
+    for (size_t i = 0; i < links.size() * 2; ++i) {
+      RingHeader *header = new (region + ringOffset + ringStride * i) RingHeader;
+      header->head.store(0);
+      header->tail.store(0);
+    }
+    return true;
+  }
+
+  std::unique_ptr<Transport> endpoint(int rank) override {
+    std::vector<SharedMemoryTransport::Channel> channels(ranks);
+    for (size_t l = 0; l < links.size(); ++l) {
+      // Ring 2l carries first -> second, ring 2l + 1 the other way
+      int first = links[l].first, second = links[l].second;
+      if (rank != first && rank != second) {
+        continue;
+      }
+      bool isFirst = rank == first;
+      SharedMemoryTransport::Channel &channel = channels[isFirst ? second : first];
+      char *forward = region + ringOffset + ringStride * (l * 2);
+      char *backward = region + ringOffset + ringStride * (l * 2 + 1);
+      char *out = isFirst ? forward : backward;
+      char *in = isFirst ? backward : forward;
+      channel.out = reinterpret_cast<RingHeader *>(out);
+      channel.outBytes = out + sizeof(RingHeader);
+      channel.in = reinterpret_cast<RingHeader *>(in);
+      channel.inBytes = in + sizeof(RingHeader);
+    }
+    return std::unique_ptr<Transport>(new SharedMemoryTransport(
+        rank, reinterpret_cast<ControlBlock *>(region),
+        reinterpret_cast<Doorbell *>(region + doorbellOffset), channels,
+        capacity));
+  }
+
+private:
+  int ranks;
+  std::vector<std::pair<int, int>> links;
+  size_t capacity;
+  char *region = nullptr;
+  size_t regionSize = 0, doorbellOffset = 0, ringOffset = 0, ringStride = 0;
+};
+
+} // namespace
+
+std::unique_ptr<TransportFabric>
+createTransportFabric(TransportKind kind, int ranks,
+                      const std::vector<std::pair<int, int>> &links,
+                      size_t ringBytes, std::string &error) {
+  for (const std::pair<int, int> &link : links) {
+    if (link.first < 0 || link.first >= ranks || link.second < 0 ||
+        link.second >= ranks || link.first == link.second) {
+      error = "Invalid transport link";
+      return nullptr;
+    }
+  }
+  if (kind == TransportKind::UnixSocket) {
+    std::unique_ptr<SocketFabric> fabric(new SocketFabric(ranks, links));
+    if (!fabric->create(error)) {
+      return nullptr;
+    }
+    return std::unique_ptr<TransportFabric>(fabric.release());
+  }
+  std::unique_ptr<SharedMemoryFabric> fabric(
+      new SharedMemoryFabric(ranks, links, ringBytes));
+  if (!fabric->create(error)) {
+    return nullptr;
+  }
+  return std::unique_ptr<TransportFabric>(fabric.release());
+}
+
+#else
+
+std::unique_ptr<TransportFabric>
+createTransportFabric(TransportKind, int, const std::vector<std::pair<int, int>> &,
+                      size_t, std::string &error) {
+  error = "Multi-process transports need POSIX";
+  return nullptr;
+}
+
+#endif